@@ -0,0 +1,29 @@
+/*
+ * linux/arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef __ARM_NEON__
+/*
+ * Code built with -mfpu=neon may get NEON instructions anywhere the
+ * compiler sees fit, so it must live in a compilation unit of its own
+ * and be called from between kernel_neon_begin() and kernel_neon_end()
+ * in another one.
+ */
+#define kernel_neon_begin()	BUILD_BUG_ON(1)
+#else
+void kernel_neon_begin(void);
+#endif
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
@@ -105,6 +105,11 @@ static struct resource sprd_nand_resources[] = {
 		.end = SPRD_NAND_BASE + SPRD_NAND_SIZE - 1,
 		.flags	= IORESOURCE_MEM,
 	},
+	[2] = {
+		.start	= IRQ_NLC_INT,
+		.end = IRQ_NLC_INT,
+		.flags	= IORESOURCE_IRQ,
+	},
 };
 
 struct platform_device sprd_nand_device = {
@@ -656,6 +656,16 @@ static void nand_command_lp(struct mtd_info *mtd, unsigned int command,
 		command = NAND_CMD_READ0;
 	}
 
+	/*
+	 * A cache read is started by READCACHESEQ with a page address: the
+	 * page is read normally, READCACHESEQ then makes it available while
+	 * the next page is loaded.
+	 */
+	if (command == NAND_CMD_READCACHESEQ && page_addr != -1) {
+		nand_command_lp(mtd, NAND_CMD_READ0, column, page_addr);
+		column = page_addr = -1;
+	}
+
 	/* Command latch cycle */
 	chip->cmd_ctrl(mtd, command & 0xff,
 		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
@@ -1442,10 +1452,36 @@ static uint8_t *nand_transfer_oob(struct nand_chip *chip, uint8_t *oob,
  *
  * Internal function. Called with chip held.
  */
+/**
+ * nand_cache_read_pages - [Internal] Pages to read in one cache read
+ * @mtd:	MTD device structure
+ * @chip:	nand chip info structure
+ * @page:	first page
+ * @col:	column in the first page
+ * @readlen:	number of bytes left to read
+ *
+ * Returns how many of the pages to read, up to the end of the block, can
+ * be read with one cache read sequence; 1 if cache read is not used.
+ */
+static int nand_cache_read_pages(struct mtd_info *mtd, struct nand_chip *chip,
+				 int page, int col, uint32_t readlen)
+{
+	int blkpages = 1 << (chip->phys_erase_shift - chip->page_shift);
+	int pages;
+
+	if (!NAND_HAS_CACHEREAD(chip) || mtd->writesize <= 512)
+		return 1;
+
+	pages = (col + readlen + mtd->writesize - 1) >> chip->page_shift;
+
+	return min(pages, blkpages - (page & (blkpages - 1)));
+}
+
 static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			    struct mtd_oob_ops *ops)
 {
 	int chipnr, page, realpage, col, bytes, aligned;
+	int cachepages = 0, cachecmd, nocache = 0;
 	struct nand_chip *chip = mtd->priv;
 	struct mtd_ecc_stats stats;
 	int blkcheck = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
@@ -1479,11 +1515,50 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		bytes = min(mtd->writesize - col, readlen);
 		aligned = (bytes == mtd->writesize);
 
-		/* Is the current page in the buffer ? */
-		if (realpage != chip->pagebuf || oob) {
+		/*
+		 * Is the current page in the buffer ? Pages of a cache read
+		 * are output by the chip anyway.
+		 */
+		if (realpage != chip->pagebuf || oob || cachepages) {
 			bufpoi = aligned ? buf : chip->buffers->databuf;
 
-			if (likely(sndcmd)) {
+			cachecmd = 1;
+			if (cachepages) {
+				chip->cmdfunc(mtd, cachepages > 1 ?
+					      NAND_CMD_READCACHESEQ :
+					      NAND_CMD_READCACHEEND, -1, -1);
+				cachepages--;
+			} else if (sndcmd && !nocache &&
+				   (cachepages = nand_cache_read_pages(mtd,
+						chip, page, col, readlen) - 1)) {
+				chip->cmdfunc(mtd, NAND_CMD_READCACHESEQ,
+					      0x00, page);
+				sndcmd = 0;
+			} else
+				cachecmd = 0;
+#ifdef CONFIG_MTD_NAND_SC8810
+			/*
+			 * The controller was reset and the page is lost: end
+			 * the cache read and read the rest of the block page
+			 * by page, with the retries below.
+			 */
+			if (cachecmd && chip->nfc_operation_status(mtd) ==
+			    NFC_CMD_OPER_TIMEOUT) {
+				if (cachepages) {
+					chip->cmdfunc(mtd, NAND_CMD_READCACHEEND,
+						      -1, -1);
+					nfcstatus = chip->nfc_operation_status(mtd);
+					if (nfcstatus == NFC_CMD_OPER_TIMEOUT)
+						chip->cmdfunc(mtd, NAND_CMD_RESET,
+							      -1, -1);
+				}
+				cachepages = 0;
+				cachecmd = 0;
+				nocache = 1;
+				sndcmd = 1;
+			}
+#endif
+			if (!cachecmd && likely(sndcmd)) {
 #ifdef CONFIG_MTD_NAND_SC8810
 				for (count = 0; count < NFC_CMD_MAX_CNT; count++) {
 					chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
@@ -1504,14 +1579,20 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			if (unlikely(ops->mode == MTD_OOB_RAW))
 				ret = chip->ecc.read_page_raw(mtd, chip,
 							      bufpoi, page);
-			else if (!aligned && NAND_SUBPAGE_READ(chip) && !oob)
+			else if (!aligned && NAND_SUBPAGE_READ(chip) && !oob &&
+				 !cachepages)
 				ret = chip->ecc.read_subpage(mtd, chip,
 							col, bytes, bufpoi);
 			else
 				ret = chip->ecc.read_page(mtd, chip, bufpoi,
 							  page);
-			if (ret < 0)
+			if (ret < 0) {
+				/* Don't leave the chip in the cache read */
+				if (cachepages)
+					chip->cmdfunc(mtd, NAND_CMD_READCACHEEND,
+						      -1, -1);
 				break;
+			}
 
 			/* Transfer not aligned data */
 			if (!aligned) {
@@ -1575,6 +1656,8 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		 */
 		if (!NAND_CANAUTOINCR(chip) || !(page & blkcheck))
 			sndcmd = 1;
+		if (!(page & blkcheck))
+			nocache = 0;
 	}
 
 	ops->retlen = ops->len - (size_t) readlen;
@@ -2102,10 +2185,12 @@ nfc_write_again:
 		chip->ecc.write_page(mtd, chip, buf);
 
 	/*
-	 * Cached progamming disabled for now, Not sure if its worth the
-	 * trouble. The speed gain is not very impressive. (2.3->2.6Mib/s)
+	 * Cached progamming only if the board driver asks for it, the speed
+	 * gain depends on the controller. (2.3->2.6Mib/s on the first ones
+	 * it was tried with)
 	 */
-	cached = 0;
+	if (!(chip->options & NAND_USE_CACHE_PROG))
+		cached = 0;
 
 	if (!cached || !(chip->options & NAND_CACHEPRG)) {
 
@@ -2131,7 +2216,30 @@ nfc_write_again:
 			return -EIO;
 	} else {
 		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
+#ifdef CONFIG_MTD_NAND_SC8810
+		nfcstatus = chip->nfc_operation_status(mtd);
+#endif
 		status = chip->waitfunc(mtd, chip);
+		/*
+		 * A failure of the previous page shows up here, in SR1: SR0
+		 * is about this page and only valid once the chip is really
+		 * ready, it is checked by the PAGEPROG ending the sequence.
+		 */
+		if (status & NAND_STATUS_FAIL_N1)
+			return -EIO;
+#ifdef CONFIG_MTD_NAND_SC8810
+		/*
+		 * waitfunc let the previous page finish, so the reset can't
+		 * cut its programming short. Program this page again without
+		 * the cache.
+		 */
+		if ((nfcstatus == NFC_CMD_OPER_TIMEOUT) && (count < NFC_CMD_MAX_CNT)) {
+			chip->cmdfunc(mtd, NAND_CMD_RESET, -1, -1);
+			count++;
+			cached = 0;
+			goto nfc_write_again;
+		}
+#endif
 	}
 
 #ifdef CONFIG_MTD_NAND_VERIFY_WRITE
@@ -45,7 +45,11 @@
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/nand_ecc.h>
+#include <linux/hardirq.h>
 #include <asm/byteorder.h>
+#ifdef CONFIG_MTD_NAND_ECC_NEON
+#include <asm/neon.h>
+#endif
 #else
 #include <stdint.h>
 struct mtd_info;
@@ -149,15 +153,25 @@ static const char addressbits[256] = {
 	0x0e, 0x0e, 0x0f, 0x0f, 0x0e, 0x0e, 0x0f, 0x0f
 };
 
-/**
- * __nand_calculate_ecc - [NAND Interface] Calculate 3-byte ECC for 256/512-byte
- *			 block
+#ifdef CONFIG_MTD_NAND_ECC_NEON
+static bool neon = true;
+module_param(neon, bool, 0644);
+MODULE_PARM_DESC(neon, "Use NEON for the ECC calculation if the CPU has it");
+
+#define nand_ecc_use_neon()	(neon && cpu_has_neon() && !in_interrupt())
+#else
+#define nand_ecc_use_neon()	0
+#endif
+
+/*
+ * nand_calc_ecc - calculate the ECC of a 256/512-byte block
  * @buf:	input buffer with raw data
  * @eccsize:	data bytes per ecc step (256 or 512)
  * @code:	output buffer with ECC
+ * @use_neon:	gather the parities with the NEON unit
  */
-void __nand_calculate_ecc(const unsigned char *buf, unsigned int eccsize,
-		       unsigned char *code)
+static void nand_calc_ecc(const unsigned char *buf, unsigned int eccsize,
+			  unsigned char *code, int use_neon)
 {
 	int i;
 	const uint32_t *bp = (uint32_t *)buf;
@@ -191,7 +205,27 @@ void __nand_calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	 * tmppar is the cumulative sum of this iteration.
 	 * needed for calculating rp12, rp14, rp16 and par
 	 * also used as a performance improvement for rp6, rp8 and rp10
+	 *
+	 * The NEON version gathers the same parities 4 longwords at a time.
 	 */
+#ifdef CONFIG_MTD_NAND_ECC_NEON
+	if (use_neon) {
+		struct nand_ecc_parity p;
+
+		kernel_neon_begin();
+		nand_ecc_neon_parity(buf, eccsize, &p);
+		kernel_neon_end();
+
+		par = p.par;
+		rp4 = p.rp4;
+		rp6 = p.rp6;
+		rp8 = p.rp8;
+		rp10 = p.rp10;
+		rp12 = p.rp12;
+		rp14 = p.rp14;
+		rp16 = p.rp16;
+	} else
+#endif
 	for (i = 0; i < eccsize_mult << 2; i++) {
 		cur = *bp++;
 		tmppar = cur;
@@ -412,8 +446,37 @@ void __nand_calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 		    (invparity[rp17] << 1) |
 		    (invparity[rp16] << 0);
 }
+
+/**
+ * __nand_calculate_ecc - [NAND Interface] Calculate 3-byte ECC for 256/512-byte
+ *			 block
+ * @buf:	input buffer with raw data
+ * @eccsize:	data bytes per ecc step (256 or 512)
+ * @code:	output buffer with ECC
+ */
+void __nand_calculate_ecc(const unsigned char *buf, unsigned int eccsize,
+		       unsigned char *code)
+{
+	nand_calc_ecc(buf, eccsize, code, nand_ecc_use_neon());
+}
 EXPORT_SYMBOL(__nand_calculate_ecc);
 
+/**
+ * __nand_calculate_ecc_generic - Calculate 3-byte ECC for 256/512-byte block
+ *				  without using any SIMD unit
+ * @buf:	input buffer with raw data
+ * @eccsize:	data bytes per ecc step (256 or 512)
+ * @code:	output buffer with ECC
+ *
+ * Reference for testing the accelerated versions against.
+ */
+void __nand_calculate_ecc_generic(const unsigned char *buf,
+				  unsigned int eccsize, unsigned char *code)
+{
+	nand_calc_ecc(buf, eccsize, code, 0);
+}
+EXPORT_SYMBOL(__nand_calculate_ecc_generic);
+
 /**
  * nand_calculate_ecc - [NAND Interface] Calculate 3-byte ECC for 256/512-byte
  *			 block
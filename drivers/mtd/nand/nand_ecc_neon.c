@@ -0,0 +1,92 @@
+/*
+ * NEON version of the parity gathering loop of the software Hamming ECC
+ *
+ * drivers/mtd/nand/nand_ecc_neon.c
+ *
+ * This file is built with -mfpu=neon: GCC turns the operations on the
+ * vector type below into NEON instructions, and may use NEON registers
+ * anywhere in this file. It must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see nand_ecc.c.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 or (at your option) any
+ * later version.
+ */
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/mtd/nand_ecc.h>
+
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+
+/* 4 longwords of the data buffer, which is only longword aligned */
+typedef u32x4 u32x4_u __attribute__((aligned(4)));
+
+union u32x4_words {
+	u32x4 v;
+	uint32_t w[4];
+};
+
+static inline uint32_t fold(u32x4 v)
+{
+	union u32x4_words u = { .v = v };
+
+	return u.w[0] ^ u.w[1] ^ u.w[2] ^ u.w[3];
+}
+
+/**
+ * nand_ecc_neon_parity - gather the longword parities of a 256/512-byte block
+ * @buf:	input buffer with raw data
+ * @eccsize:	data bytes per ecc step (256 or 512)
+ * @p:		parities for __nand_calculate_ecc() to fold
+ *
+ * Longword i of the block sits in lane i & 3 of vector i >> 2. The lanes
+ * of the xor of all vectors give rp4 and rp6; for the upper index bits
+ * the vectors with the bit set are xored into hi[], so the ones with the
+ * bit clear are all ^ hi[].
+ */
+void nand_ecc_neon_parity(const unsigned char *buf, unsigned int eccsize,
+			  struct nand_ecc_parity *p)
+{
+	const u32x4_u *bp = (const u32x4_u *)buf;
+	const unsigned int n = eccsize >> 4;
+	const u32x4 zero = { 0, 0, 0, 0 };
+	u32x4 all = zero;
+	u32x4 hi0 = zero, hi1 = zero, hi2 = zero, hi3 = zero, hi4 = zero;
+	u32x4 a, b, c, d, t;
+	union u32x4_words u;
+	unsigned int i;
+
+	for (i = 0; i < n; i += 4) {
+		a = bp[i];
+		b = bp[i + 1];
+		c = bp[i + 2];
+		d = bp[i + 3];
+
+		hi0 ^= b ^ d;
+		hi1 ^= c ^ d;
+		t = a ^ b ^ c ^ d;
+		all ^= t;
+		if (i & 4)
+			hi2 ^= t;
+		if (i & 8)
+			hi3 ^= t;
+		if (i & 16)
+			hi4 ^= t;
+	}
+
+	u.v = all;
+	p->par = u.w[0] ^ u.w[1] ^ u.w[2] ^ u.w[3];
+	p->rp4 = u.w[0] ^ u.w[2];
+	p->rp6 = u.w[0] ^ u.w[1];
+	p->rp8 = fold(all ^ hi0);
+	p->rp10 = fold(all ^ hi1);
+	p->rp12 = fold(all ^ hi2);
+	p->rp14 = fold(all ^ hi3);
+	p->rp16 = fold(all ^ hi4);
+}
+EXPORT_SYMBOL(nand_ecc_neon_parity);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("NEON support for the generic NAND ECC");
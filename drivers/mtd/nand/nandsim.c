@@ -42,6 +42,8 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/pagemap.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
 
 /* Default simulator parameters values */
 #if !defined(CONFIG_NANDSIM_FIRST_ID_BYTE)  || \
@@ -110,6 +112,8 @@ static unsigned int overridesize = 0;
 static char *cache_file = NULL;
 static unsigned int bbt;
 static unsigned int bch;
+static unsigned int async;
+static unsigned int cache_read;
 
 module_param(first_id_byte,  uint, 0400);
 module_param(second_id_byte, uint, 0400);
@@ -135,6 +139,8 @@ module_param(overridesize,   uint, 0400);
 module_param(cache_file,     charp, 0400);
 module_param(bbt,	     uint, 0400);
 module_param(bch,	     uint, 0400);
+module_param(async,	     uint, 0400);
+module_param(cache_read,     uint, 0400);
 
 MODULE_PARM_DESC(first_id_byte,  "The first byte returned by NAND Flash 'read ID' command (manufacturer ID)");
 MODULE_PARM_DESC(second_id_byte, "The second byte returned by NAND Flash 'read ID' command (chip ID)");
@@ -168,6 +174,9 @@ MODULE_PARM_DESC(overridesize,   "Specifies the NAND Flash size overriding the I
 				 " e.g. 5 means a size of 32 erase blocks");
 MODULE_PARM_DESC(cache_file,     "File to use to cache nand pages instead of memory");
 MODULE_PARM_DESC(bbt,		 "0 OOB, 1 BBT with marker in OOB, 2 BBT with marker in data area");
+MODULE_PARM_DESC(async,		 "Simulate NAND delays by keeping the chip busy from a timer, the "
+				 "driver sleeps until the ready interrupt instead of busy-waiting");
+MODULE_PARM_DESC(cache_read,	 "Let multi-page reads use cache read commands (large page chips)");
 MODULE_PARM_DESC(bch,		 "Enable BCH ecc and set how many bits should "
 				 "be correctable in 512-byte blocks");
 
@@ -366,6 +375,14 @@ struct nandsim {
 	void *file_buf;
 	struct page *held_pages[NS_MAX_HELD_PAGES];
 	int held_cnt;
+
+	/* R/B# line simulation when async is set */
+	struct hrtimer busy_timer; /* fires at the end of the operation */
+	struct completion ready;   /* completed when the chip is ready */
+	int busy;
+
+	/* Page in the data register during a cache read, -1 if none */
+	int cache_row;
 };
 
 /*
@@ -413,6 +430,16 @@ static struct nandsim_operations {
 			       STATE_DATAOUT, STATE_READY}},
 };
 
+/*
+ * Cache read output is the tail of a large page read: the page is in the
+ * internal buffer, then data output and back to ready.
+ */
+static uint32_t cache_read_states[NS_OPER_STATES] = {
+	STATE_CMD_READ0, STATE_ADDR_PAGE, STATE_CMD_READSTART,
+	STATE_DATAOUT, STATE_READY
+};
+#define CACHE_READ_DATAOUT_IDX	3
+
 struct weak_block {
 	struct list_head list;
 	unsigned int erase_block_no;
@@ -713,6 +740,7 @@ error:
  */
 static void free_nandsim(struct nandsim *ns)
 {
+	hrtimer_cancel(&ns->busy_timer);
 	kfree(ns->buf.byte);
 	free_device(ns);
 
@@ -1586,6 +1614,47 @@ static int prog_page(struct nandsim *ns, int num)
  *
  * RETURNS: 0 if success, -1 if error.
  */
+/*
+ * With async set, operations don't busy-wait for their simulated duration:
+ * the chip reports busy until busy_timer fires, like the ready interrupt of
+ * a real controller, and the driver can sleep in the meantime.
+ */
+static enum hrtimer_restart ns_busy_timer_fn(struct hrtimer *timer)
+{
+	struct nandsim *ns = container_of(timer, struct nandsim, busy_timer);
+
+	ns->busy = 0;
+	complete_all(&ns->ready);
+
+	return HRTIMER_NORESTART;
+}
+
+static void ns_wait_ready(struct nandsim *ns)
+{
+	if (!ns->busy)
+		return;
+
+	if (in_interrupt() || oops_in_progress) {
+		/* Can't sleep, pretend the operation is over */
+		hrtimer_cancel(&ns->busy_timer);
+		ns->busy = 0;
+		complete_all(&ns->ready);
+		return;
+	}
+
+	wait_for_completion(&ns->ready);
+}
+
+static void ns_start_busy(struct nandsim *ns, unsigned long us)
+{
+	ns_wait_ready(ns);
+
+	ns->busy = 1;
+	INIT_COMPLETION(ns->ready);
+	hrtimer_start(&ns->busy_timer, ns_to_ktime((u64)us * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
 static int do_state_action(struct nandsim *ns, uint32_t action)
 {
 	int num;
@@ -1614,6 +1683,8 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 		}
 		num = ns->geom.pgszoob - ns->regs.off - ns->regs.column;
 		read_page(ns, num);
+		if (ns->options & OPT_LARGEPAGE)
+			ns->cache_row = ns->regs.row;
 
 		NS_DBG("do_state_action: (ACTION_CPY:) copy %d bytes to int buf, raw offset %d\n",
 			num, NS_RAW_OFFSET(ns) + ns->regs.off);
@@ -1625,6 +1696,11 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 		else
 			NS_LOG("read OOB of page %d\n", ns->regs.row);
 
+		if (async) {
+			ns_start_busy(ns, access_delay +
+				input_cycle * ns->geom.pgsz / 1000 / busdiv);
+			break;
+		}
 		NS_UDELAY(access_delay);
 		NS_UDELAY(input_cycle * ns->geom.pgsz / 1000 / busdiv);
 
@@ -1658,7 +1734,10 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 
 		erase_sector(ns);
 
-		NS_MDELAY(erase_delay);
+		if (async)
+			ns_start_busy(ns, erase_delay * 1000);
+		else
+			NS_MDELAY(erase_delay);
 
 		if (erase_block_wear)
 			update_wear(erase_block_no);
@@ -1696,8 +1775,13 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			num, ns->regs.row, ns->regs.column, NS_RAW_OFFSET(ns) + ns->regs.off);
 		NS_LOG("programm page %d\n", ns->regs.row);
 
-		NS_UDELAY(programm_delay);
-		NS_UDELAY(output_cycle * ns->geom.pgsz / 1000 / busdiv);
+		if (async) {
+			ns_start_busy(ns, programm_delay +
+				output_cycle * ns->geom.pgsz / 1000 / busdiv);
+		} else {
+			NS_UDELAY(programm_delay);
+			NS_UDELAY(output_cycle * ns->geom.pgsz / 1000 / busdiv);
+		}
 
 		if (write_error(page_no)) {
 			NS_WARN("simulating write failure in page %u\n", page_no);
@@ -1882,6 +1966,54 @@ static void switch_state(struct nandsim *ns)
 	}
 }
 
+/*
+ * Cache read commands don't fit in the states chains, they are emulated
+ * here. READCACHESEQ outputs the page in the data register (read by the
+ * previous READSTART or READCACHESEQ) while the next one is loaded,
+ * READCACHEEND outputs it and ends the cache read.
+ */
+static void ns_cache_read(struct nandsim *ns, u_char cmd)
+{
+	int busdiv = ns->busw == 8 ? 1 : 2;
+
+	if (ns->cache_row < 0) {
+		NS_ERR("cache_read: command %#x without a page read before\n",
+			(uint)cmd);
+		switch_to_ready_state(ns, NS_STATUS_FAILED(ns));
+		return;
+	}
+
+	ns_wait_ready(ns);
+
+	ns->regs.command = cmd;
+	ns->regs.row = ns->cache_row;
+	ns->regs.column = 0;
+	ns->regs.off = 0;
+	read_page(ns, ns->geom.pgszoob);
+	NS_LOG("cache read page %d\n", ns->regs.row);
+
+	if (cmd == NAND_CMD_READCACHESEQ && ns->cache_row + 1 < ns->geom.pgnum)
+		ns->cache_row += 1;
+	else
+		ns->cache_row = -1;
+
+	ns->op = cache_read_states;
+	ns->stateidx = CACHE_READ_DATAOUT_IDX;
+	ns->state = STATE_DATAOUT;
+	ns->nxstate = STATE_READY;
+	ns->regs.num = ns->geom.pgszoob;
+	ns->regs.count = 0;
+	ns->regs.status = NS_STATUS_OK(ns);
+
+	if (async) {
+		ns_start_busy(ns, access_delay +
+			input_cycle * ns->geom.pgsz / 1000 / busdiv);
+	} else {
+		NS_UDELAY(access_delay);
+		NS_UDELAY(input_cycle * ns->geom.pgsz / 1000 / busdiv);
+	}
+}
+
 static u_char ns_nand_read_byte(struct mtd_info *mtd)
 {
 	struct nandsim *ns = ((struct nand_chip *)mtd->priv)->priv;
@@ -1905,9 +2037,15 @@ static u_char ns_nand_read_byte(struct mtd_info *mtd)
 	/* Status register may be read as many times as it is wanted */
 	if (NS_STATE(ns->state) == STATE_DATAOUT_STATUS) {
 		NS_DBG("read_byte: return %#x status\n", ns->regs.status);
+		if (ns->busy)
+			return ns->regs.status & ~NAND_STATUS_READY;
 		return ns->regs.status;
 	}
 
+	/* Page data is only valid once the chip is ready again */
+	if (NS_STATE(ns->state) == STATE_DATAOUT)
+		ns_wait_ready(ns);
+
 	/* Check if there is any data in the internal buffer which may be read */
 	if (ns->regs.count == ns->regs.num) {
 		NS_WARN("read_byte: no more data to output, return %#x\n", (uint)outb);
@@ -1974,6 +2112,14 @@ static void ns_nand_write_byte(struct mtd_info *mtd, u_char byte)
 		 * The byte written is a command.
 		 */
 
+		if (byte == NAND_CMD_READCACHESEQ ||
+		    byte == NAND_CMD_READCACHEEND) {
+			ns_cache_read(ns, byte);
+			return;
+		}
+		if (byte != NAND_CMD_STATUS)
+			ns->cache_row = -1;
+
 		if (byte == NAND_CMD_RESET) {
 			NS_LOG("reset chip\n");
 			switch_to_ready_state(ns, NS_STATUS_OK(ns));
@@ -2124,8 +2270,24 @@ static void ns_hwcontrol(struct mtd_info *mtd, int cmd, unsigned int bitmask)
 
 static int ns_device_ready(struct mtd_info *mtd)
 {
+	struct nandsim *ns = ((struct nand_chip *)mtd->priv)->priv;
+
 	NS_DBG("device_ready\n");
-	return 1;
+	return !ns->busy;
+}
+
+/*
+ * Used instead of nand_wait() when async is set: sleep until the ready
+ * "interrupt" rather than polling the status register.
+ */
+static int ns_waitfunc(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	struct nandsim *ns = chip->priv;
+
+	ns_wait_ready(ns);
+
+	chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+	return chip->read_byte(mtd);
 }
 
 static uint16_t ns_nand_read_word(struct mtd_info *mtd)
@@ -2192,6 +2354,8 @@ static void ns_nand_read_buf(struct mtd_info *mtd, u_char *buf, int len)
 		return;
 	}
 
+	ns_wait_ready(ns);
+
 	/* Check if these are expected bytes */
 	if (ns->regs.count + len > ns->regs.num) {
 		NS_ERR("read_buf: too many bytes to read\n");
@@ -2256,6 +2420,12 @@ static int __init ns_init_module(void)
 	nand        = (struct nandsim *)(chip + 1);
 	chip->priv  = (void *)nand;
 
+	hrtimer_init(&nand->busy_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	nand->busy_timer.function = ns_busy_timer_fn;
+	init_completion(&nand->ready);
+	complete_all(&nand->ready);
+	nand->cache_row = -1;
+
 	/*
 	 * Register simulator's callbacks.
 	 */
@@ -2267,9 +2437,13 @@ static int __init ns_init_module(void)
 	chip->verify_buf = ns_nand_verify_buf;
 	chip->read_word  = ns_nand_read_word;
 	chip->ecc.mode   = NAND_ECC_SOFT;
+	if (async)
+		chip->waitfunc = ns_waitfunc;
 	/* The NAND_SKIP_BBTSCAN option is necessary for 'overridesize' */
 	/* and 'badblocks' parameters to work */
 	chip->options   |= NAND_SKIP_BBTSCAN;
+	if (cache_read)
+		chip->options |= NAND_USE_CACHE_READ;
 
 	switch (bbt) {
 	case 2:
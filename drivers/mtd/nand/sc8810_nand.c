@@ -23,9 +23,19 @@
 #include <linux/irq.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/cache.h>
 #include <mach/globalregs.h>
+#include <mach/dma.h>
 #include "sc8810_nand.h"
 
+/* A write_buf() chunk, copied to the controller buffer at PAGEPROG */
+struct sc8810_nand_wr_seg {
+	const u8		*buf;
+	u16			len;
+};
+
 struct sprd_nand_info {
     unsigned long           phys_base;
 	struct mtd_info		    mtd;
@@ -36,6 +46,16 @@ struct sprd_nand_info {
 	u8			            mc_addr_ins_num;
 	u16                     b_pointer;
 	u16 			        addr_array[5];
+	u8			data_in_mbuf;	/* read data is still in NFC_MBUF */
+	u8			nfc_irq_armed;
+	u8			wr_seg_num;
+	int			irq;
+	int			dma_ch;
+	struct completion	nfc_done;
+	struct completion	dma_done;
+	struct sc8810_nand_wr_seg wr_seg[NFC_MAX_WR_SEGS];
+	void			(*cmdfunc)(struct mtd_info *mtd, unsigned command,
+					   int column, int page_addr);
 };
 
 struct sc8810_nand_page_oob {
@@ -112,6 +132,37 @@ static void  nfc_mcr_inst_init(void)
 	g_info.mc_ins_num = 0;
 	g_info.b_pointer = 0;
 	g_info.mc_addr_ins_num = 0;
+	g_info.data_in_mbuf = 0;
+	g_info.wr_seg_num = 0;
+}
+
+/*
+ * Have the controller interrupt us when the command about to be started
+ * is done, so that the caller can sleep instead of polling NFC_CLR_RAW.
+ * Only NFC_DONE is used: ECC runs take a few microseconds, less than an
+ * interrupt round trip, and are still polled.
+ */
+static void sc8810_nfc_irq_arm(void)
+{
+	if (g_info.irq < 0 || in_interrupt() || oops_in_progress)
+		return;
+
+	INIT_COMPLETION(g_info.nfc_done);
+	g_info.nfc_irq_armed = 1;
+	nfc_reg_write(NFC_STS_EN, NFC_DONE_EN);
+}
+
+static irqreturn_t sc8810_nfc_irq(int irq, void *dev_id)
+{
+	if (!(nfc_reg_read(NFC_STS_EN) & NFC_DONE_EN) ||
+	    !(nfc_reg_read(NFC_CLR_RAW) & NFC_DONE_RAW))
+		return IRQ_NONE;
+
+	/* The raw status is cleared by the waiter */
+	nfc_reg_write(NFC_STS_EN, 0);
+	complete(&g_info.nfc_done);
+
+	return IRQ_HANDLED;
 }
 
 void  nfc_mcr_inst_add(u32 ins, u32 mode)
@@ -156,6 +207,7 @@ static unsigned int nfc_mcr_inst_exc(void)
 	value |= (1 << NFC_CMD_SET_OFFSET);
 	nfc_reg_write(NFC_CFG0, value);
 	value = NFC_CMD_VALID | ((unsigned int)NF_MC_NOP_ID) | ((g_info.mc_ins_num - 1) << 16);
+	sc8810_nfc_irq_arm();
 	nfc_reg_write(NFC_CMD, value);
 
 	return 0;
@@ -171,6 +223,7 @@ static unsigned int nfc_mcr_inst_exc_for_id(void)
 
 	nfc_reg_write(NFC_CFG0, value);
 	value = NFC_CMD_VALID | ((unsigned int)NF_MC_NOP_ID) | ((g_info.mc_ins_num - 1) << 16);
+	sc8810_nfc_irq_arm();
 	nfc_reg_write(NFC_CMD, value);
 
 	return 0;
@@ -236,6 +289,17 @@ static int sc8810_nfc_wait_command_finish(unsigned int flag, int cmd)
 	unsigned int counter = 0;
 
 	nfc_cmd_result_status = NFC_CMD_OPER_OK;
+	if (g_info.nfc_irq_armed && flag == NFC_DONE_EVENT) {
+		g_info.nfc_irq_armed = 0;
+		if (!wait_for_completion_timeout(&g_info.nfc_done,
+				msecs_to_jiffies(NFC_IRQ_TIMEOUT_MS)) &&
+		    !(nfc_reg_read(NFC_CLR_RAW) & NFC_DONE_RAW)) {
+			nfc_reg_write(NFC_STS_EN, 0);
+			nfc_cmd_result_status = NFC_CMD_OPER_TIMEOUT;
+		}
+		event = flag;
+	}
+
 	while (((event & flag) != flag) && (counter < NFC_TIMEOUT_VAL)) {
 		value = nfc_reg_read(NFC_CLR_RAW);
 
@@ -386,33 +450,149 @@ static u32 sc8810_ecc_decode(struct sc8810_ecc_param *param)
 	return ret;
 }
 
+static void sc8810_nand_dma_irq(int dma_ch, void *dev_id)
+{
+	complete(&g_info.dma_done);
+}
+
+/*
+ * Move len bytes between buf and NFC_MBUF at offset with the DMA engine.
+ * Returns -1 if the CPU has to do the copy instead: short or unaligned
+ * transfers, buffers outside of the linear mapping (vmalloc), contexts
+ * that cannot sleep, or a DMA timeout.
+ *
+ * Unmapping a DMA_FROM_DEVICE buffer invalidates the cache lines it
+ * covers, so reads need a buffer that starts and ends on a cache line:
+ * a partial line would lose whatever the CPU wrote next to the buffer.
+ */
+static int sc8810_nand_dma_xfer(u8 *buf, unsigned int offset, int len, int to_mbuf)
+{
+	struct sprd_dma_channel_desc desc;
+	struct device *dev = &g_info.pdev->dev;
+	enum dma_data_direction dir = to_mbuf ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	dma_addr_t addr;
+	int ret = 0;
+
+	if (g_info.dma_ch < 0 || len < NFC_DMA_MIN_LEN ||
+	    (((unsigned long)buf | offset | len) & 3) ||
+	    (!to_mbuf && (((unsigned long)buf | len) & (L1_CACHE_BYTES - 1))) ||
+	    !virt_addr_valid(buf) || !virt_addr_valid(buf + len - 1) ||
+	    in_interrupt() || oops_in_progress)
+		return -1;
+
+	addr = dma_map_single(dev, buf, len, dir);
+	if (dma_mapping_error(dev, addr))
+		return -1;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.cfg_swt_mode_sel = DMA_UN_SWT_MODE;
+	desc.cfg_src_data_width = DMA_SDATA_WIDTH32;
+	desc.cfg_dst_data_width = DMA_DDATA_WIDTH32;
+	desc.cfg_req_mode_sel = DMA_REQMODE_TRANS;
+	desc.cfg_blk_len = len;
+	desc.total_len = len;
+	desc.src_elem_postm = 4;
+	desc.dst_elem_postm = 4;
+	desc.src_burst_mode = SRC_BURST_MODE_8;
+	desc.dst_burst_mode = SRC_BURST_MODE_8;
+	if (to_mbuf) {
+		desc.src_addr = addr;
+		desc.dst_addr = NFC_MBUF_PHYS + offset;
+	} else {
+		desc.src_addr = NFC_MBUF_PHYS + offset;
+		desc.dst_addr = addr;
+	}
+
+	INIT_COMPLETION(g_info.dma_done);
+	sprd_dma_channel_config(g_info.dma_ch, DMA_NORMAL, &desc);
+	sprd_dma_channel_start(g_info.dma_ch);
+	if (!wait_for_completion_timeout(&g_info.dma_done,
+			msecs_to_jiffies(NFC_DMA_TIMEOUT_MS))) {
+		printk("nfc dma of %d bytes timeout, copy by cpu.\n", len);
+		ret = -1;
+	}
+	sprd_dma_channel_stop(g_info.dma_ch);
+	dma_unmap_single(dev, addr, len, dir);
+
+	return ret;
+}
+
+/*
+ * After READSTART the page is left in NFC_MBUF and read_buf() moves it
+ * straight into the caller's buffer. The ECC engine only reuses NFC_MBUF
+ * in ecc.correct, once nand_base has read the whole page.
+ */
 static void sc8810_nand_read_buf(struct mtd_info *mtd, uint8_t *buf, int len)
 {
-	memcpy(buf, g_info.b_pointer + io_wr_port,len);
+	if (!g_info.data_in_mbuf)
+		memcpy(buf, g_info.b_pointer + io_wr_port, len);
+	else if (sc8810_nand_dma_xfer(buf, g_info.b_pointer, len, 0))
+		memcpy(buf, (void *)(NFC_MBUF_ADDR + g_info.b_pointer), len);
 	g_info.b_pointer += len;
 }
 
+/*
+ * NFC_MBUF can't be filled yet, ecc.calculate runs the ECC engine on it
+ * for every step. Just remember the caller's buffers, they are valid up
+ * to PAGEPROG where sc8810_nand_flush_wr_segs() copies them.
+ */
 static void sc8810_nand_write_buf(struct mtd_info *mtd, const uint8_t *buf, int len)
 {
-	memcpy(g_info.b_pointer + io_wr_port, (unsigned char*)buf,len);
+	struct sc8810_nand_wr_seg *seg;
+	u8 *p;
+
+	if (g_info.wr_seg_num < NFC_MAX_WR_SEGS) {
+		seg = &g_info.wr_seg[g_info.wr_seg_num ++];
+		seg->buf = buf;
+		seg->len = len;
+	} else {
+		/* Out of segments, gather the rest in the bounce buffer */
+		seg = &g_info.wr_seg[NFC_MAX_WR_SEGS - 1];
+		p = io_wr_port + g_info.b_pointer - seg->len;
+		if (seg->buf != p) {
+			memcpy(p, seg->buf, seg->len);
+			seg->buf = p;
+		}
+		memcpy(io_wr_port + g_info.b_pointer, buf, len);
+		seg->len += len;
+	}
 	g_info.b_pointer += len;
 }
 
-static u_char sc8810_nand_read_byte(struct mtd_info *mtd)
+static void sc8810_nand_flush_wr_segs(void)
 {
-	u_char ch;
+	struct sc8810_nand_wr_seg *seg;
+	unsigned int offset = 0;
+	int i;
+
+	for (i = 0; i < g_info.wr_seg_num; i ++) {
+		seg = &g_info.wr_seg[i];
+		if (sc8810_nand_dma_xfer((u8 *)seg->buf, offset, seg->len, 1))
+			memcpy((void *)(NFC_MBUF_ADDR + offset), seg->buf, seg->len);
+		offset += seg->len;
+	}
+	g_info.wr_seg_num = 0;
+}
 
-	ch = io_wr_port[g_info.b_pointer ++];
+static u_char sc8810_nand_get_byte(void)
+{
+	if (g_info.data_in_mbuf)
+		return readb(NFC_MBUF_ADDR + g_info.b_pointer ++);
 
-	return ch;
+	return io_wr_port[g_info.b_pointer ++];
+}
+
+static u_char sc8810_nand_read_byte(struct mtd_info *mtd)
+{
+	return sc8810_nand_get_byte();
 }
 
 static u16 sc8810_nand_read_word(struct mtd_info *mtd)
 {
 	u16 ch = 0;
 
-	ch = io_wr_port[g_info.b_pointer ++];
-	ch |= io_wr_port[g_info.b_pointer ++] << 8;
+	ch = sc8810_nand_get_byte();
+	ch |= sc8810_nand_get_byte() << 8;
 
 	return ch;
 }
@@ -458,6 +638,7 @@ static void sc8810_nand_hwcontrol(struct mtd_info *mtd, int cmd, unsigned int ct
 			break;
 		case NAND_CMD_STATUS:
 			nfc_mcr_inst_init();
+			sc8810_nfc_irq_arm();
 			nfc_reg_write(NFC_CMD, 0x80000070);
 			sc8810_nfc_wait_command_finish(NFC_DONE_EVENT, cmd);
 			memcpy(io_wr_port, (void *)NFC_ID_STS, 1);
@@ -496,25 +677,65 @@ static void sc8810_nand_hwcontrol(struct mtd_info *mtd, int cmd, unsigned int ct
 
 			nfc_mcr_inst_exc();
 			sc8810_nfc_wait_command_finish(NFC_DONE_EVENT, cmd);
-			memcpy(io_wr_port, (void *)NFC_MBUF_ADDR, size);
+			g_info.data_in_mbuf = 1;
 			break;
 		case NAND_CMD_SEQIN:
 			nfc_mcr_inst_init();
 			nfc_mcr_inst_add(NAND_CMD_SEQIN, NF_MC_CMD_ID);
 			break;
+		case NAND_CMD_CACHEDPROG:
 		case NAND_CMD_PAGEPROG:
-			memcpy((void *)NFC_MBUF_ADDR, io_wr_port, g_info.b_pointer);
+			sc8810_nand_flush_wr_segs();
 			sc8810_nand_data_add(g_info.b_pointer, chip->options & NAND_BUSWIDTH_16, 0);
 			nfc_mcr_inst_add(cmd, NF_MC_CMD_ID);
 			nfc_mcr_inst_add(0, NF_MC_WAIT_ID);
 			nfc_mcr_inst_exc();
-			sc8810_nfc_wait_command_finish(NFC_DONE_EVENT, cmd);
+			sc8810_nfc_wait_command_finish(NFC_DONE_EVENT, NAND_CMD_PAGEPROG);
 			break;
 		}
 	} else if (ctrl & NAND_ALE)
 		nfc_mcr_inst_add(cmd & 0xff, NF_MC_ADDR_ID);
 }
 
+/*
+ * Cache read commands are queued in one micro-program together with the
+ * transfer of the page they output. READCACHESEQ with a page address is
+ * the whole READ0/address/READSTART/READCACHESEQ sequence, 12 of the 16
+ * instruction slots, so the first page is not transferred for nothing
+ * after READSTART as the generic cmd_ctrl path would do.
+ */
+static void sc8810_nand_cmdfunc(struct mtd_info *mtd, unsigned int command,
+				int column, int page_addr)
+{
+	struct nand_chip *chip = (struct nand_chip *)(mtd->priv);
+
+	if (command != NAND_CMD_READCACHESEQ && command != NAND_CMD_READCACHEEND) {
+		g_info.cmdfunc(mtd, command, column, page_addr);
+		return;
+	}
+
+	nfc_mcr_inst_init();
+	if (page_addr != -1) {
+		if (chip->options & NAND_BUSWIDTH_16)
+			column >>= 1;
+		nfc_mcr_inst_add(NAND_CMD_READ0, NF_MC_CMD_ID);
+		nfc_mcr_inst_add(column & 0xff, NF_MC_ADDR_ID);
+		nfc_mcr_inst_add((column >> 8) & 0xff, NF_MC_ADDR_ID);
+		nfc_mcr_inst_add(page_addr & 0xff, NF_MC_ADDR_ID);
+		nfc_mcr_inst_add((page_addr >> 8) & 0xff, NF_MC_ADDR_ID);
+		if (chip->chipsize > (128 << 20))
+			nfc_mcr_inst_add((page_addr >> 16) & 0xff, NF_MC_ADDR_ID);
+		nfc_mcr_inst_add(NAND_CMD_READSTART, NF_MC_CMD_ID);
+		nfc_mcr_inst_add(0, NF_MC_WAIT_ID);
+	}
+	nfc_mcr_inst_add(command, NF_MC_CMD_ID);
+	nfc_mcr_inst_add(0, NF_MC_WAIT_ID);
+	sc8810_nand_data_add(mtd->writesize + mtd->oobsize, chip->options & NAND_BUSWIDTH_16, 1);
+	nfc_mcr_inst_exc();
+	sc8810_nfc_wait_command_finish(NFC_DONE_EVENT, NAND_CMD_READSTART);
+	g_info.data_in_mbuf = 1;
+}
+
 static int sc8810_nand_devready(struct mtd_info *mtd)
 {
 	unsigned long value = 0;
@@ -565,6 +786,45 @@ static void sc8810_nand_enable_hwecc(struct mtd_info *mtd, int mode)
 	sprd_ecc_mode = mode;
 }
 
+/*
+ * The ECC engine only runs in ecc.correct, so there is nothing to do per
+ * step while the page is read: move the data and the OOB area out of
+ * NFC_MBUF in one transfer instead of one read_buf() per ECC step, each
+ * too short to be worth a DMA.
+ */
+static int sc8810_nand_read_page_hwecc(struct mtd_info *mtd, struct nand_chip *chip,
+				       uint8_t *buf, int page)
+{
+	int i, eccsize = chip->ecc.size;
+	int eccbytes = chip->ecc.bytes;
+	int eccsteps = chip->ecc.steps;
+	uint8_t *p = buf;
+	uint8_t *ecc_calc = chip->buffers->ecccalc;
+	uint8_t *ecc_code = chip->buffers->ecccode;
+	uint32_t *eccpos = chip->ecc.layout->eccpos;
+	int stat;
+
+	if (buf + mtd->writesize == chip->oob_poi)
+		chip->read_buf(mtd, buf, mtd->writesize + mtd->oobsize);
+	else {
+		chip->read_buf(mtd, buf, mtd->writesize);
+		chip->read_buf(mtd, chip->oob_poi, mtd->oobsize);
+	}
+
+	for (i = 0; i < chip->ecc.total; i++)
+		ecc_code[i] = chip->oob_poi[eccpos[i]];
+
+	for (i = 0; eccsteps; eccsteps--, i += eccbytes, p += eccsize) {
+		stat = chip->ecc.correct(mtd, p, &ecc_code[i], &ecc_calc[i]);
+		if (stat < 0)
+			mtd->ecc_stats.failed++;
+		else
+			mtd->ecc_stats.corrected += stat;
+	}
+
+	return 0;
+}
+
 static int sc8810_nand_correct_data(struct mtd_info *mtd, uint8_t *dat, uint8_t *read_ecc, uint8_t *calc_ecc)
 {
 	struct sc8810_ecc_param param;
@@ -629,6 +889,7 @@ int board_nand_init(struct nand_chip *this)
 	this->ecc.calculate = sc8810_nand_calculate_ecc;
 	this->ecc.correct = sc8810_nand_correct_data;
 	this->ecc.hwctl = sc8810_nand_enable_hwecc;
+	this->ecc.read_page = sc8810_nand_read_page_hwecc;
 	this->ecc.mode = NAND_ECC_HW;
 	this->ecc.size = CONFIG_SYS_NAND_ECCSIZE;
 	this->ecc.bytes = CONFIG_SYS_NAND_ECCBYTES;
@@ -641,6 +902,7 @@ int board_nand_init(struct nand_chip *this)
 	this->chip_delay = 20;
 	this->priv = &g_info;
 	this->options |= NAND_BUSWIDTH_16;
+	this->options |= NAND_USE_CACHE_READ | NAND_USE_CACHE_PROG;
 
 	return 0;
 }
@@ -650,12 +912,23 @@ static struct mtd_info *sprd_mtd = NULL;
 const char *part_probes[] = { "cmdlinepart", NULL };
 #endif
 
+static void sprd_nand_free_irq_dma(void)
+{
+	if (g_info.irq >= 0)
+		free_irq(g_info.irq, &g_info);
+	if (g_info.dma_ch >= 0)
+		sprd_dma_free(g_info.dma_ch);
+	g_info.irq = -1;
+	g_info.dma_ch = -1;
+}
+
 static int sprd_nand_probe(struct platform_device *pdev)
 {
 	struct nand_chip *this;
 	struct resource *regs = NULL;
 	struct mtd_partition *partitions = NULL;
 	int num_partitions = 0;
+	int irq;
 
 	regs = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!regs) {
@@ -668,6 +941,21 @@ static int sprd_nand_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, &g_info);
 	g_info.pdev = pdev;
+	g_info.irq = -1;
+	init_completion(&g_info.nfc_done);
+	init_completion(&g_info.dma_done);
+
+	irq = platform_get_irq(pdev, 0);
+	if (irq >= 0 && !request_irq(irq, sc8810_nfc_irq, 0, "sprd-nand", &g_info))
+		g_info.irq = irq;
+	else
+		dev_warn(&pdev->dev, "no irq, polling for command completion\n");
+
+	g_info.dma_ch = sprd_dma_request(DMA_UID_SOFTWARE, sc8810_nand_dma_irq, &g_info);
+	if (g_info.dma_ch < 0)
+		dev_warn(&pdev->dev, "no dma channel, copying pages by cpu\n");
+	else
+		sprd_dma_set_irq_type(g_info.dma_ch, TRANSACTION_DONE, ON);
 
 	sprd_mtd = kmalloc(sizeof(struct mtd_info) + sizeof(struct nand_chip), GFP_KERNEL);
 	this = (struct nand_chip *)(&sprd_mtd[1]);
@@ -680,7 +968,10 @@ static int sprd_nand_probe(struct platform_device *pdev)
 	this->options |= NAND_NO_READRDY;
 
 	board_nand_init(this);
-	nand_scan(sprd_mtd, 1);
+	nand_scan_ident(sprd_mtd, 1, NULL);
+	g_info.cmdfunc = this->cmdfunc;
+	this->cmdfunc = sc8810_nand_cmdfunc;
+	nand_scan_tail(sprd_mtd);
 
 	sprd_mtd->name = "sprd-nand";
 #ifdef CONFIG_MTD_CMDLINE_PARTS
@@ -697,6 +988,7 @@ static int sprd_nand_probe(struct platform_device *pdev)
 	return 0;
 release:
 	nand_release(sprd_mtd);
+	sprd_nand_free_irq_dma();
 Err:
 	return 0;
 }
@@ -706,6 +998,7 @@ static int sprd_nand_remove(struct platform_device *pdev)
 	platform_set_drvdata(pdev, NULL);
 	nand_release(sprd_mtd);
 	kfree(sprd_mtd);
+	sprd_nand_free_irq_dma();
 
 	return 0;
 }
@@ -6,6 +6,7 @@
 #define NFC_REG_BASE				(SPRD_NAND_BASE)
 #define NFC_MBUF_ADDR				(NFC_REG_BASE + 0x2000)
 #define NFC_SBUF_ADDR				(NFC_REG_BASE + 0x4000)
+#define NFC_MBUF_PHYS				(SPRD_NAND_PHYS + 0x2000)
 
 #define NFC_CMD					    (NFC_REG_BASE + 0x0000)
 #define NFC_CFG0				    (NFC_REG_BASE + 0x0004)
@@ -129,6 +130,13 @@
 #define NFC_ERASE_TIMEOUT			(0xc000)
 #define NFC_READ_TIMEOUT			(0x2000)
 #define NFC_WRITE_TIMEOUT			(0x4000)
+#define NFC_IRQ_TIMEOUT_MS			(400)
+#define NFC_DMA_TIMEOUT_MS			(100)
+
+/* Shorter transfers are cheaper to copy by CPU than to set up a DMA for */
+#define NFC_DMA_MIN_LEN				(512)
+/* ECC steps of a 8KB page plus its OOB, with some slack */
+#define NFC_MAX_WR_SEGS				(24)
 
 #define NF_MC_CMD_ID				(0xFD)
 #define NF_MC_ADDR_ID				(0xF1)
@@ -0,0 +1,308 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * Check the software ECC implementations picked at runtime (e.g. NEON)
+ * against the generic ones, then measure their throughput.
+ *
+ * The tests run when the module is loaded, which then fails with -EAGAIN
+ * so that it does not stay around, like tcrypt:
+ *
+ *	modprobe mtd_eccspeedtest mode=2 sec=2 m=13 t=8
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/mtd/nand_ecc.h>
+#include <linux/bch.h>
+
+#define PRINT_PREF KERN_INFO "mtd_eccspeedtest: "
+
+#define SELFTEST_ROUNDS	64
+
+static int mode;
+module_param(mode, int, 0);
+MODULE_PARM_DESC(mode, "Tests to run: 0 all, 1 Hamming ECC, 2 BCH");
+
+static unsigned int sec = 1;
+module_param(sec, uint, 0);
+MODULE_PARM_DESC(sec, "Length in seconds of speed tests");
+
+static int m = 13;
+module_param(m, int, 0);
+MODULE_PARM_DESC(m, "BCH Galois field order");
+
+static int t = 4;
+module_param(t, int, 0);
+MODULE_PARM_DESC(t, "BCH error correction capability in bits");
+
+static unsigned int size = 512;
+module_param(size, uint, 0);
+MODULE_PARM_DESC(size, "BCH data bytes per ecc step");
+
+/* one more byte, to also test data that is not word aligned */
+static unsigned char data[2048 + 1] __aligned(4);
+static unsigned char error_data[2048 + 1] __aligned(4);
+
+#if defined(CONFIG_MTD_NAND_ECC) || defined(CONFIG_MTD_NAND_ECC_MODULE)
+
+typedef void (*hamming_calc_t)(const unsigned char *buf, unsigned int eccsize,
+			       unsigned char *code);
+
+static int hamming_selftest(unsigned int eccsize)
+{
+	unsigned char code[3], ref_code[3];
+	int i;
+
+	for (i = 0; i < SELFTEST_ROUNDS; i++) {
+		get_random_bytes(data, eccsize);
+
+		__nand_calculate_ecc(data, eccsize, code);
+		__nand_calculate_ecc_generic(data, eccsize, ref_code);
+		if (memcmp(code, ref_code, sizeof(code))) {
+			printk(KERN_ERR "mtd_eccspeedtest: not ok - "
+			       "nand-ecc-%u\n", eccsize);
+			print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16,
+				       4, data, eccsize, false);
+			return -EINVAL;
+		}
+	}
+
+	printk(PRINT_PREF "ok - nand-ecc-%u\n", eccsize);
+	return 0;
+}
+
+static void hamming_speed(const char *name, hamming_calc_t calc,
+			  unsigned int eccsize)
+{
+	unsigned long start, end;
+	unsigned char code[3];
+	int count;
+
+	for (start = jiffies, end = start + sec * HZ, count = 0;
+	     time_before(jiffies, end); count++)
+		calc(data, eccsize, code);
+
+	printk(PRINT_PREF "%s %u bytes: %d operations in %u seconds "
+	       "(%ld bytes)\n", name, eccsize, count, sec,
+	       (long)count * eccsize);
+}
+
+static int hamming_test(void)
+{
+	unsigned int eccsize;
+	int err;
+
+	for (eccsize = 256; eccsize <= 512; eccsize <<= 1) {
+		err = hamming_selftest(eccsize);
+		if (err)
+			return err;
+	}
+
+	for (eccsize = 256; eccsize <= 512; eccsize <<= 1) {
+		hamming_speed("__nand_calculate_ecc", __nand_calculate_ecc,
+			      eccsize);
+		hamming_speed("__nand_calculate_ecc_generic",
+			      __nand_calculate_ecc_generic, eccsize);
+	}
+
+	return 0;
+}
+
+#else
+
+static int hamming_test(void)
+{
+	return 0;
+}
+
+#endif
+
+#if defined(CONFIG_BCH) || defined(CONFIG_BCH_MODULE)
+
+typedef void (*bch_encode_t)(struct bch_control *bch, const uint8_t *data,
+			     unsigned int len, uint8_t *ecc);
+
+/* flip t distinct bits of the len bytes of error_data at offset */
+static void inject_errors(struct bch_control *bch, unsigned int offset,
+			  unsigned int len)
+{
+	unsigned int bit, byte;
+	unsigned char mask;
+	int i = 0;
+
+	while (i < bch->t) {
+		bit = random32() % (len * BITS_PER_BYTE);
+		byte = offset + bit / BITS_PER_BYTE;
+		mask = 1 << (bit % BITS_PER_BYTE);
+		if ((error_data[byte] ^ data[byte]) & mask)
+			continue;
+		error_data[byte] ^= mask;
+		i++;
+	}
+}
+
+static int bch_selftest(struct bch_control *bch, unsigned int len,
+			unsigned int offset)
+{
+	unsigned char *buf = data + offset;
+	uint8_t ecc[bch->ecc_bytes], ref_ecc[bch->ecc_bytes];
+	unsigned int errloc[bch->t];
+	int i, n, nerr;
+
+	for (i = 0; i < SELFTEST_ROUNDS; i++) {
+		get_random_bytes(buf, len);
+
+		memset(ecc, 0, sizeof(ecc));
+		memset(ref_ecc, 0, sizeof(ref_ecc));
+		encode_bch(bch, buf, len, ecc);
+		encode_bch_generic(bch, buf, len, ref_ecc);
+		if (memcmp(ecc, ref_ecc, sizeof(ecc)))
+			goto fail;
+
+		memcpy(error_data, data, len + offset);
+		inject_errors(bch, offset, len);
+
+		nerr = decode_bch(bch, error_data + offset, len, ecc, NULL,
+				  NULL, errloc);
+		if (nerr < 0)
+			goto fail;
+		for (n = 0; n < nerr; n++)
+			if (errloc[n] < 8 * len)
+				error_data[offset + errloc[n] / 8] ^=
+					1 << (errloc[n] % 8);
+		if (memcmp(error_data + offset, buf, len))
+			goto fail;
+	}
+
+	printk(PRINT_PREF "ok - bch-%d-%d-%u%s\n", bch->m, bch->t, len,
+	       offset ? "-unaligned" : "");
+	return 0;
+
+fail:
+	printk(KERN_ERR "mtd_eccspeedtest: not ok - bch-%d-%d-%u%s\n",
+	       bch->m, bch->t, len, offset ? "-unaligned" : "");
+	print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16, 4,
+		       buf, len, false);
+	return -EINVAL;
+}
+
+static void bch_encode_speed(struct bch_control *bch, const char *name,
+			     bch_encode_t encode, unsigned int len)
+{
+	uint8_t ecc[bch->ecc_bytes];
+	unsigned long start, end;
+	int count;
+
+	for (start = jiffies, end = start + sec * HZ, count = 0;
+	     time_before(jiffies, end); count++) {
+		memset(ecc, 0, sizeof(ecc));
+		encode(bch, data, len, ecc);
+	}
+
+	printk(PRINT_PREF "%s %u bytes: %d operations in %u seconds "
+	       "(%ld bytes)\n", name, len, count, sec, (long)count * len);
+}
+
+/* decoding with t errors, which runs the syndrome and root computation */
+static void bch_decode_speed(struct bch_control *bch, unsigned int len)
+{
+	uint8_t ecc[bch->ecc_bytes];
+	unsigned int errloc[bch->t];
+	unsigned long start, end;
+	int count;
+
+	memset(ecc, 0, sizeof(ecc));
+	encode_bch(bch, data, len, ecc);
+	memcpy(error_data, data, len);
+	inject_errors(bch, 0, len);
+
+	for (start = jiffies, end = start + sec * HZ, count = 0;
+	     time_before(jiffies, end); count++)
+		decode_bch(bch, error_data, len, ecc, NULL, NULL, errloc);
+
+	printk(PRINT_PREF "decode_bch %u bytes, %d errors: %d operations in "
+	       "%u seconds (%ld bytes)\n", len, bch->t, count, sec,
+	       (long)count * len);
+}
+
+static int bch_test(void)
+{
+	struct bch_control *bch;
+	int err;
+
+	bch = init_bch(m, t, 0);
+	if (!bch) {
+		printk(KERN_ERR "mtd_eccspeedtest: cannot init BCH m=%d t=%d\n",
+		       m, t);
+		return -EINVAL;
+	}
+
+	if (size > sizeof(data) - 1 || 8 * size > bch->n - bch->ecc_bits) {
+		printk(KERN_ERR "mtd_eccspeedtest: size %u too large\n", size);
+		err = -EINVAL;
+		goto out;
+	}
+
+	err = bch_selftest(bch, size, 0);
+	if (!err)
+		err = bch_selftest(bch, size, 1);
+	if (err)
+		goto out;
+
+	bch_encode_speed(bch, "encode_bch", encode_bch, size);
+	bch_encode_speed(bch, "encode_bch_generic", encode_bch_generic, size);
+	bch_decode_speed(bch, size);
+out:
+	free_bch(bch);
+	return err;
+}
+
+#else
+
+static int bch_test(void)
+{
+	return 0;
+}
+
+#endif
+
+static int __init mtd_eccspeedtest_init(void)
+{
+	int err = 0;
+
+	srandom32(jiffies);
+
+	if (mode == 0 || mode == 1)
+		err = hamming_test();
+	if (!err && (mode == 0 || mode == 2))
+		err = bch_test();
+
+	if (err) {
+		printk(KERN_ERR "mtd_eccspeedtest: one or more tests failed!\n");
+		return err;
+	}
+
+	/* All the work is done, do not keep the module loaded */
+	return -EAGAIN;
+}
+module_init(mtd_eccspeedtest_init);
+
+static void __exit mtd_eccspeedtest_exit(void)
+{
+}
+module_exit(mtd_eccspeedtest_exit);
+
+MODULE_DESCRIPTION("Software ECC self-test and speed test module");
+MODULE_LICENSE("GPL");
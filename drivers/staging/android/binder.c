@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -28,6 +29,7 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
@@ -35,9 +37,38 @@
 #include <linux/vmalloc.h>
 
 #include "binder.h"
+#include "binder_trace.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking
+ *
+ * binder_main_lock is held shared by ioctls and poll, and exclusive
+ * by open, the deferred work, the debugfs files and the few
+ * operations listed below. While it is held shared, no proc, thread
+ * or binder_context_mgr_node is created or freed, and a node's proc
+ * does not change.
+ *
+ * Everything a proc owns is protected by proc->lock: its threads,
+ * their todo lists and transaction stacks, its nodes, refs, buffers
+ * and todo list. The state of a node belongs to node->proc, that of a
+ * dead node to binder_dead_nodes_lock. A shared holder takes the lock
+ * of its own proc and of at most one other proc, in address order
+ * (binder_lock_other_proc()), so transactions between unrelated pairs
+ * of processes run in parallel.
+ *
+ * Operations that can reach the objects of any process take
+ * binder_main_lock exclusive instead: translating binder objects in
+ * a transaction, releasing a buffer that holds them, failing a reply
+ * through a dead thread, thread exit and proc release. The exclusive
+ * holder may touch everything, proc locks or not.
+ *
+ * Lock order: binder_main_lock -> proc->lock -> other proc->lock (by
+ * address) -> binder_dead_nodes_lock -> mmap_sem. binder_deferred_lock
+ * nests inside binder_main_lock.
+ */
+static DECLARE_RWSEM(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_MUTEX(binder_dead_nodes_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -47,7 +78,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id = ATOMIC_INIT(0);
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -145,25 +176,63 @@ enum binder_stat_types {
 	BINDER_STAT_COUNT
 };
 
+/* Counters are atomic: the global ones are updated without any lock */
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_REPLY_SG) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
+/*
+ * Latency histograms have one log2 bucket per power of two
+ * nanoseconds; the last bucket also counts everything slower.
+ */
+#define BINDER_LAT_HIST_BUCKETS	32
+
+static void binder_lat_hist_add(atomic_t *hist, s64 ns)
+{
+	int bucket = ns > 0 ? fls64(ns) - 1 : 0;
+
+	if (bucket >= BINDER_LAT_HIST_BUCKETS)
+		bucket = BINDER_LAT_HIST_BUCKETS - 1;
+	atomic_inc(&hist[bucket]);
+}
+
+/* Buffer allocator counters, kept globally and per proc */
+struct binder_alloc_stats {
+	atomic_t allocs;
+	atomic_t quick_hits;	/* served from a size class list */
+	atomic_t pages_mapped;	/* pages allocated and mapped */
+	atomic_t pages_reused;	/* pages found mapped in the cache */
+	atomic_t pages_shrunk;	/* cached pages freed by the shrinker */
+	atomic64_t alloc_ns;	/* total time spent in binder_alloc_buf */
+	atomic_t alloc_lat[BINDER_LAT_HIST_BUCKETS];
+};
+
+static struct binder_alloc_stats binder_alloc_stats;
+
+#define binder_alloc_stats_inc(proc, field) \
+	do { \
+		atomic_inc(&binder_alloc_stats.field); \
+		atomic_inc(&(proc)->alloc_stats.field); \
+	} while (0)
+
+/* Mapped pages on the lru_pages lists of all procs */
+static atomic_t binder_lru_count = ATOMIC_INIT(0);
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -177,24 +246,27 @@ struct binder_transaction_log_entry {
 	int offsets_size;
 };
 struct binder_transaction_log {
-	int next;
+	atomic_t cur;	/* index of the last entry added, -1 if none */
 	int full;
 	struct binder_transaction_log_entry entry[32];
 };
-static struct binder_transaction_log binder_transaction_log;
-static struct binder_transaction_log binder_transaction_log_failed;
+static struct binder_transaction_log binder_transaction_log = {
+	.cur = ATOMIC_INIT(-1),
+};
+static struct binder_transaction_log binder_transaction_log_failed = {
+	.cur = ATOMIC_INIT(-1),
+};
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
-	e = &log->entry[log->next];
-	memset(e, 0, sizeof(*e));
-	log->next++;
-	if (log->next == ARRAY_SIZE(log->entry)) {
-		log->next = 0;
+	unsigned int cur = atomic_inc_return(&log->cur);
+
+	if (cur >= ARRAY_SIZE(log->entry))
 		log->full = 1;
-	}
+	e = &log->entry[cur % ARRAY_SIZE(log->entry)];
+	memset(e, 0, sizeof(*e));
 	return e;
 }
 
@@ -230,7 +302,9 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
-	unsigned min_priority:8;
+	unsigned inherit_rt:1;
+	unsigned sched_policy:2;
+	unsigned min_priority:8;	/* kernel prio, with sched_policy */
 	struct list_head async_todo;
 };
 
@@ -258,21 +332,55 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head quick_entry; /* on a size class list */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned quick:1; /* freed, kept on a size class list */
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
 	struct binder_node *target_node;
 	size_t data_size;
 	size_t offsets_size;
+	size_t extra_buffers_size; /* gathered buffer objects, after offsets */
 	uint8_t data[0];
 };
 
+/*
+ * Freed buffers that can hold up to BINDER_QUICK_MAX bytes are kept
+ * whole, pages mapped, on per size class lists of up to
+ * BINDER_QUICK_DEPTH buffers each. Class n holds buffers of
+ * BINDER_QUICK_MIN << n bytes or more, so an allocation is served from
+ * the list of the smallest class at least as large without searching
+ * or splitting the free space and without touching page tables.
+ */
+#define BINDER_QUICK_MIN_SHIFT	5
+#define BINDER_QUICK_MIN	(1U << BINDER_QUICK_MIN_SHIFT)
+#define BINDER_QUICK_CLASSES	7
+#define BINDER_QUICK_MAX	(BINDER_QUICK_MIN << (BINDER_QUICK_CLASSES - 1))
+#define BINDER_QUICK_DEPTH	4
+
+/*
+ * A page of the buffer area. Pages no buffer uses any more stay
+ * mapped, on proc->lru_pages, until the shrinker frees them.
+ */
+struct binder_lru_page {
+	struct page *page_ptr;
+	struct list_head lru;
+};
+
+/* A scheduling policy and a kernel prio, as in task->normal_prio */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -280,6 +388,7 @@ enum binder_deferred_state {
 };
 
 struct binder_proc {
+	struct mutex lock;	/* see "Locking" above */
 	struct hlist_node proc_node;
 	struct rb_root threads;
 	struct rb_root nodes;
@@ -299,7 +408,16 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct list_head quick_buffers[BINDER_QUICK_CLASSES];
+	int quick_count[BINDER_QUICK_CLASSES];
+
+	struct binder_lru_page *pages;
+	struct list_head lru_pages;
+	int pages_mapped;	/* including those on lru_pages */
+	int pages_cached;	/* on lru_pages */
+	struct binder_alloc_stats alloc_stats;
+	/* round trip of synchronous transactions sent, send to reply */
+	atomic_t rtt_lat[BINDER_LAT_HIST_BUCKETS];
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -310,7 +428,7 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_priority default_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -352,14 +470,85 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static void binder_proc_lock(struct binder_proc *proc, const char *tag)
+{
+	trace_binder_lock(tag);
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
+	trace_binder_locked(tag);
+}
+
+static void binder_proc_unlock(struct binder_proc *proc, const char *tag)
+{
+	trace_binder_unlock(tag);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
+}
+
+/*
+ * Switch from binder_proc_lock() to the exclusive lock, keeping
+ * proc->lock for symmetry. Everything looked up so far must be looked
+ * up again.
+ */
+static void binder_lock_upgrade(struct binder_proc *proc)
+{
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
+	trace_binder_lock(__func__);
+	down_write(&binder_main_lock);
+	mutex_lock(&proc->lock);
+	trace_binder_locked(__func__);
+}
+
+static void binder_lock_downgrade(struct binder_proc *proc)
+{
+	downgrade_write(&binder_main_lock);
+}
+
+/*
+ * Take @other->lock in addition to @proc->lock, which the caller holds.
+ * Returns 0 if @proc->lock was held throughout, 1 if it had to be
+ * dropped to respect the lock order, in which case whatever the caller
+ * looked up under it must be looked up again. @other may be NULL, for
+ * the owner of dead nodes.
+ */
+static int binder_lock_other_proc(struct binder_proc *proc,
+				  struct binder_proc *other)
+{
+	if (other == NULL) {
+		mutex_lock(&binder_dead_nodes_lock);
+		return 0;
+	}
+	if (other == proc)
+		return 0;
+	if (proc < other) {
+		mutex_lock_nested(&other->lock, SINGLE_DEPTH_NESTING);
+		return 0;
+	}
+	mutex_unlock(&proc->lock);
+	mutex_lock(&other->lock);
+	mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+	return 1;
+}
+
+static void binder_unlock_other_proc(struct binder_proc *proc,
+				     struct binder_proc *other)
+{
+	if (other == NULL)
+		mutex_unlock(&binder_dead_nodes_lock);
+	else if (other != proc)
+		mutex_unlock(&other->lock);
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -498,21 +687,197 @@ out_unlock:
 	return -EBADF;
 }
 
-static void binder_set_nice(long nice)
+#define BINDER_NICE_TO_PRIO(nice)	(MAX_RT_PRIO + (nice) + 20)
+#define BINDER_PRIO_TO_NICE(prio)	((prio) - MAX_RT_PRIO - 20)
+
+/*
+ * Node minimum priority that never raises anything: what libbinder's
+ * nice value of 0x7f has always meant.
+ */
+#define BINDER_PRIO_NO_FLOOR		BINDER_NICE_TO_PRIO(0x7f)
+
+static bool binder_is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static bool binder_is_fair_policy(int policy)
+{
+	return policy == SCHED_NORMAL || policy == SCHED_BATCH;
+}
+
+static bool binder_supported_policy(int policy)
+{
+	return binder_is_fair_policy(policy) || binder_is_rt_policy(policy);
+}
+
+/* Nice value or RT priority, as userspace sees them */
+static int binder_to_userspace_prio(int policy, int kernel_priority)
+{
+	if (binder_is_fair_policy(policy))
+		return BINDER_PRIO_TO_NICE(kernel_priority);
+	else
+		return MAX_USER_RT_PRIO - 1 - kernel_priority;
+}
+
+static int binder_to_kernel_prio(int policy, int user_priority)
 {
-	long min_nice;
-	if (can_nice(current, nice)) {
-		set_user_nice(current, nice);
+	if (binder_is_fair_policy(policy))
+		return BINDER_NICE_TO_PRIO(user_priority);
+	else
+		return MAX_USER_RT_PRIO - 1 - user_priority;
+}
+
+/*
+ * Switch the current thread to @desired. With @verify, the thread's
+ * RLIMIT_RTPRIO and RLIMIT_NICE cap the result unless it has
+ * CAP_SYS_NICE; restoring a priority the thread had is not checked.
+ */
+static void binder_do_set_priority(struct binder_priority desired,
+				   bool verify)
+{
+	struct task_struct *task = current;
+	unsigned int policy = desired.sched_policy;
+	int priority;
+	bool has_cap_nice;
+
+	if (task->policy == policy && task->normal_prio == desired.prio)
 		return;
+
+	has_cap_nice = has_capability_noaudit(task, CAP_SYS_NICE);
+	priority = binder_to_userspace_prio(policy, desired.prio);
+
+	if (verify && binder_is_rt_policy(policy) && !has_cap_nice) {
+		long max_rtprio = task_rlimit(task, RLIMIT_RTPRIO);
+
+		if (max_rtprio == 0) {
+			policy = SCHED_NORMAL;
+			priority = -20;
+		} else if (priority > max_rtprio) {
+			priority = max_rtprio;
+		}
 	}
-	min_nice = 20 - current->signal->rlim[RLIMIT_NICE].rlim_cur;
-	binder_debug(BINDER_DEBUG_PRIORITY_CAP,
-		     "binder: %d: nice value %ld not allowed use "
-		     "%ld instead\n", current->pid, nice, min_nice);
-	set_user_nice(current, min_nice);
-	if (min_nice < 20)
-		return;
-	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
+
+	if (verify && binder_is_fair_policy(policy) && !has_cap_nice) {
+		long min_nice = 20 - task_rlimit(task, RLIMIT_NICE);
+
+		if (min_nice > 19) {
+			binder_user_error("binder: %d RLIMIT_NICE not set\n",
+					  task->pid);
+			return;
+		} else if (priority < min_nice) {
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: nice value %d not allowed "
+				     "use %ld instead\n", task->pid, priority,
+				     min_nice);
+			priority = min_nice;
+		}
+	}
+
+	trace_binder_set_priority(task->tgid, task->pid, task->normal_prio,
+				  binder_to_kernel_prio(policy, priority),
+				  desired.prio);
+
+	if (binder_is_rt_policy(policy)) {
+		struct sched_param params = { .sched_priority = priority };
+
+		sched_setscheduler_nocheck(task, policy | SCHED_RESET_ON_FORK,
+					   &params);
+	} else {
+		struct sched_param params = { .sched_priority = 0 };
+
+		if (task->policy != policy)
+			sched_setscheduler_nocheck(task,
+					policy | SCHED_RESET_ON_FORK, &params);
+		set_user_nice(task, priority);
+	}
+}
+
+static void binder_set_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(desired, true);
+}
+
+static void binder_restore_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(desired, false);
+}
+
+/* Policy and userspace priority in flat_binder_object flags */
+static int binder_flags_priority(unsigned long flags, int *priority)
+{
+	int policy = (flags & FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+		FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+
+	*priority = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+	/* For SCHED_NORMAL and SCHED_BATCH the low byte is a nice value */
+	if (binder_is_fair_policy(policy))
+		*priority = (s8)*priority;
+	return policy;
+}
+
+/*
+ * An RT minimum priority must be a valid RT priority. Any nice value
+ * is accepted: libbinder sends 0x7f for every node.
+ */
+static bool binder_flags_priority_valid(unsigned long flags)
+{
+	int priority;
+	int policy = binder_flags_priority(flags, &priority);
+
+	if (binder_is_fair_policy(policy))
+		return true;
+	return priority >= 1 && priority < MAX_USER_RT_PRIO;
+}
+
+/*
+ * Minimum priority of a new node, from its flat_binder_object flags,
+ * checked with binder_flags_priority_valid(). A nice value out of the
+ * -20..19 range means no minimum priority.
+ */
+static void binder_node_set_priority(struct binder_node *node,
+				     unsigned long flags)
+{
+	int priority;
+	int policy = binder_flags_priority(flags, &priority);
+
+	node->sched_policy = policy;
+	if (binder_is_fair_policy(policy) && (priority < -20 || priority > 19))
+		node->min_priority = BINDER_PRIO_NO_FLOOR;
+	else
+		node->min_priority = binder_to_kernel_prio(policy, priority);
+	node->inherit_rt = !!(flags & FLAT_BINDER_FLAG_INHERIT_RT);
+}
+
+/*
+ * Called by the thread that picked up @t for @node. A synchronous
+ * transaction runs at the caller's priority, real-time only if the node
+ * allows it; both kinds run at least at the node's minimum priority.
+ */
+static void binder_transaction_priority(struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority desired = t->priority;
+	struct binder_priority node_prio = {
+		.sched_policy = node->sched_policy,
+		.prio = node->min_priority,
+	};
+
+	t->saved_priority.sched_policy = current->policy;
+	t->saved_priority.prio = current->normal_prio;
+
+	if (!node->inherit_rt && binder_is_rt_policy(desired.sched_policy)) {
+		desired.sched_policy = SCHED_NORMAL;
+		desired.prio = BINDER_NICE_TO_PRIO(0);
+	}
+	if (t->flags & TF_ONE_WAY)
+		desired = t->saved_priority;
+
+	/* A lower kernel prio is a higher priority, whatever the policy */
+	if (node_prio.prio < desired.prio)
+		desired = node_prio;
+
+	binder_set_priority(desired);
 }
 
 static size_t binder_buffer_size(struct binder_proc *proc,
@@ -607,6 +972,27 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add(struct binder_proc *proc,
+			   struct binder_lru_page *page)
+{
+	list_add_tail(&page->lru, &proc->lru_pages);
+	proc->pages_cached++;
+	atomic_inc(&binder_lru_count);
+}
+
+static void binder_lru_del(struct binder_proc *proc,
+			   struct binder_lru_page *page)
+{
+	list_del_init(&page->lru);
+	proc->pages_cached--;
+	atomic_dec(&binder_lru_count);
+}
+
+/*
+ * Freeing a range only moves its pages to proc->lru_pages, mapped.
+ * Allocating takes them back from there and maps new pages for the
+ * rest, which is the only case that needs mmap_sem.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,8 +1000,11 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
-	struct mm_struct *mm;
+	struct binder_lru_page *page;
+	struct page **page_array_ptr;
+	struct mm_struct *mm = NULL;
+	int need_map = 0;
+	int ret;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -624,18 +1013,27 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
-	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
-
-	if (mm) {
-		down_write(&mm->mmap_sem);
-		vma = proc->vma;
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (allocate == 0) {
+			BUG_ON(page->page_ptr == NULL);
+			binder_lru_add(proc, page);
+		} else if (page->page_ptr) {
+			binder_lru_del(proc, page);
+			binder_alloc_stats_inc(proc, pages_reused);
+		} else
+			need_map = 1;
 	}
+	if (!need_map)
+		return 0;
 
-	if (allocate == 0)
-		goto free_range;
+	if (vma == NULL) {
+		mm = get_task_mm(proc->tsk);
+		if (mm) {
+			down_write(&mm->mmap_sem);
+			vma = proc->vma;
+		}
+	}
 
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
@@ -644,20 +1042,19 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr)
+			continue;
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,7 +1064,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -675,6 +1072,8 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
+		proc->pages_mapped++;
+		binder_alloc_stats_inc(proc, pages_mapped);
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -682,22 +1081,19 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
 err_no_vma:
+	/* Whatever is mapped goes back to the cache */
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr)
+			binder_lru_add(proc, page);
+	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -705,16 +1101,169 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Free up to @nr_to_scan pages from the cache of @proc, oldest first.
+ * Called by the shrinker, which must not wait for mmap_sem.
+ */
+static int binder_shrink_proc(struct binder_proc *proc, int nr_to_scan)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
+	struct binder_lru_page *page;
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+	void *page_addr;
+	int freed = 0;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm == NULL) {
+		/* Without the mm the user mapping cannot be zapped */
+		if (proc->vma)
+			return 0;
+	} else if (!down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		return 0;
+	}
+	vma = mm ? proc->vma : NULL;
+
+	while (freed < nr_to_scan && !list_empty(&proc->lru_pages)) {
+		page = list_first_entry(&proc->lru_pages,
+					struct binder_lru_page, lru);
+		page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+		binder_lru_del(proc, page);
+		if (vma)
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		proc->pages_mapped--;
+		binder_alloc_stats_inc(proc, pages_shrunk);
+		freed++;
+	}
+
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return freed;
+}
+
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int nr_to_scan = sc->nr_to_scan;
+
+	if (nr_to_scan <= 0)
+		return atomic_read(&binder_lru_count);
+
+	/*
+	 * Binder allocates memory with its own locks held, so reclaim
+	 * only trylocks them and skips whatever is busy.
+	 */
+	if (!down_read_trylock(&binder_main_lock))
+		return -1;
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (!proc->pages_cached || !mutex_trylock(&proc->lock))
+			continue;
+		nr_to_scan -= binder_shrink_proc(proc, nr_to_scan);
+		mutex_unlock(&proc->lock);
+		if (nr_to_scan <= 0)
+			break;
+	}
+	up_read(&binder_main_lock);
+
+	return atomic_read(&binder_lru_count);
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/* Size class whose buffers all hold @size bytes, -1 if none */
+static int binder_quick_class(size_t size)
+{
+	if (size > BINDER_QUICK_MAX)
+		return -1;
+	if (size <= BINDER_QUICK_MIN)
+		return 0;
+	return fls((size - 1) >> BINDER_QUICK_MIN_SHIFT);
+}
+
+static struct binder_buffer *binder_quick_get(struct binder_proc *proc,
+					      size_t size)
+{
+	struct binder_buffer *buffer;
+	int class = binder_quick_class(size);
+
+	if (class < 0 || list_empty(&proc->quick_buffers[class]))
+		return NULL;
+	buffer = list_first_entry(&proc->quick_buffers[class],
+				  struct binder_buffer, quick_entry);
+	BUG_ON(!buffer->quick || buffer->free);
+	list_del(&buffer->quick_entry);
+	proc->quick_count[class]--;
+	buffer->quick = 0;
+	return buffer;
+}
+
+/* Keep @buffer, just freed, on a size class list if there is room */
+static int binder_quick_put(struct binder_proc *proc,
+			    struct binder_buffer *buffer, size_t buffer_size)
+{
+	int class;
+
+	if (buffer_size < BINDER_QUICK_MIN ||
+	    buffer_size >= BINDER_QUICK_MAX << 1)
+		return 0;
+	class = fls(buffer_size >> BINDER_QUICK_MIN_SHIFT) - 1;
+	if (proc->quick_count[class] >= BINDER_QUICK_DEPTH)
+		return 0;
+	buffer->quick = 1;
+	list_add(&buffer->quick_entry, &proc->quick_buffers[class]);
+	proc->quick_count[class]++;
+	return 1;
+}
+
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer);
+
+/* Return all buffers on the size class lists to the free space */
+static int binder_quick_flush(struct binder_proc *proc)
+{
+	struct binder_buffer *buffer;
+	int flushed = 0;
+	int class;
+
+	for (class = 0; class < BINDER_QUICK_CLASSES; class++) {
+		while (!list_empty(&proc->quick_buffers[class])) {
+			buffer = list_first_entry(&proc->quick_buffers[class],
+						  struct binder_buffer,
+						  quick_entry);
+			BUG_ON(!buffer->quick);
+			list_del(&buffer->quick_entry);
+			buffer->quick = 0;
+			__binder_free_buf(proc, buffer);
+			flushed++;
+		}
+		proc->quick_count[class] = 0;
+	}
+	return flushed;
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						size_t extra_buffers_size,
+						int is_async)
+{
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
+	struct rb_node *best_fit;
 	void *has_page_addr;
 	void *end_page_addr;
+	size_t data_offsets_size;
 	size_t size;
 
 	if (proc->vma == NULL) {
@@ -723,14 +1272,22 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
+	data_offsets_size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
 
-	if (size < data_size || size < offsets_size) {
+	if (data_offsets_size < data_size ||
+	    data_offsets_size < offsets_size) {
 		binder_user_error("binder: %d: got transaction with invalid "
 			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
 		return NULL;
 	}
+	size = data_offsets_size + ALIGN(extra_buffers_size, sizeof(void *));
+	if (size < data_offsets_size || size < extra_buffers_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"extra buffers size %zd\n", proc->pid,
+			extra_buffers_size);
+		return NULL;
+	}
 
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
@@ -740,6 +1297,15 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	buffer = binder_quick_get(proc, size);
+	if (buffer) {
+		binder_alloc_stats_inc(proc, quick_hits);
+		goto found;
+	}
+
+retry:
+	n = proc->free_buffers.rb_node;
+	best_fit = NULL;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -756,6 +1322,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		}
 	}
 	if (best_fit == NULL) {
+		if (binder_quick_flush(proc))
+			goto retry;
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
@@ -787,18 +1355,21 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
-	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
 		list_add(&new_buffer->entry, &buffer->entry);
 		new_buffer->free = 1;
+		new_buffer->quick = 0;
 		binder_insert_free_buffer(proc, new_buffer);
 	}
+found:
+	binder_insert_allocated_buffer(proc, buffer);
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
+	buffer->extra_buffers_size = extra_buffers_size;
 	buffer->async_transaction = is_async;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
@@ -811,6 +1382,30 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size,
+					      size_t extra_buffers_size,
+					      int is_async)
+{
+	struct binder_buffer *buffer;
+	ktime_t start = ktime_get();
+
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size,
+				    extra_buffers_size, is_async);
+	if (buffer) {
+		s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		binder_alloc_stats_inc(proc, allocs);
+		atomic64_add(ns, &binder_alloc_stats.alloc_ns);
+		atomic64_add(ns, &proc->alloc_stats.alloc_ns);
+		binder_lat_hist_add(binder_alloc_stats.alloc_lat, ns);
+		binder_lat_hist_add(proc->alloc_stats.alloc_lat, ns);
+		trace_binder_transaction_alloc_buf(proc, buffer, ns);
+	}
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -876,13 +1471,15 @@ static void binder_free_buf(struct binder_proc *proc,
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+		ALIGN(buffer->offsets_size, sizeof(void *)) +
+		ALIGN(buffer->extra_buffers_size, sizeof(void *));
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_free_buf %p size %zd buffer"
 		     "_size %zd\n", proc->pid, buffer, size, buffer_size);
 
 	BUG_ON(buffer->free);
+	BUG_ON(buffer->quick);
 	BUG_ON(size > buffer_size);
 	BUG_ON(buffer->transaction != NULL);
 	BUG_ON((void *)buffer < proc->buffer);
@@ -897,11 +1494,22 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
+	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
+	if (binder_quick_put(proc, buffer, buffer_size))
+		return;
+	__binder_free_buf(proc, buffer);
+}
+
+/* Give the space of @buffer, in no tree, back to the free space */
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
+{
+	size_t buffer_size = binder_buffer_size(proc, buffer);
+
 	binder_update_page_range(proc, 0,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
 		NULL);
-	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
 		struct binder_buffer *next = list_entry(buffer->entry.next,
@@ -968,11 +1576,13 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
+	node->sched_policy = SCHED_NORMAL;
+	node->min_priority = BINDER_NICE_TO_PRIO(0);
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
@@ -1103,7 +1713,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1367,6 +1977,10 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				task_close_fd(proc, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			/* Lives in the buffer itself, nothing to release */
+			break;
+
 		default:
 			printk(KERN_ERR "binder: transaction release %d bad "
 			       "object type %lx\n", debug_id, fp->type);
@@ -1375,14 +1989,24 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
-static void binder_transaction(struct binder_proc *proc,
-			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+/*
+ * Called with binder_proc_lock(proc) held, or with the exclusive lock
+ * if @exclusive is set. Returns -EAGAIN, before doing anything, if
+ * the transaction needs the exclusive lock, and 0 otherwise; failures
+ * are reported through thread->return_error.
+ */
+static int binder_transaction(struct binder_proc *proc,
+			      struct binder_thread *thread,
+			      struct binder_transaction_data *tr, int reply,
+			      int exclusive, size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
-	size_t *offp, *off_end;
+	size_t *offp, *off_start, *off_end;
+	uint8_t *sg_start, *sg_bufp, *sg_end;
 	struct binder_proc *target_proc;
+	struct binder_proc *locked_proc = NULL;
+	int target_locked = 0;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
 	struct list_head *target_list;
@@ -1391,6 +2015,10 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
 
+	if (!exclusive && (tr->offsets_size || (reply &&
+	    thread->transaction_stack && !thread->transaction_stack->from)))
+		return -EAGAIN;
+
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
 	e->from_proc = proc->pid;
@@ -1408,7 +2036,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1428,6 +2056,14 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		/*
+		 * Our transaction stack and in_reply_to->from only change
+		 * under this thread or the exclusive lock, so nothing needs
+		 * to be looked up again if proc->lock had to be dropped.
+		 */
+		locked_proc = target_thread->proc;
+		binder_lock_other_proc(proc, locked_proc);
+		target_locked = 1;
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1443,6 +2079,7 @@ static void binder_transaction(struct binder_proc *proc,
 		}
 		target_proc = target_thread->proc;
 	} else {
+retry_target:
 		if (tr->target.handle) {
 			struct binder_ref *ref;
 			ref = binder_get_ref(proc, tr->target.handle);
@@ -1467,6 +2104,16 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		if (target_locked && locked_proc != target_proc) {
+			binder_unlock_other_proc(proc, locked_proc);
+			target_locked = 0;
+		}
+		if (!target_locked) {
+			locked_proc = target_proc;
+			target_locked = 1;
+			if (binder_lock_other_proc(proc, target_proc))
+				goto retry_target;
+		}
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
@@ -1513,7 +2160,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1542,9 +2189,18 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	if (binder_supported_policy(current->policy)) {
+		t->priority.sched_policy = current->policy;
+		t->priority.prio = current->normal_prio;
+	} else {
+		/* e.g. SCHED_IDLE, which binder_set_priority() cannot apply */
+		t->priority = proc->default_priority;
+	}
+	t->start_time = ktime_get();
+	trace_binder_transaction(reply, t, target_node);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
@@ -1577,7 +2233,11 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_bad_offset;
 	}
+	off_start = offp;
 	off_end = (void *)offp + tr->offsets_size;
+	sg_start = (uint8_t *)offp + ALIGN(tr->offsets_size, sizeof(void *));
+	sg_bufp = sg_start;
+	sg_end = sg_start + extra_buffers_size;
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
 		if (*offp > t->buffer->data_size - sizeof(*fp) ||
@@ -1596,12 +2256,20 @@ static void binder_transaction(struct binder_proc *proc,
 			struct binder_ref *ref;
 			struct binder_node *node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
+				if (!binder_flags_priority_valid(fp->flags)) {
+					binder_user_error("binder: %d:%d got "
+						"node with invalid priority "
+						"flags %lx\n", proc->pid,
+						thread->pid, fp->flags);
+					return_error = BR_FAILED_REPLY;
+					goto err_binder_new_node_failed;
+				}
 				node = binder_new_node(proc, fp->binder, fp->cookie);
 				if (node == NULL) {
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				binder_node_set_priority(node, fp->flags);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1707,6 +2375,71 @@ static void binder_transaction(struct binder_proc *proc,
 			fp->handle = target_fd;
 		} break;
 
+		case BINDER_TYPE_PTR: {
+			struct binder_buffer_object *bp, *parent;
+			uint8_t *parent_buf;
+			size_t len;
+
+			bp = (struct binder_buffer_object *)fp;
+			if (*offp > t->buffer->data_size - sizeof(*bp) ||
+			    t->buffer->data_size < sizeof(*bp)) {
+				binder_user_error("binder: %d:%d got transaction with "
+					"invalid offset, %zd\n",
+					proc->pid, thread->pid, *offp);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_offset;
+			}
+			len = ALIGN(bp->length, sizeof(void *));
+			if (len < bp->length || len > sg_end - sg_bufp) {
+				binder_user_error("binder: %d:%d got transaction with "
+					"buffer object of %zd bytes, only %zd "
+					"left\n", proc->pid, thread->pid,
+					bp->length, sg_end - sg_bufp);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_offset;
+			}
+			if (copy_from_user(sg_bufp, bp->buffer, bp->length)) {
+				binder_user_error("binder: %d:%d got transaction with "
+					"invalid buffer object ptr\n",
+					proc->pid, thread->pid);
+				return_error = BR_FAILED_REPLY;
+				goto err_copy_data_failed;
+			}
+			bp->buffer = sg_bufp + target_proc->user_buffer_offset;
+			binder_debug(BINDER_DEBUG_TRANSACTION,
+				     "        buffer %zd bytes -> %p\n",
+				     bp->length, bp->buffer);
+
+			if (bp->flags & BINDER_BUFFER_FLAG_HAS_PARENT) {
+				/*
+				 * The parent must be an earlier buffer object
+				 * whose copy holds the pointer. Its fields
+				 * are only trusted as far as they stay within
+				 * the buffers gathered so far.
+				 */
+				if (bp->parent >= offp - off_start)
+					goto err_bad_parent;
+				parent = (struct binder_buffer_object *)
+					(t->buffer->data + off_start[bp->parent]);
+				if (parent->type != BINDER_TYPE_PTR)
+					goto err_bad_parent;
+				parent_buf = (uint8_t *)parent->buffer -
+					target_proc->user_buffer_offset;
+				if (parent_buf < sg_start ||
+				    parent_buf > sg_bufp ||
+				    parent->length > sg_bufp - parent_buf ||
+				    parent->length < sizeof(void *) ||
+				    bp->parent_offset >
+				    parent->length - sizeof(void *) ||
+				    !IS_ALIGNED(bp->parent_offset,
+						sizeof(void *)))
+					goto err_bad_parent;
+				*(void **)(parent_buf + bp->parent_offset) =
+					bp->buffer;
+			}
+			sg_bufp += len;
+		} break;
+
 		default:
 			binder_user_error("binder: %d:%d got transactio"
 				"n with invalid object type, %lx\n",
@@ -1716,6 +2449,11 @@ static void binder_transaction(struct binder_proc *proc,
 		}
 	}
 	if (reply) {
+		s64 rtt = ktime_to_ns(ktime_sub(ktime_get(),
+						in_reply_to->start_time));
+
+		binder_lat_hist_add(target_proc->rtt_lat, rtt);
+		trace_binder_reply(t, in_reply_to, rtt);
 		BUG_ON(t->buffer->async_transaction != 0);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
@@ -1738,8 +2476,14 @@ static void binder_transaction(struct binder_proc *proc,
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
-	return;
+	binder_unlock_other_proc(proc, locked_proc);
+	return 0;
 
+err_bad_parent:
+	binder_user_error("binder: %d:%d got transaction with invalid "
+		"parent for buffer object at offset %zd\n",
+		proc->pid, thread->pid, *offp);
+	return_error = BR_FAILED_REPLY;
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1781,23 +2525,31 @@ err_no_context_mgr_node:
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
 		thread->return_error = return_error;
+	if (target_locked)
+		binder_unlock_other_proc(proc, locked_proc);
+	return 0;
 }
 
+/*
+ * Called with binder_proc_lock(proc) held. The few commands that need
+ * the exclusive lock upgrade to it and downgrade again once done.
+ */
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			void __user *buffer, int size, signed long *consumed)
 {
 	uint32_t cmd;
 	void __user *ptr = buffer + *consumed;
 	void __user *end = buffer + size;
+	int exclusive = 0;
 
 	while (ptr < end && thread->return_error == BR_OK) {
 		if (get_user(cmd, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1806,6 +2558,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_DECREFS: {
 			uint32_t target;
 			struct binder_ref *ref;
+			struct binder_proc *owner = NULL;
+			int locked = 0;
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
@@ -1813,9 +2567,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			ptr += sizeof(uint32_t);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
+				/* Nothing was looked up yet, so no retry */
+				owner = binder_context_mgr_node->proc;
+				binder_lock_other_proc(proc, owner);
+				locked = 1;
 				ref = binder_get_ref_for_node(proc,
 					       binder_context_mgr_node);
-				if (ref->desc != target) {
+				if (ref && ref->desc != target) {
 					binder_user_error("binder: %d:"
 						"%d tried to acquire "
 						"reference to desc 0, "
@@ -1823,9 +2581,26 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						proc->pid, thread->pid,
 						ref->desc);
 				}
-			} else
+			} else {
+retry_ref:
+				/* The owner of the node holds its refcounts */
 				ref = binder_get_ref(proc, target);
+				if (ref) {
+					owner = ref->node->proc;
+					locked = 1;
+					if (binder_lock_other_proc(proc, owner)) {
+						ref = binder_get_ref(proc, target);
+						if (ref && ref->node->proc != owner) {
+							binder_unlock_other_proc(proc, owner);
+							locked = 0;
+							goto retry_ref;
+						}
+					}
+				}
+			}
 			if (ref == NULL) {
+				if (locked)
+					binder_unlock_other_proc(proc, owner);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1854,6 +2629,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			binder_unlock_other_proc(proc, owner);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1934,6 +2710,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			ptr += sizeof(void *);
 
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			if (buffer && buffer->offsets_size && !exclusive) {
+				/*
+				 * Releasing the objects in it can reach the
+				 * nodes and refs of any process.
+				 */
+				binder_lock_upgrade(proc);
+				exclusive = 1;
+				buffer = binder_buffer_lookup(proc, data_ptr);
+			}
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
@@ -1975,7 +2760,34 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			if (binder_transaction(proc, thread, &tr,
+					       cmd == BC_REPLY, exclusive, 0)) {
+				binder_lock_upgrade(proc);
+				exclusive = 1;
+				binder_transaction(proc, thread, &tr,
+						   cmd == BC_REPLY, exclusive, 0);
+			}
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			if (binder_transaction(proc, thread,
+					       &tr.transaction_data,
+					       cmd == BC_REPLY_SG, exclusive,
+					       tr.buffers_size)) {
+				binder_lock_upgrade(proc);
+				exclusive = 1;
+				binder_transaction(proc, thread,
+						   &tr.transaction_data,
+						   cmd == BC_REPLY_SG, exclusive,
+						   tr.buffers_size);
+			}
 			break;
 		}
 
@@ -2163,6 +2975,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			       proc->pid, thread->pid, cmd);
 			return -EINVAL;
 		}
+		if (exclusive) {
+			binder_lock_downgrade(proc);
+			exclusive = 0;
+		}
 		*consumed = ptr - buffer;
 	}
 	return 0;
@@ -2172,9 +2988,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2232,7 +3048,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_proc_unlock(proc, __func__);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2243,7 +3059,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2256,7 +3072,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_proc_lock(proc, __func__);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2406,13 +3222,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2447,6 +3257,7 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		trace_binder_transaction_received(t);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2598,12 +3409,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_proc_lock(proc, __func__);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_proc_unlock(proc, __func__);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,6 +3439,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	int exclusive = 0;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2635,7 +3447,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_proc_lock(proc, __func__);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2694,6 +3506,8 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	case BINDER_SET_CONTEXT_MGR:
+		binder_lock_upgrade(proc);
+		exclusive = 1;
 		if (binder_context_mgr_node != NULL) {
 			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
 			ret = -EBUSY;
@@ -2723,6 +3537,8 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
+		binder_lock_upgrade(proc);
+		exclusive = 1;
 		binder_free_thread(proc, thread);
 		thread = NULL;
 		break;
@@ -2744,7 +3560,9 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	if (exclusive)
+		binder_lock_downgrade(proc);
+	binder_proc_unlock(proc, __func__);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2873,6 +3691,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2884,14 +3703,24 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	for (i = 0; i < BINDER_QUICK_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->quick_buffers[i]);
+	INIT_LIST_HEAD(&proc->lru_pages);
+	if (binder_supported_policy(current->policy)) {
+		proc->default_priority.sched_policy = current->policy;
+		proc->default_priority.prio = current->normal_prio;
+	} else {
+		proc->default_priority.sched_policy = SCHED_NORMAL;
+		proc->default_priority.prio = BINDER_NICE_TO_PRIO(0);
+	}
+	mutex_init(&proc->lock);
+	down_write(&binder_main_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	up_write(&binder_main_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -3035,7 +3864,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			if (proc->pages[i].page_ptr) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
@@ -3044,10 +3873,11 @@ static void binder_deferred_release(struct binder_proc *proc)
 					     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(proc->pages[i].page_ptr);
 				page_count++;
 			}
 		}
+		atomic_sub(proc->pages_cached, &binder_lru_count);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -3071,7 +3901,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3928,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3122,13 +3952,14 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %d:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3330,7 +4161,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3351,17 +4184,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,14 +4206,48 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
+	}
+}
+
+/* Non-empty buckets only, one line each: "<lower bound in ns> <count>" */
+static void print_binder_lat_hist(struct seq_file *m, const char *prefix,
+				  const char *name, atomic_t *hist)
+{
+	int i;
+
+	seq_printf(m, "%s%s:\n", prefix, name);
+	for (i = 0; i < BINDER_LAT_HIST_BUCKETS; i++) {
+		int count = atomic_read(&hist[i]);
+
+		if (count)
+			seq_printf(m, "%s  %llu %d\n", prefix, 1ULL << i,
+				   count);
 	}
 }
 
+static void print_binder_alloc_stats(struct seq_file *m, const char *prefix,
+				     struct binder_alloc_stats *stats)
+{
+	int allocs = atomic_read(&stats->allocs);
+
+	seq_printf(m, "%salloc: %d avg %lld ns, size class hits %d\n",
+		   prefix, allocs, allocs ?
+		   div_s64(atomic64_read(&stats->alloc_ns), allocs) : 0,
+		   atomic_read(&stats->quick_hits));
+	seq_printf(m, "%spage map: mapped %d reused %d shrunk %d\n", prefix,
+		   atomic_read(&stats->pages_mapped),
+		   atomic_read(&stats->pages_reused),
+		   atomic_read(&stats->pages_shrunk));
+	print_binder_lat_hist(m, prefix, "alloc latency", stats->alloc_lat);
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3414,6 +4285,8 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  pages: %d mapped, %d cached\n", proc->pages_mapped,
+		   proc->pages_cached);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3428,6 +4301,9 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  pending transactions: %d\n", count);
 
 	print_binder_stats(m, "  ", &proc->stats);
+	print_binder_alloc_stats(m, "  ", &proc->alloc_stats);
+	print_binder_lat_hist(m, "  ", "transaction round trip",
+			      proc->rtt_lat);
 }
 
 
@@ -3439,7 +4315,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3451,7 +4327,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3462,16 +4338,18 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	print_binder_alloc_stats(m, "", &binder_alloc_stats);
+	seq_printf(m, "cached pages: %d\n", atomic_read(&binder_lru_count));
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3482,13 +4360,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3498,11 +4376,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3520,13 +4398,15 @@ static void print_binder_transaction_log_entry(struct seq_file *m,
 static int binder_transaction_log_show(struct seq_file *m, void *unused)
 {
 	struct binder_transaction_log *log = m->private;
+	unsigned int next = ((unsigned int)atomic_read(&log->cur) + 1) %
+			    ARRAY_SIZE(log->entry);
 	int i;
 
 	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++)
+		for (i = next; i < ARRAY_SIZE(log->entry); i++)
 			print_binder_transaction_log_entry(m, &log->entry[i]);
 	}
-	for (i = 0; i < log->next; i++)
+	for (i = 0; i < next; i++)
 		print_binder_transaction_log_entry(m, &log->entry[i]);
 	return 0;
 }
@@ -3565,6 +4445,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3598,3 +4479,6 @@ static int __init binder_init(void)
 device_initcall(binder_init);
 
 MODULE_LICENSE("GPL v2");
+
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
@@ -32,11 +32,23 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
+	/*
+	 * Minimum priority the node's transactions run at: a nice value
+	 * for SCHED_NORMAL and SCHED_BATCH, an RT priority for SCHED_FIFO
+	 * and SCHED_RR. A nice value out of -20..19, like the 0x7f that
+	 * libbinder sends, means no minimum.
+	 */
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/* Scheduling policy of the minimum priority */
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 3U << 9,
+	/* Synchronous calls from RT threads run RT too */
+	FLAT_BINDER_FLAG_INHERIT_RT = 0x800,
 };
 
 /*
@@ -61,6 +73,29 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+enum {
+	BINDER_BUFFER_FLAG_HAS_PARENT = 0x01,
+};
+
+/*
+ * A buffer object, at an offset like a flat_binder_object, describes a
+ * block of user memory that the driver copies into the target's buffer
+ * after the offsets array; 'buffer' is rewritten to where the target
+ * sees the copy. With BINDER_BUFFER_FLAG_HAS_PARENT, the pointer at
+ * 'parent_offset' in the copy of an earlier buffer object, the one at
+ * index 'parent' in the offsets array, is rewritten as well, so that
+ * structures pointing to each other arrive linked. Only transactions
+ * sent with BC_TRANSACTION_SG or BC_REPLY_SG have room for them.
+ */
+struct binder_buffer_object {
+	unsigned long		type;
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+	size_t			parent;
+	size_t			parent_offset;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -147,6 +182,12 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	/* room for buffer objects, each length aligned to sizeof(void *) */
+	size_t buffers_size;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +365,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, whose
+	 * binder_buffer_objects are gathered into the target buffer.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
@@ -21,10 +21,20 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/log2.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/lzo.h>
+#include <linux/vmalloc.h>
+#include <asm/unaligned.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -41,6 +51,101 @@ static char klog_buf[256];
 #endif /* CONFIG_SEC_DEBUG */
 
 
+/* Largest ring we can allocate physically contiguous */
+#define LOGGER_MAX_SIZE		(PAGE_SIZE << (MAX_ORDER - 1))
+
+/*
+ * Size of each per-CPU front buffer; it must hold at least one entry of
+ * LOGGER_ENTRY_MAX_LEN plus its struct logger_front_entry header.
+ */
+#define LOGGER_FRONT_SIZE	(16*1024)
+
+/* Longest time entries sit in the front buffers when nobody is reading */
+#define LOGGER_DRAIN_DELAY	(HZ / 10)
+
+/*
+ * struct logger_front - a per-CPU staging buffer in front of a log
+ *
+ * Writers reserve space for an entry by advancing 'head' with cmpxchg, copy
+ * the entry in without holding any lock and then commit it. logger_drain()
+ * moves committed entries into the log under log->mutex and rewinds the
+ * buffer once everything reserved in it has been moved. A writer may migrate
+ * after picking its CPU's buffer; that only costs locality, as reservations
+ * are atomic.
+ *
+ * Everything outside [tail, head) is kept zeroed, so that a reserved but not
+ * yet committed entry always reads as LOGGER_FRONT_RESERVED.
+ */
+struct logger_front {
+	unsigned char		*buffer;
+	atomic_t		head;	/* end of the reserved space */
+	size_t			tail;	/* first entry not drained, log->mutex */
+};
+
+#define LOGGER_FRONT_RESERVED	0	/* being written */
+#define LOGGER_FRONT_COMMITTED	1	/* ready to be drained */
+#define LOGGER_FRONT_DISCARDED	2	/* copy failed, skip it */
+
+struct logger_front_entry {
+	__u32			size;	/* size of the record, aligned */
+	__u32			state;	/* LOGGER_FRONT_* */
+	struct logger_entry	entry;	/* the entry as it goes into the log */
+};
+
+/*
+ * Entries pushed out of the ring are collected into chunks of this size,
+ * which are compressed as a whole once full.
+ */
+#define LOGGER_CHUNK_SIZE	(16*1024)
+
+/* Memory an enabled archive takes besides its chunks */
+#define LOGGER_ARCHIVE_OVERHEAD	(LOGGER_CHUNK_SIZE + \
+	PAGE_ALIGN(lzo1x_worst_compress(LOGGER_CHUNK_SIZE)) + \
+	PAGE_ALIGN(LZO1X_1_MEM_COMPRESS))
+
+/*
+ * With CONFIG_ANDROID_LOGGER_COMPRESS, a log gets 1/LOGGER_RING_SHARE of its
+ * memory as the ring and the rest, less LOGGER_ARCHIVE_OVERHEAD, as the
+ * archive budget.
+ */
+#define LOGGER_RING_SHARE	4
+
+/* struct logger_chunk - a compressed run of entries that left the ring */
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_archive's list */
+	__u32			pos;	/* position of the first entry */
+	size_t			len;	/* uncompressed size */
+	size_t			clen;	/* compressed size, len: stored as is */
+	unsigned char		data[0];
+};
+
+/*
+ * struct logger_archive - compressed history behind a log
+ *
+ * When enabled, entries that the writer pushes out of the ring are kept in
+ * 'stage' and, once a chunk is full, compressed into the list of chunks. The
+ * oldest chunks are dropped to keep the memory they take within 'budget'. The
+ * archive ends exactly where the ring starts, at position log->ctl->head, so
+ * readers simply read on from the archive into the ring.
+ *
+ * Protected by log->mutex.
+ */
+struct logger_archive {
+	struct list_head	chunks;	/* oldest first */
+	size_t			budget;	/* memory for chunks, 0: off */
+	size_t			orig;	/* uncompressed bytes in chunks */
+	size_t			used;	/* compressed bytes in chunks */
+	size_t			mem;	/* memory the chunks take */
+	unsigned int		nr_chunks;
+	unsigned char		*stage;	/* entries not compressed yet */
+	size_t			stage_len;
+	__u32			stage_pos; /* position of the first staged entry */
+	unsigned char		*cbuf;	/* compression output */
+	void			*wrkmem; /* compression work memory */
+	unsigned long		decompressions; /* chunks read back */
+	u64			decompress_ns;	/* time spent reading back */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
@@ -57,6 +162,11 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_front __percpu *front; /* NULL: writers take mutex */
+	struct delayed_work	drain_work; /* drains the front buffers */
+	struct logger_mmap_ctl	*ctl;	/* control page shared with mmap */
+	atomic_t		mapped;	/* mappings of the ring */
+	struct logger_archive	archive; /* compressed older entries */
 };
 
 /*
@@ -69,6 +179,12 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			mapped;	/* poll() follows log->ctl->tail */
+	__u32			seen;	/* log->ctl->tail at the last POLLIN */
+	int			archived; /* reading log->archive at a_pos */
+	__u32			a_pos;	/* archive read position */
+	unsigned char		*cache;	/* decompressed chunk, or NULL */
+	__u32			cache_pos; /* position of the cached chunk */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -154,6 +270,253 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	return count;
 }
 
+/* Positions wrap around at 2^32; compare them by their distance */
+static inline int logger_pos_before(__u32 a, __u32 b)
+{
+	return (__s32) (a - b) < 0;
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * logger_archive_trim - drop the oldest chunks that do not fit the budget
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_archive_trim(struct logger_archive *archive)
+{
+	struct logger_chunk *chunk;
+
+	while (archive->used > archive->budget) {
+		chunk = list_first_entry(&archive->chunks, struct logger_chunk,
+					 list);
+		list_del(&chunk->list);
+		archive->orig -= chunk->len;
+		archive->used -= chunk->clen;
+		archive->mem -= ksize(chunk);
+		archive->nr_chunks--;
+		kfree(chunk);
+	}
+}
+
+/*
+ * logger_archive_compress - compress the staged entries into a new chunk.
+ * Should the chunk not be allocated, its entries are lost, as they would be
+ * without the archive.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_archive_compress(struct logger_log *log)
+{
+	struct logger_archive *archive = &log->archive;
+	struct logger_chunk *chunk;
+	size_t clen;
+	int ret;
+
+	ret = lzo1x_1_compress(archive->stage, archive->stage_len,
+			       archive->cbuf, &clen, archive->wrkmem);
+	if (ret != LZO_E_OK || clen >= archive->stage_len)
+		clen = archive->stage_len;
+
+	chunk = kmalloc(sizeof(*chunk) + clen, GFP_KERNEL);
+	if (chunk) {
+		chunk->pos = archive->stage_pos;
+		chunk->len = archive->stage_len;
+		chunk->clen = clen;
+		memcpy(chunk->data, clen == chunk->len ? archive->stage :
+		       archive->cbuf, clen);
+		list_add_tail(&chunk->list, &archive->chunks);
+		archive->orig += chunk->len;
+		archive->used += clen;
+		archive->mem += ksize(chunk);
+		archive->nr_chunks++;
+	}
+
+	archive->stage_pos += archive->stage_len;
+	archive->stage_len = 0;
+
+	logger_archive_trim(archive);
+}
+
+/*
+ * logger_archive_add - archive the entries from 'off' to 'end' in the ring,
+ * the first of which is at position 'pos', before they are overwritten.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_archive_add(struct logger_log *log, size_t off,
+			       size_t end, __u32 pos)
+{
+	struct logger_archive *archive = &log->archive;
+
+	if (!archive->budget)
+		return;
+
+	if (!archive->stage_len)
+		archive->stage_pos = pos;
+
+	while (off != end) {
+		size_t len = get_entry_len(log, off);
+		size_t first = min(len, log->size - off);
+
+		if (archive->stage_len + len > LOGGER_CHUNK_SIZE)
+			logger_archive_compress(log);
+
+		memcpy(archive->stage + archive->stage_len,
+		       log->buffer + off, first);
+		if (len != first)
+			memcpy(archive->stage + archive->stage_len + first,
+			       log->buffer, len - first);
+		archive->stage_len += len;
+		off = logger_offset(off + len);
+	}
+}
+
+/*
+ * logger_archive_oldest - return the position of the oldest archived entry,
+ * or of the oldest entry in the ring if the archive is empty.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static __u32 logger_archive_oldest(struct logger_log *log)
+{
+	struct logger_archive *archive = &log->archive;
+
+	if (!list_empty(&archive->chunks))
+		return list_first_entry(&archive->chunks, struct logger_chunk,
+					list)->pos;
+	if (archive->stage_len)
+		return archive->stage_pos;
+	return log->ctl->head;
+}
+
+/*
+ * logger_archive_entry - return the entry at the reader's archive position,
+ * decompressing its chunk unless the reader has it cached already. Returns
+ * NULL once the reader has caught up with the ring.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static unsigned char *logger_archive_entry(struct logger_log *log,
+					   struct logger_reader *reader)
+{
+	struct logger_archive *archive = &log->archive;
+	struct logger_chunk *chunk;
+	size_t len;
+	ktime_t start;
+
+	/* chunks the reader was still due to read may have been dropped */
+	if (logger_pos_before(reader->a_pos, logger_archive_oldest(log)))
+		reader->a_pos = logger_archive_oldest(log);
+
+	list_for_each_entry(chunk, &archive->chunks, list) {
+		if (reader->a_pos - chunk->pos < chunk->len)
+			goto found;
+		/* the chunk holding a_pos could not be allocated */
+		if (logger_pos_before(reader->a_pos, chunk->pos)) {
+			reader->a_pos = chunk->pos;
+			goto found;
+		}
+	}
+
+	if (logger_pos_before(reader->a_pos, archive->stage_pos))
+		reader->a_pos = archive->stage_pos;
+	if (reader->a_pos - archive->stage_pos < archive->stage_len)
+		return archive->stage + (reader->a_pos - archive->stage_pos);
+	return NULL;
+
+found:
+	if (reader->cache && reader->cache_pos == chunk->pos)
+		return reader->cache + (reader->a_pos - chunk->pos);
+
+	if (!reader->cache) {
+		reader->cache = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		if (!reader->cache)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	start = ktime_get();
+	len = chunk->len;
+	if (chunk->clen == chunk->len)
+		memcpy(reader->cache, chunk->data, len);
+	else if (lzo1x_decompress_safe(chunk->data, chunk->clen,
+				       reader->cache, &len) != LZO_E_OK ||
+		 len != chunk->len) {
+		reader->cache_pos = chunk->pos - 1;
+		return ERR_PTR(-EIO);
+	}
+	archive->decompressions++;
+	archive->decompress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	reader->cache_pos = chunk->pos;
+	return reader->cache + (reader->a_pos - chunk->pos);
+}
+
+/* The length of an archived entry, which need not be aligned */
+static inline __u32 logger_archive_entry_len(unsigned char *entry)
+{
+	return sizeof(struct logger_entry) +
+		get_unaligned((__u16 *) entry);
+}
+
+/*
+ * logger_archive_reset - drop everything archived and move all readers
+ * reading the archive to the start of the ring.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_archive_reset(struct logger_log *log)
+{
+	struct logger_archive *archive = &log->archive;
+	struct logger_chunk *chunk, *tmp;
+	struct logger_reader *reader;
+
+	list_for_each_entry_safe(chunk, tmp, &archive->chunks, list)
+		kfree(chunk);
+	INIT_LIST_HEAD(&archive->chunks);
+	archive->orig = 0;
+	archive->used = 0;
+	archive->mem = 0;
+	archive->nr_chunks = 0;
+	archive->stage_len = 0;
+	archive->stage_pos = log->ctl->head;
+
+	list_for_each_entry(reader, &log->readers, list) {
+		if (reader->archived) {
+			reader->archived = 0;
+			reader->r_off = log->head;
+		}
+	}
+}
+#else /* !CONFIG_ANDROID_LOGGER_COMPRESS */
+/* Without an archive, lapped entries are simply lost */
+static inline void logger_archive_add(struct logger_log *log, size_t off,
+				      size_t end, __u32 pos)
+{
+}
+
+static inline __u32 logger_archive_oldest(struct logger_log *log)
+{
+	return log->ctl->head;
+}
+
+static inline unsigned char *logger_archive_entry(struct logger_log *log,
+						  struct logger_reader *reader)
+{
+	return NULL;
+}
+
+static inline __u32 logger_archive_entry_len(unsigned char *entry)
+{
+	return 0;
+}
+
+static inline void logger_archive_reset(struct logger_log *log)
+{
+}
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
+
+static void logger_drain(struct logger_log *log);
+
 /*
  * logger_read - our log's read() method
  *
@@ -179,7 +542,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		logger_drain(log);
+		ret = !reader->archived && log->w_off == reader->r_off;
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -203,6 +567,33 @@ start:
 
 	mutex_lock(&log->mutex);
 
+	if (reader->archived) {
+		unsigned char *entry = logger_archive_entry(log, reader);
+
+		if (IS_ERR(entry)) {
+			ret = PTR_ERR(entry);
+			goto out;
+		}
+
+		if (entry) {
+			ret = logger_archive_entry_len(entry);
+			if (count < ret) {
+				ret = -EINVAL;
+				goto out;
+			}
+			if (copy_to_user(buf, entry, ret)) {
+				ret = -EFAULT;
+				goto out;
+			}
+			reader->a_pos += ret;
+			goto out;
+		}
+
+		/* read on in the ring */
+		reader->archived = 0;
+		reader->r_off = log->head;
+	}
+
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
 		mutex_unlock(&log->mutex);
@@ -273,14 +664,43 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 {
 	size_t old = log->w_off;
 	size_t new = logger_offset(old + len);
+	size_t head = log->head;
+	__u32 head_pos = log->ctl->head;
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, head)) {
+		log->head = get_next_entry(log, head, len);
+		logger_archive_add(log, head, log->head, head_pos);
+		log->ctl->head += logger_offset(log->head - head);
+	}
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+	list_for_each_entry(reader, &log->readers, list) {
+		if (reader->archived || !clock_interval(old, new, reader->r_off))
+			continue;
+
+		/* with an archive, the lapped entries are still readable */
+		if (log->archive.budget) {
+			reader->archived = 1;
+			reader->a_pos = head_pos + logger_offset(reader->r_off -
+								 head);
+		} else
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+	}
+
+	/* mmap readers must see the new head before the entries go away */
+	smp_wmb();
+}
+
+/*
+ * logger_commit - publish the entry of 'len' bytes just written to mmap
+ * readers.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_commit(struct logger_log *log, size_t len)
+{
+	smp_wmb();
+	log->ctl->tail += len;
 }
 
 /*
@@ -302,6 +722,123 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
+/*
+ * logger_front_consume - drop the record at the front buffer's tail, zeroing
+ * it for the next round of reservations.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_front_consume(struct logger_front *front,
+				 struct logger_front_entry *rec)
+{
+	size_t size = rec->size;
+
+	memset(rec, 0, size);
+	front->tail += size;
+}
+
+/*
+ * logger_front_peek - return the committed record at the front buffer's tail,
+ * or NULL if the buffer is empty or its oldest record is still being written.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static struct logger_front_entry *logger_front_peek(struct logger_front *front)
+{
+	while (front->tail != atomic_read(&front->head)) {
+		struct logger_front_entry *rec;
+		__u32 state;
+
+		rec = (struct logger_front_entry *) (front->buffer + front->tail);
+		state = ACCESS_ONCE(rec->state);
+		if (state == LOGGER_FRONT_RESERVED)
+			return NULL;
+
+		/* pairs with the smp_wmb() in logger_write_front() */
+		smp_rmb();
+		if (state == LOGGER_FRONT_COMMITTED)
+			return rec;
+
+		logger_front_consume(front, rec);
+	}
+
+	return NULL;
+}
+
+/*
+ * logger_drain - move the committed entries of all front buffers into the
+ * log, oldest first, and rewind the front buffers that are left empty.
+ *
+ * Entries from different CPUs are merged by timestamp. An entry that is
+ * still being written holds back the ones after it on the same CPU until
+ * the next drain. Writers only queue drain_work for the first entry of an
+ * empty front buffer, so a front buffer that cannot be rewound gets its
+ * next drain queued here.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_drain(struct logger_log *log)
+{
+	bool pending = false;
+	int cpu;
+
+	if (!log->front)
+		return;
+
+	while (1) {
+		struct logger_front *front, *best_front = NULL;
+		struct logger_front_entry *rec, *best = NULL;
+		size_t len;
+
+		for_each_possible_cpu(cpu) {
+			front = per_cpu_ptr(log->front, cpu);
+			rec = logger_front_peek(front);
+			if (!rec)
+				continue;
+			if (best && (rec->entry.sec > best->entry.sec ||
+				     (rec->entry.sec == best->entry.sec &&
+				      rec->entry.nsec >= best->entry.nsec)))
+				continue;
+			best = rec;
+			best_front = front;
+		}
+		if (!best)
+			break;
+
+		len = sizeof(struct logger_entry) + best->entry.len;
+		fix_up_readers(log, len);
+		do_write_log(log, &best->entry, len);
+		logger_commit(log, len);
+		logger_front_consume(best_front, best);
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct logger_front *front = per_cpu_ptr(log->front, cpu);
+
+		/* fails if new entries were reserved meanwhile */
+		if (front->tail &&
+		    atomic_cmpxchg(&front->head, front->tail, 0) == front->tail)
+			front->tail = 0;
+		if (atomic_read(&front->head))
+			pending = true;
+	}
+
+	if (pending)
+		schedule_delayed_work(&log->drain_work, LOGGER_DRAIN_DELAY);
+}
+
+static void logger_drain_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log,
+					      drain_work.work);
+
+	mutex_lock(&log->mutex);
+	logger_drain(log);
+	mutex_unlock(&log->mutex);
+
+	wake_up_interruptible(&log->wq);
+}
+
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
  * the log 'log'
@@ -342,6 +879,76 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 	return count;
 }
 
+/*
+ * logger_write_front - writes an entry into the current CPU's front buffer
+ * without taking log->mutex.
+ *
+ * Returns the number of payload bytes written, -ENOSPC if the front buffer
+ * is full, or another negative error code on failure.
+ */
+static ssize_t logger_write_front(struct logger_log *log,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
+{
+	struct logger_front *front;
+	struct logger_front_entry *rec;
+	size_t size;
+	ssize_t ret = 0;
+	int old;
+
+	size = ALIGN(sizeof(struct logger_front_entry) + header->len,
+		     sizeof(__u32));
+	front = per_cpu_ptr(log->front, raw_smp_processor_id());
+
+	do {
+		old = atomic_read(&front->head);
+		if (old + size > LOGGER_FRONT_SIZE)
+			return -ENOSPC;
+	} while (atomic_cmpxchg(&front->head, old, old + size) != old);
+
+	rec = (struct logger_front_entry *) (front->buffer + old);
+	rec->size = size;
+	rec->entry = *header;
+
+	while (nr_segs-- > 0) {
+		size_t len;
+
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, header->len - ret);
+
+		if (len && copy_from_user(rec->entry.msg + ret,
+					  iov->iov_base, len)) {
+			ret = -EFAULT;
+			break;
+		}
+
+#ifdef CONFIG_SEC_DEBUG
+		/* pass platform log (!@hello) to kernel */
+		if (len >= 2 && !strncmp(rec->entry.msg + ret, "!@", 2))
+			printk("%.*s\n", (int) min_t(size_t, len, 255),
+			       rec->entry.msg + ret);
+#endif /* CONFIG_SEC_DEBUG */
+
+		iov++;
+		ret += len;
+	}
+
+	/* the entry must be complete before logger_drain() can see it */
+	smp_wmb();
+	rec->state = ret < 0 ? LOGGER_FRONT_DISCARDED : LOGGER_FRONT_COMMITTED;
+
+	/*
+	 * first entry of an empty front buffer: make sure it reaches the log.
+	 * Later ones are covered by this drain, or by the one logger_drain()
+	 * queues when it leaves entries behind.
+	 */
+	if (!old)
+		schedule_delayed_work(&log->drain_work, LOGGER_DRAIN_DELAY);
+
+	return ret;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -351,7 +958,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	size_t orig;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
@@ -368,8 +975,31 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
+	if (log->front) {
+		ret = logger_write_front(log, &header, iov, nr_segs);
+		if (ret != -ENOSPC) {
+			if (unlikely(ret < 0))
+				return ret;
+
+			/* wake up any blocked readers, who drain the entry */
+			smp_mb();
+			if (waitqueue_active(&log->wq))
+				wake_up_interruptible(&log->wq);
+			return ret;
+		}
+		ret = 0;
+	}
+
 	mutex_lock(&log->mutex);
 
+	/*
+	 * Our front buffer is full (or there is none): drain what the front
+	 * buffers hold first, so that the log stays in order, and write the
+	 * entry straight into the log.
+	 */
+	logger_drain(log);
+	orig = log->w_off;
+
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
 	 * entry after (what will be) the new write offset. We do this now
@@ -399,6 +1029,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
+	logger_commit(log, sizeof(struct logger_entry) + header.len);
 	mutex_unlock(&log->mutex);
 
 	/* wake up any blocked readers */
@@ -444,10 +1075,15 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		reader->mapped = 0;
+		reader->cache = NULL;
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
 		reader->r_off = log->head;
+		/* new readers start with the oldest archived entry */
+		reader->a_pos = logger_archive_oldest(log);
+		reader->archived = reader->a_pos != log->ctl->head;
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -468,6 +1104,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
 		list_del(&reader->list);
+		kfree(reader->cache);
 		kfree(reader);
 	}
 
@@ -498,7 +1135,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	logger_drain(log);
+	if (reader->mapped) {
+		if (log->ctl->tail != reader->seen) {
+			reader->seen = log->ctl->tail;
+			ret |= POLLIN | POLLRDNORM;
+		}
+	} else if (reader->archived || log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -512,6 +1155,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -523,7 +1167,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
+		if (reader->archived)
+			ret = (log->ctl->head - reader->a_pos) +
+				(log->ctl->tail - log->ctl->head);
+		else if (log->w_off >= reader->r_off)
 			ret = log->w_off - reader->r_off;
 		else
 			ret = (log->size - reader->r_off) + log->w_off;
@@ -534,6 +1181,20 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		if (reader->archived) {
+			unsigned char *entry = logger_archive_entry(log, reader);
+
+			if (IS_ERR(entry)) {
+				ret = PTR_ERR(entry);
+				break;
+			}
+			if (entry) {
+				ret = logger_archive_entry_len(entry);
+				break;
+			}
+			reader->archived = 0;
+			reader->r_off = log->head;
+		}
 		if (log->w_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
@@ -547,6 +1208,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		log->ctl->head = log->ctl->tail;
+		logger_archive_reset(log);
 		ret = 0;
 		break;
 	}
@@ -556,9 +1219,84 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static void logger_vm_open(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_inc(&log->mapped);
+}
+
+static void logger_vm_close(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_dec(&log->mapped);
+}
+
+static const struct vm_operations_struct logger_vm_ops = {
+	.open = logger_vm_open,
+	.close = logger_vm_close,
+};
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the control page followed by the ring, read-only, so that a reader can
+ * consume many entries without a system call each; see struct logger_mmap_ctl.
+ * The log cannot be resized while it is mapped.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader = file->private_data;
+	struct logger_log *log;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	log = reader->log;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_ops = &logger_vm_ops;
+	vma->vm_private_data = log;
+
+	mutex_lock(&log->mutex);
+
+	if (len > PAGE_SIZE + log->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(log->ctl) >> PAGE_SHIFT,
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (!ret && len > PAGE_SIZE)
+		ret = remap_pfn_range(vma, vma->vm_start + PAGE_SIZE,
+				      virt_to_phys(log->buffer) >> PAGE_SHIFT,
+				      len - PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		goto out;
+
+	logger_vm_open(vma);
+	if (!reader->mapped) {
+		reader->mapped = 1;
+		reader->seen = log->ctl->tail;
+	}
+
+out:
+	mutex_unlock(&log->mutex);
+
+	return ret;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
+	.mmap = logger_mmap,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
@@ -569,13 +1307,13 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and no more
+ * than LOGGER_MAX_SIZE. The ring itself is allocated by init_log(), so that
+ * resizing can free it; with CONFIG_ANDROID_LOGGER_COMPRESS, 'SIZE' is shared
+ * between the ring and the compressed history.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -588,6 +1326,11 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.drain_work = __DELAYED_WORK_INITIALIZER(VAR .drain_work, \
+						 logger_drain_work), \
+	.archive = { \
+		.chunks = LIST_HEAD_INIT(VAR .archive.chunks), \
+	}, \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 1024*1024)
@@ -608,10 +1351,306 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * The GetLog crash dump tool finds the logs through their physical addresses,
+ * derived from the kernel addresses we supply here. The rings are allocated
+ * from lowmem, so that the translation holds.
+ */
+static void logger_supply_getlog(void)
+{
+#if defined(CONFIG_SEC_DEBUG)
+ 	//{{ Mark for GetLog
+ 	sec_getlog_supply_loggerinfo(log_main.buffer, log_radio.buffer,
+  				     log_events.buffer, log_system.buffer);
+#endif
+}
+
+static ssize_t logger_buffer_size_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+
+	return sprintf(buf, "%lu\n", (unsigned long) log->size);
+}
+
+/*
+ * Writing a new size to /sys/class/misc/<log>/buffer_size replaces the ring;
+ * its contents are discarded and readers start over at the new, empty log.
+ */
+static ssize_t logger_buffer_size_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t len)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+	struct logger_reader *reader;
+	unsigned char *buffer, *old;
+	unsigned long size;
+	size_t old_size;
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &size);
+	if (ret)
+		return ret;
+	if (!is_power_of_2(size) || size <= LOGGER_ENTRY_MAX_LEN ||
+	    size > LOGGER_MAX_SIZE)
+		return -EINVAL;
+
+	buffer = alloc_pages_exact(size, GFP_KERNEL | __GFP_ZERO);
+	if (!buffer)
+		return -ENOMEM;
+
+	mutex_lock(&log->mutex);
+
+	if (atomic_read(&log->mapped)) {
+		mutex_unlock(&log->mutex);
+		free_pages_exact(buffer, size);
+		return -EBUSY;
+	}
+
+	old = log->buffer;
+	old_size = log->size;
+	log->buffer = buffer;
+	log->size = size;
+	log->w_off = 0;
+	log->head = 0;
+	/* positions map to ring offsets modulo the size, so realign them */
+	log->ctl->tail = ALIGN(log->ctl->tail, size);
+	log->ctl->head = log->ctl->tail;
+	log->ctl->size = size;
+	list_for_each_entry(reader, &log->readers, list)
+		reader->r_off = 0;
+	logger_archive_reset(log);
+
+	/* what the front buffers hold goes into the new ring */
+	logger_drain(log);
+	logger_supply_getlog();
+
+	mutex_unlock(&log->mutex);
+
+	free_pages_exact(old, old_size);
+
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, size >> 10);
+
+	return len;
+}
+
+static DEVICE_ATTR(buffer_size, S_IRUGO | S_IWUSR, logger_buffer_size_show,
+		   logger_buffer_size_store);
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+static ssize_t logger_compress_size_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+
+	return sprintf(buf, "%lu\n", (unsigned long) log->archive.budget);
+}
+
+/*
+ * Writing a size in bytes to /sys/class/misc/<log>/compress_size keeps up to
+ * that much memory of compressed history behind the ring, on top of
+ * LOGGER_ARCHIVE_OVERHEAD; 0 turns the archive off and frees it.
+ */
+static ssize_t logger_compress_size_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t len)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+	struct logger_archive *archive = &log->archive;
+	unsigned char *stage = NULL, *cbuf = NULL;
+	void *wrkmem = NULL;
+	unsigned long budget;
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &budget);
+	if (ret)
+		return ret;
+
+	if (budget) {
+		stage = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		cbuf = vmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE));
+		wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+		if (!stage || !cbuf || !wrkmem) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	mutex_lock(&log->mutex);
+
+	if (!budget || !archive->budget) {
+		/* turning it on or off: start over either way */
+		logger_archive_reset(log);
+		swap(archive->stage, stage);
+		swap(archive->cbuf, cbuf);
+		swap(archive->wrkmem, wrkmem);
+	}
+	archive->budget = budget;
+	logger_archive_trim(archive);
+
+	mutex_unlock(&log->mutex);
+
+	ret = len;
+out:
+	kfree(stage);
+	vfree(cbuf);
+	vfree(wrkmem);
+
+	return ret;
+}
+
+static DEVICE_ATTR(compress_size, S_IRUGO | S_IWUSR,
+		   logger_compress_size_show, logger_compress_size_store);
+
+/*
+ * /sys/class/misc/<log>/compress_stats shows what the archive holds and what
+ * reading it back has cost so far.
+ */
+static ssize_t logger_compress_stats_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+	struct logger_archive *archive = &log->archive;
+	ssize_t ret;
+
+	mutex_lock(&log->mutex);
+	ret = sprintf(buf,
+		      "chunks: %u\n"
+		      "orig_size: %lu\n"
+		      "compr_size: %lu\n"
+		      "mem_size: %lu\n"
+		      "staged: %lu\n"
+		      "decompressions: %lu\n"
+		      "decompress_ns: %llu\n",
+		      archive->nr_chunks,
+		      (unsigned long) archive->orig,
+		      (unsigned long) archive->used,
+		      (unsigned long) archive->mem,
+		      (unsigned long) archive->stage_len,
+		      archive->decompressions,
+		      (unsigned long long) archive->decompress_ns);
+	mutex_unlock(&log->mutex);
+
+	return ret;
+}
+
+static DEVICE_ATTR(compress_stats, S_IRUGO, logger_compress_stats_show, NULL);
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
+
+static struct attribute *logger_attrs[] = {
+	&dev_attr_buffer_size.attr,
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	&dev_attr_compress_size.attr,
+	&dev_attr_compress_stats.attr,
+#endif
+	NULL,
+};
+
+static const struct attribute_group logger_attr_group = {
+	.attrs = logger_attrs,
+};
+
+/*
+ * Allocates the per-CPU front buffers of 'log'. Without them, writers simply
+ * take log->mutex and write straight into the log.
+ */
+static void __init init_log_front(struct logger_log *log)
+{
+	struct logger_front __percpu *front;
+	int cpu;
+
+	front = alloc_percpu(struct logger_front);
+	if (!front)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_front *f = per_cpu_ptr(front, cpu);
+
+		f->buffer = kzalloc(LOGGER_FRONT_SIZE, GFP_KERNEL);
+		if (!f->buffer)
+			goto fail_free;
+		atomic_set(&f->head, 0);
+		f->tail = 0;
+	}
+
+	log->front = front;
+	return;
+
+fail_free:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(front, cpu)->buffer);
+	free_percpu(front);
+fail:
+	printk(KERN_WARNING "logger: no front buffers for log '%s'\n",
+	       log->misc.name);
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * Turns on the archive of 'log' with what is left of 'mem', the memory of
+ * the log, once the ring and the compression buffers are taken out.
+ */
+static void __init init_log_archive(struct logger_log *log, size_t mem)
+{
+	struct logger_archive *archive = &log->archive;
+
+	if (mem <= log->size + LOGGER_ARCHIVE_OVERHEAD)
+		return;
+
+	archive->stage = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	archive->cbuf = vmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE));
+	archive->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!archive->stage || !archive->cbuf || !archive->wrkmem) {
+		kfree(archive->stage);
+		vfree(archive->cbuf);
+		vfree(archive->wrkmem);
+		archive->stage = NULL;
+		archive->cbuf = NULL;
+		archive->wrkmem = NULL;
+		printk(KERN_WARNING "logger: no compressed history for log "
+		       "'%s'\n", log->misc.name);
+		return;
+	}
+
+	archive->stage_pos = log->ctl->head;
+	archive->budget = mem - log->size - LOGGER_ARCHIVE_OVERHEAD;
+}
+#endif
+
 static int __init init_log(struct logger_log *log)
 {
+	size_t mem = log->size;
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	log->size = mem / LOGGER_RING_SHARE;
+#endif
+	log->buffer = alloc_pages_exact(log->size, GFP_KERNEL | __GFP_ZERO);
+	if (unlikely(!log->buffer))
+		return -ENOMEM;
+
+	log->ctl = (struct logger_mmap_ctl *) get_zeroed_page(GFP_KERNEL);
+	if (unlikely(!log->ctl)) {
+		free_pages_exact(log->buffer, log->size);
+		log->buffer = NULL;
+		return -ENOMEM;
+	}
+	log->ctl->size = log->size;
+
+	init_log_front(log);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	init_log_archive(log, mem);
+#endif
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -619,8 +1658,15 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	ret = sysfs_create_group(&log->misc.this_device->kobj,
+				 &logger_attr_group);
+	if (unlikely(ret))
+		printk(KERN_WARNING "logger: no sysfs attributes for log "
+		       "'%s'\n", log->misc.name);
+
+	printk(KERN_INFO "logger: created %luK log '%s', %luK compressed "
+	       "history\n", (unsigned long) log->size >> 10, log->misc.name,
+	       (unsigned long) log->archive.budget >> 10);
 
 	return 0;
 }
@@ -645,11 +1691,7 @@ static int __init logger_init(void)
 	if (unlikely(ret))
 		goto out;
 
-#if defined(CONFIG_SEC_DEBUG)
- 	//{{ Mark for GetLog
- 	sec_getlog_supply_loggerinfo(_buf_log_main, _buf_log_radio,
-  				     _buf_log_events, _buf_log_system);
-#endif
+	logger_supply_getlog();
 
 out:
 	return ret;
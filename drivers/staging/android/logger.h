@@ -30,6 +30,26 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_mmap_ctl - the first page of a read-only mmap() of a log
+ *
+ * The ring itself is mapped right after this page. Positions count the bytes
+ * written to the log, modulo 2^32; the entry at position 'pos' starts at
+ * offset (pos & (size - 1)) into the ring and may wrap around its end. An
+ * entry is valid once 'tail' has moved past it. After copying an entry out,
+ * a reader must re-read 'head': if (__s32) (head - pos) > 0, the entry was
+ * overwritten meanwhile and the reader restarts from 'head'.
+ *
+ * poll() on a file that has mmap()ed the log reports POLLIN when the log was
+ * written to since the previous poll() that reported POLLIN.
+ */
+struct logger_mmap_ctl {
+	__u32		head;	/* position of the oldest entry */
+	__u32		tail;	/* position right after the newest entry */
+	__u32		size;	/* size of the ring, a power of two */
+	__u32		__pad;
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -0,0 +1,238 @@
+/*
+ * drivers/staging/android/logger_bench.c
+ *
+ * Multi-writer benchmark for the Android logger: one kernel thread per
+ * writer, bound to a CPU, writes entries to a log device as fast as it
+ * can for a while. Reports writes per second and the write latency.
+ *
+ * The benchmark runs when the module is loaded, which then fails with
+ * -EAGAIN so that it does not stay around:
+ *
+ *	insmod logger_bench.ko writers=4 sec=5 size=100
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/err.h>
+#include <asm/uaccess.h>
+
+#include "logger.h"
+
+#define PRINT_PREF KERN_INFO "logger_bench: "
+
+/* Write latency histogram: bucket i counts writes of [2^i, 2^(i+1)) ns */
+#define LAT_BUCKETS	32
+
+static int writers;
+module_param(writers, int, 0);
+MODULE_PARM_DESC(writers, "Number of writer threads (default: one per "
+		 "online CPU)");
+
+static unsigned int sec = 1;
+module_param(sec, uint, 0);
+MODULE_PARM_DESC(sec, "Length in seconds of the run");
+
+static unsigned int size = 64;
+module_param(size, uint, 0);
+MODULE_PARM_DESC(size, "Message bytes per entry");
+
+static char *dev = "/dev/log/main";
+module_param(dev, charp, 0);
+MODULE_PARM_DESC(dev, "Log device to write to");
+
+struct bench_writer {
+	int			id;
+	struct file		*filp;
+	struct completion	done;
+	unsigned long		writes;
+	u64			total_ns;
+	u64			max_ns;
+	unsigned long		hist[LAT_BUCKETS];
+	int			err;
+};
+
+static DECLARE_COMPLETION(bench_start);
+
+static int bench_writer_thread(void *data)
+{
+	struct bench_writer *w = data;
+	unsigned char prio = 4;		/* ANDROID_LOG_INFO */
+	char tag[16];
+	char *msg;
+	struct iovec iov[3];
+	unsigned long end;
+	mm_segment_t old_fs;
+	ktime_t start;
+	loff_t pos;
+	ssize_t ret;
+	u64 ns;
+
+	msg = kmalloc(size + 1, GFP_KERNEL);
+	if (!msg) {
+		w->err = -ENOMEM;
+		complete(&w->done);
+		return 0;
+	}
+	memset(msg, 'a' + w->id % 26, size);
+	msg[size] = '\0';
+	snprintf(tag, sizeof(tag), "bench%d", w->id);
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = tag;
+	iov[1].iov_len = strlen(tag) + 1;
+	iov[2].iov_base = msg;
+	iov[2].iov_len = size + 1;
+
+	wait_for_completion(&bench_start);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (end = jiffies + sec * HZ; time_before(jiffies, end);) {
+		pos = 0;
+		start = ktime_get();
+		ret = vfs_writev(w->filp, (const struct iovec __user *)iov, 3,
+				 &pos);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret < 0) {
+			w->err = ret;
+			break;
+		}
+
+		w->writes++;
+		w->total_ns += ns;
+		if (ns > w->max_ns)
+			w->max_ns = ns;
+		w->hist[min_t(int, ns ? fls64(ns) - 1 : 0, LAT_BUCKETS - 1)]++;
+
+		cond_resched();
+	}
+	set_fs(old_fs);
+
+	kfree(msg);
+	complete(&w->done);
+	return 0;
+}
+
+static void bench_report(struct bench_writer *w, int nr)
+{
+	unsigned long hist[LAT_BUCKETS] = { 0, };
+	unsigned long writes = 0;
+	u64 total_ns = 0, max_ns = 0;
+	int i, b;
+
+	for (i = 0; i < nr; i++) {
+		printk(PRINT_PREF "writer %d: %lu writes, mean %llu ns, "
+		       "max %llu ns\n", i, w[i].writes,
+		       w[i].writes ? div64_u64(w[i].total_ns, w[i].writes) : 0,
+		       w[i].max_ns);
+		writes += w[i].writes;
+		total_ns += w[i].total_ns;
+		max_ns = max(max_ns, w[i].max_ns);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			hist[b] += w[i].hist[b];
+	}
+
+	printk(PRINT_PREF "%d writers, %u bytes: %lu writes in %u seconds "
+	       "(%lu writes/s), mean %llu ns, max %llu ns\n", nr, size,
+	       writes, sec, writes / sec,
+	       writes ? div64_u64(total_ns, writes) : 0, max_ns);
+	for (b = 0; b < LAT_BUCKETS; b++)
+		if (hist[b])
+			printk(PRINT_PREF "  < %llu ns: %lu\n", 2ULL << b,
+			       hist[b]);
+}
+
+static int __init logger_bench_init(void)
+{
+	struct bench_writer *w;
+	struct task_struct *task;
+	struct file *filp;
+	int cpu = -1;
+	int i, nr = 0, err = 0;
+
+	if (!sec || size >= LOGGER_ENTRY_MAX_PAYLOAD) {
+		printk(KERN_ERR "logger_bench: bad sec or size\n");
+		return -EINVAL;
+	}
+	if (writers <= 0)
+		writers = num_online_cpus();
+
+	filp = filp_open(dev, O_WRONLY, 0);
+	if (IS_ERR(filp)) {
+		printk(KERN_ERR "logger_bench: cannot open %s\n", dev);
+		return PTR_ERR(filp);
+	}
+
+	w = kcalloc(writers, sizeof(*w), GFP_KERNEL);
+	if (!w) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* Spread the writers over the online CPUs, round robin */
+	for (i = 0; i < writers; i++) {
+		w[i].id = i;
+		w[i].filp = filp;
+		init_completion(&w[i].done);
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+
+		task = kthread_create(bench_writer_thread, &w[i],
+				      "logger_bench/%d", i);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		nr++;
+	}
+
+	complete_all(&bench_start);
+	for (i = 0; i < nr; i++) {
+		wait_for_completion(&w[i].done);
+		if (w[i].err && !err)
+			err = w[i].err;
+	}
+
+	if (!err)
+		bench_report(w, nr);
+	else
+		printk(KERN_ERR "logger_bench: failed (%d)\n", err);
+
+	kfree(w);
+out:
+	filp_close(filp, NULL);
+
+	/* All the work is done, do not keep the module loaded */
+	return err ? err : -EAGAIN;
+}
+module_init(logger_bench_init);
+
+static void __exit logger_bench_exit(void)
+{
+}
+module_exit(logger_bench_exit);
+
+MODULE_DESCRIPTION("Android logger multi-writer benchmark");
+MODULE_LICENSE("GPL");
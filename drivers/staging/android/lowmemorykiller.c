@@ -43,6 +43,8 @@
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 #define ENHANCED_LMK_ROUTINE
 
 #ifdef ENHANCED_LMK_ROUTINE
@@ -72,12 +74,6 @@ static int lmk_kill_ok = 0;
 
 extern atomic_t optimize_comp_on;
 
-extern int isolate_lru_page_compcache(struct page *page);
-extern void putback_lru_page(struct page *page);
-extern unsigned int zone_id_shrink_pagelist(struct zone *zone_id,struct list_head *page_list);
-
-#define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
-
 #define SWAP_PROCESS_DEBUG_LOG 1
 /* free RAM 8M(2048 pages) */
 #define CHECK_FREE_MEMORY 2048
@@ -85,13 +81,6 @@ extern unsigned int zone_id_shrink_pagelist(struct zone *zone_id,struct list_hea
 #define CHECK_FREE_SWAPSPACE  10240
 
 unsigned int check_free_memory;
-
-enum pageout_io {
-	PAGEOUT_IO_ASYNC,
-	PAGEOUT_IO_SYNC,
-};
-
-
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
 #ifdef ENHANCED_LMK_ROUTINE
@@ -107,6 +96,232 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
+/*
+ * Shrinker cost, for comparing candidate selection schemes under
+ * reclaim load: number of scanning calls and total time spent in them.
+ */
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+static u64 lowmem_scan_calls;
+static u64 lowmem_scan_ns;
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+#ifdef ENHANCED_LMK_ROUTINE
+#define LOWMEM_SELECT_DEPTH LOWMEM_DEATHPENDING_DEPTH
+#else
+#define LOWMEM_SELECT_DEPTH 1
+#endif
+
+/*
+ * Thread group leaders filed by oom_adj, from OOM_DISABLE up to
+ * OOM_ADJUST_MAX. Tasks are added at fork, moved to their new bucket
+ * when oom_adj changes and removed when they are unhashed.
+ * lowmem_adj_lock nests inside tasklist_lock, siglock and task_lock.
+ *
+ * Filing a task at the tail of a bucket stamps it with the next
+ * lowmem_adj_seq, so every bucket is in increasing lmk_adj_seq order.
+ *
+ * Tasks fork before lowmem_init(), so the buckets are initialised
+ * statically.
+ */
+#define LOWMEM_ADJ_BUCKETS (OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+#if LOWMEM_ADJ_BUCKETS != 33
+#error lowmem_adj_index initialiser does not match the oom_adj range
+#endif
+
+#define LOWMEM_ADJ_HEAD(i) [i] = LIST_HEAD_INIT(lowmem_adj_index[i])
+#define LOWMEM_ADJ_HEADS4(i)						\
+	LOWMEM_ADJ_HEAD(i), LOWMEM_ADJ_HEAD(i + 1),			\
+	LOWMEM_ADJ_HEAD(i + 2), LOWMEM_ADJ_HEAD(i + 3)
+
+static struct list_head lowmem_adj_index[LOWMEM_ADJ_BUCKETS] = {
+	LOWMEM_ADJ_HEADS4(0), LOWMEM_ADJ_HEADS4(4), LOWMEM_ADJ_HEADS4(8),
+	LOWMEM_ADJ_HEADS4(12), LOWMEM_ADJ_HEADS4(16), LOWMEM_ADJ_HEADS4(20),
+	LOWMEM_ADJ_HEADS4(24), LOWMEM_ADJ_HEADS4(28), LOWMEM_ADJ_HEAD(32),
+};
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static u64 lowmem_adj_seq;
+
+static struct list_head *lowmem_adj_bucket(int oom_adj)
+{
+	return &lowmem_adj_index[oom_adj - OOM_DISABLE];
+}
+
+/*
+ * Called from copy_process() with tasklist_lock and siglock held.
+ * Kernel threads are never candidates and are left out; so are the
+ * few tasks that exec from one, such as init and usermode helpers.
+ */
+void lowmem_adj_index_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	if (!p->mm)
+		return;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	p->lmk_adj_seq = ++lowmem_adj_seq;
+	list_add_tail(&p->lmk_adj_node,
+		      lowmem_adj_bucket(p->signal->oom_adj));
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called from __unhash_process() with tasklist_lock held */
+void lowmem_adj_index_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	list_del_init(&p->lmk_adj_node);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called after p->signal->oom_adj changed, with siglock held */
+void lowmem_adj_index_update(struct task_struct *p)
+{
+	unsigned long flags;
+	struct task_struct *leader = p->group_leader;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (!list_empty(&leader->lmk_adj_node)) {
+		leader->lmk_adj_seq = ++lowmem_adj_seq;
+		list_move_tail(&leader->lmk_adj_node,
+			       lowmem_adj_bucket(p->signal->oom_adj));
+	}
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called from de_thread() when a thread takes over as group leader */
+void lowmem_adj_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (!list_empty(&old->lmk_adj_node)) {
+		new->lmk_adj_seq = old->lmk_adj_seq;
+		list_replace_init(&old->lmk_adj_node, &new->lmk_adj_node);
+	}
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+#define LOWMEM_SCAN_BATCH 16
+
+/*
+ * Add tasks from the oom_adj bucket to selected[first..max), largest
+ * RSS first, and return the new number of tasks in selected[]. Every
+ * task in the bucket is looked at, so the cost grows with the size of
+ * the bucket, though not with the number of other tasks. RSS can only
+ * be read under task_lock, which nests outside lowmem_adj_lock, so
+ * references are taken on a batch of tasks with the lock held and
+ * their RSS is read, one task_lock at a time, once it is dropped.
+ *
+ * The next batch resumes after the last task seen: right after it if
+ * it is still filed with the same stamp, else after the first task
+ * filed later. A task refiled meanwhile is seen again at the tail, so
+ * tasks already in selected[], from this bucket or a higher one, are
+ * skipped. A reference is held on each task returned.
+ */
+static int lowmem_select_bucket(int adj, struct task_struct **selected,
+				int *selected_tasksize, int first, int max)
+{
+	struct list_head *head = lowmem_adj_bucket(adj);
+	struct task_struct *batch[LOWMEM_SCAN_BATCH];
+	struct task_struct *p, *last = NULL;
+	u64 last_seq = 0;
+	int n, i, j, nr = first;
+	int tasksize;
+
+	do {
+		n = 0;
+		spin_lock_irq(&lowmem_adj_lock);
+		if (last && !list_empty(&last->lmk_adj_node) &&
+		    last->lmk_adj_seq == last_seq)
+			p = last;
+		else
+			p = list_entry(head, struct task_struct, lmk_adj_node);
+		list_for_each_entry_continue(p, head, lmk_adj_node) {
+			/* Seen already, exiting, or a kernel thread */
+			if (p->lmk_adj_seq <= last_seq || !p->mm)
+				continue;
+			get_task_struct(p);
+			batch[n++] = p;
+			if (n == LOWMEM_SCAN_BATCH)
+				break;
+		}
+		if (n)
+			last_seq = batch[n - 1]->lmk_adj_seq;
+		spin_unlock_irq(&lowmem_adj_lock);
+
+		if (last)
+			put_task_struct(last);
+		last = n ? batch[n - 1] : NULL;
+		if (last)
+			get_task_struct(last);
+
+		for (i = 0; i < n; i++) {
+			p = batch[i];
+			tasksize = 0;
+			task_lock(p);
+			if (p->mm)
+				tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+
+			for (j = 0; j < nr && selected[j] != p; j++)
+				;
+			if (tasksize <= 0 || j < nr || (nr == max &&
+					tasksize <= selected_tasksize[nr - 1])) {
+				put_task_struct(p);
+				continue;
+			}
+			if (nr == max)
+				put_task_struct(selected[--nr]);
+
+			for (j = nr; j > first &&
+			     selected_tasksize[j - 1] < tasksize; j--) {
+				selected[j] = selected[j - 1];
+				selected_tasksize[j] = selected_tasksize[j - 1];
+			}
+			selected[j] = p;
+			selected_tasksize[j] = tasksize;
+			nr++;
+		}
+	} while (n == LOWMEM_SCAN_BATCH);
+
+	if (last)
+		put_task_struct(last);
+	return nr;
+}
+
+/*
+ * Pick up to LOWMEM_SELECT_DEPTH victims with oom_adj >= min_adj,
+ * highest oom_adj first and, within one oom_adj, the largest RSS
+ * first. Only the buckets down to the first non-empty ones are looked
+ * at and tasklist_lock is not taken. A reference is held on each
+ * task returned.
+ */
+static int lowmem_select(int min_adj, struct task_struct **selected,
+			 int *selected_tasksize, int *selected_oom_adj)
+{
+	int adj, i, n, nr = 0;
+
+	for (adj = OOM_ADJUST_MAX;
+	     adj >= min_adj && nr < LOWMEM_SELECT_DEPTH; adj--) {
+		n = lowmem_select_bucket(adj, selected, selected_tasksize,
+					 nr, LOWMEM_SELECT_DEPTH);
+		for (i = nr; i < n; i++) {
+			selected_oom_adj[i] = adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", selected[i]->pid,
+				     selected[i]->comm, adj,
+				     selected_tasksize[i]);
+		}
+		nr = n;
+	}
+
+	return nr;
+}
+#endif /* CONFIG_ANDROID_LMK_ADJ_INDEX */
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -135,14 +350,17 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
+#ifndef CONFIG_ANDROID_LMK_ADJ_INDEX
 	struct task_struct *p;
+	int tasksize;
+#endif
+	ktime_t start;
 #ifdef ENHANCED_LMK_ROUTINE
 	struct task_struct *selected[LOWMEM_DEATHPENDING_DEPTH] = {NULL,};
 #else
 	struct task_struct *selected = NULL;
 #endif
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 #ifdef ENHANCED_LMK_ROUTINE
@@ -202,6 +420,36 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		return rem;
 	}
 
+	start = ktime_get();
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+#ifdef ENHANCED_LMK_ROUTINE
+	all_selected_oom = lowmem_select(min_adj, selected, selected_tasksize,
+					 selected_oom_adj);
+	for (i = 0; i < all_selected_oom; i++) {
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+			     selected[i]->pid, selected[i]->comm,
+			     selected_oom_adj[i], selected_tasksize[i]);
+		lowmem_deathpending[i] = selected[i];
+		lowmem_deathpending_timeout = jiffies + HZ;
+		force_sig(SIGKILL, selected[i]);
+		rem -= selected_tasksize[i];
+		put_task_struct(selected[i]);
+	}
+#else
+	if (lowmem_select(min_adj, &selected, &selected_tasksize,
+			  &selected_oom_adj)) {
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+			     selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize);
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
+		force_sig(SIGKILL, selected);
+		rem -= selected_tasksize;
+		put_task_struct(selected);
+	}
+#endif
+#else /* !CONFIG_ANDROID_LMK_ADJ_INDEX */
 #ifdef ENHANCED_LMK_ROUTINE
 	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++)
 		selected_oom_adj[i] = min_adj;
@@ -293,9 +541,16 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		rem -= selected_tasksize;
 	}
 #endif
+	read_unlock(&tasklist_lock);
+#endif /* CONFIG_ANDROID_LMK_ADJ_INDEX */
+
+	spin_lock(&lowmem_stats_lock);
+	lowmem_scan_calls++;
+	lowmem_scan_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_unlock(&lowmem_stats_lock);
+
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -305,94 +560,6 @@ static struct shrinker lowmem_shrinker = {
 };
 
 #ifdef CONFIG_ZRAM_FOR_ANDROID
-/*
- * zone_id_shrink_pagelist() clear page flags,
- * update the memory zone status, and swap pagelist
- */
-
-static unsigned int shrink_pages(struct mm_struct *mm,
-				 struct list_head *zone0_page_list,
-				 struct list_head *zone1_page_list,
-				 unsigned int num_to_scan)
-{
-	unsigned long addr;
-	unsigned int isolate_pages_countter = 0;
-
-	struct vm_area_struct *vma = mm->mmap;
-	while (vma != NULL) {
-
-		for (addr = vma->vm_start; addr < vma->vm_end;
-		     addr += PAGE_SIZE) {
-			struct page *page;
-			/*get the page address from virtual memory address */
-			page = follow_page(vma, addr, FOLL_GET);
-
-			if (page && !IS_ERR(page)) {
-
-				put_page(page);
-				/* only moveable, anonymous and not dirty pages can be swapped  */
-				if ((!PageUnevictable(page))
-				    && (!PageDirty(page)) && ((PageAnon(page)))
-				    && (0 == page_is_file_cache(page))) {
-					switch (page_zone_id(page)) {
-					case 0:
-						if (!isolate_lru_page_compcache(page)) {
-							/* isolate page from LRU and add to temp list  */
-							/*create new page list, it will be used in shrink_page_list */
-							list_add_tail(&page->lru, zone0_page_list);
-							isolate_pages_countter++;
-						}
-						break;
-					case 1:
-						if (!isolate_lru_page_compcache(page)) {
-							/* isolate page from LRU and add to temp list  */
-							/*create new page list, it will be used in shrink_page_list */
-							list_add_tail(&page->lru, zone1_page_list);
-							isolate_pages_countter++;
-						}
-						break;
-					default:
-						break;
-					}
-				}
-			}
-
-			if (isolate_pages_countter >= num_to_scan) {
-				return isolate_pages_countter;
-			}
-		}
-
-		vma = vma->vm_next;
-	}
-
-	return isolate_pages_countter;
-}
-
-/*
- * swap_application_pages() will search the
- * pages which can be swapped, then call
- * zone_id_shrink_pagelist to update zone
- * status
- */
-static unsigned int swap_pages(struct list_head *zone0_page_list,
-								struct list_head *zone1_page_list)
-{
-        struct zone *zone_id_0 = &NODE_DATA(0)->node_zones[0];
-        struct zone *zone_id_1 = &NODE_DATA(0)->node_zones[1];
-	unsigned int pages_counter = 0;
-
-	/*if the page list is not empty, call zone_id_shrink_pagelist to update zone status */
-	if ((zone_id_0) && (!list_empty(zone0_page_list))) {
-		pages_counter +=
-		    zone_id_shrink_pagelist(zone_id_0, zone0_page_list);
-	}
-	if ((zone_id_1) && (!list_empty(zone1_page_list))) {
-		pages_counter +=
-		    zone_id_shrink_pagelist(zone_id_1, zone1_page_list);
-	}
-	return pages_counter;
-}
-
 static ssize_t lmk_state_show(struct device *dev,
 			      struct device_attribute *attr, char *buf)
 {
@@ -438,38 +605,30 @@ static ssize_t lmk_state_store(struct device *dev,
 		for_each_process(p) {
 			if ((p->pid == lmk_kill_pid) &&
 			    (__task_cred(p)->uid > 10000)) {
-				task_lock(p);
-				selected = p;
-				if (!selected->mm || !selected->signal) {
-				task_unlock(p);
-				selected = NULL;
-				break;
-		        }
-#if SWAP_PROCESS_DEBUG_LOG > 0
-				printk
-				    ("idletime compcache: swap process pid %d, name %s, oom %d, task_size %ld\n",
-				     p->pid, p->comm, p->signal->oom_adj,
-				     get_mm_rss(p->mm));
-#endif
+				if (p->mm && p->signal) {
+					selected = p;
+					get_task_struct(selected);
+				}
 				break;
 			}
 		}
 		read_unlock(&tasklist_lock);
 
 		if (selected) {
-			LIST_HEAD(zone0_page_list);
-			LIST_HEAD(zone1_page_list);
-			int pages_tofree = 0, pages_freed = 0;
-
-			pages_tofree =
-			    shrink_pages(selected->mm, &zone0_page_list,
-						&zone1_page_list, 0x7FFFFFFF);
-			task_unlock(selected);
-			pages_freed =
-			    swap_pages(&zone0_page_list,
-				       &zone1_page_list);
-			lmk_kill_ok = 0;
+			struct mm_struct *mm = get_task_mm(selected);
 
+			if (mm) {
+#if SWAP_PROCESS_DEBUG_LOG > 0
+				printk
+				    ("idletime compcache: swap process pid %d, name %s, oom %d, task_size %ld\n",
+				     selected->pid, selected->comm,
+				     selected->signal->oom_adj, get_mm_rss(mm));
+#endif
+				reclaim_mm_anon_pages(mm);
+				mmput(mm);
+			}
+			put_task_struct(selected);
+			lmk_kill_ok = 0;
 		}
 	}
 
@@ -526,12 +685,28 @@ static void __exit lowmem_exit(void)
 	task_free_unregister(&task_nb);
 }
 
+static int lowmem_get_stat(char *buffer, const struct kernel_param *kp)
+{
+	u64 val;
+
+	spin_lock(&lowmem_stats_lock);
+	val = *(u64 *)kp->arg;
+	spin_unlock(&lowmem_stats_lock);
+	return sprintf(buffer, "%llu", (unsigned long long)val);
+}
+
+static struct kernel_param_ops lowmem_stat_ops = {
+	.get = lowmem_get_stat,
+};
+
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_cb(scan_calls, &lowmem_stat_ops, &lowmem_scan_calls, S_IRUGO);
+module_param_cb(scan_ns, &lowmem_stat_ops, &lowmem_scan_ns, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -23,15 +23,18 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/ktime.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #ifdef CONFIG_ZRAM_FOR_ANDROID
 #include <linux/swap.h>
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
@@ -40,21 +43,13 @@
 
 /* Globals */
 static int zram_major;
+static struct workqueue_struct *zram_wq;
+static struct kmem_cache *zram_entry_cache;
 struct zram *devices;
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
-
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
 	spin_lock(&zram->stat64_lock);
@@ -92,21 +87,367 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static u16 zram_get_obj_size(struct zram *zram, u32 index)
+{
+	return zram->table[index].flags >> ZRAM_SIZE_SHIFT;
+}
+
+static void zram_set_obj_size(struct zram *zram, u32 index, u16 size)
+{
+	unsigned long flags = zram->table[index].flags;
+
+	flags &= BIT(ZRAM_SIZE_SHIFT) - 1;
+	zram->table[index].flags = flags | (unsigned long)size << ZRAM_SIZE_SHIFT;
+}
+
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+/* Record an access to the slot for idle page writeback */
+static void zram_accessed(struct zram *zram, u32 index)
+{
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram->table[index].ac_time = jiffies;
+#endif
+}
+
+static void zram_comp_strm_destroy(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp_strm)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *strm = per_cpu_ptr(zram->comp_strm, cpu);
+
+		if (strm->tfm)
+			crypto_free_comp(strm->tfm);
+		free_pages((unsigned long)strm->buffer, 1);
+	}
+
+	free_percpu(zram->comp_strm);
+	zram->comp_strm = NULL;
+}
+
+static int zram_comp_strm_create(struct zram *zram)
+{
+	int cpu;
+
+	zram->comp_strm = alloc_percpu(struct zram_comp_strm);
+	if (!zram->comp_strm)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *strm = per_cpu_ptr(zram->comp_strm, cpu);
+
+		mutex_init(&strm->lock);
+		strm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(strm->tfm)) {
+			int ret = PTR_ERR(strm->tfm);
+
+			strm->tfm = NULL;
+			zram_comp_strm_destroy(zram);
+			return ret;
+		}
+		/*
+		 * Allocate 2 pages: backends may expand incompressible
+		 * input, e.g. lzo up to PAGE_SIZE + PAGE_SIZE / 16 + 67.
+		 */
+		strm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							__GFP_ZERO, 1);
+		if (!strm->buffer) {
+			zram_comp_strm_destroy(zram);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Grab the compression stream of the local CPU. We may be migrated
+ * while holding it, in which case the stream mutex keeps another
+ * writer on the original CPU from using it at the same time.
+ */
+static struct zram_comp_strm *zram_comp_strm_find(struct zram *zram)
+{
+	struct zram_comp_strm *strm;
+
+	strm = per_cpu_ptr(zram->comp_strm, raw_smp_processor_id());
+	mutex_lock(&strm->lock);
+
+	return strm;
+}
+
+static void zram_comp_strm_release(struct zram_comp_strm *strm)
+{
+	mutex_unlock(&strm->lock);
+}
+
+static void zram_lat_hist_add(atomic_t *hist, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	int bucket = ns ? fls64(ns) - 1 : 0;
+
+	if (bucket >= ZRAM_LAT_HIST_BUCKETS)
+		bucket = ZRAM_LAT_HIST_BUCKETS - 1;
+	atomic_inc(&hist[bucket]);
+}
+
+/*
+ * Check whether the page is one word repeated throughout; zero filled
+ * pages are the common case. The word is returned in *element.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	if (likely(!element)) {
+		memset(ptr, 0, PAGE_SIZE);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+/*
+ * Without dedup an object only ever has one user, so no zram_entry is
+ * allocated for it: the "entry" is the zsmalloc handle. The object
+ * size is kept in the slot flags in both cases.
+ */
+static unsigned long zram_entry_handle(struct zram *zram,
+				struct zram_entry *entry)
+{
+	if (!zram->hash)
+		return (unsigned long)entry;
+	return entry->handle;
+}
+
+static struct zram_entry *zram_entry_alloc(struct zram *zram,
+				unsigned int len, u32 checksum)
+{
+	struct zram_entry *entry;
+	unsigned long handle;
+
+	handle = zs_malloc(zram->mem_pool, len);
+	if (!handle)
+		return NULL;
+
+	if (!zram->hash)
+		return (struct zram_entry *)handle;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry) {
+		zs_free(zram->mem_pool, handle);
+		return NULL;
+	}
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->refcount = 1;
+
+	return entry;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry,
+				unsigned int len)
+{
+	zs_free(zram->mem_pool, zram_entry_handle(zram, entry));
+
+	if (unlikely(len == PAGE_SIZE))
+		atomic_dec(&zram->stats.pages_expand);
+	else if (len <= PAGE_SIZE / 2)
+		atomic_dec(&zram->stats.good_compress);
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, len);
+	if (zram->hash)
+		kmem_cache_free(zram_entry_cache, entry);
+}
+
+/*
+ * Same-page dedup: every stored object is indexed by the checksum of
+ * its uncompressed contents, so that writing a page identical to one
+ * already stored (common with zygote-forked processes) only takes a
+ * reference on the existing object.
+ */
+static int zram_hash_create(struct zram *zram)
+{
+	size_t i;
+
+	zram->hash_size = (zram->disksize >> PAGE_SHIFT) >> ZRAM_HASH_SHIFT;
+	zram->hash_size = clamp_t(size_t, zram->hash_size,
+				ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash)
+		return -ENOMEM;
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+static void zram_hash_destroy(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
+
+/*
+ * Drop a reference to an object of len bytes, freeing it with the last
+ * one. Returns true if the object was freed. May be called with a slot
+ * lock held.
+ */
+static bool zram_entry_put(struct zram *zram, struct zram_entry *entry,
+				unsigned int len)
+{
+	struct zram_hash *hash;
+	int refcount;
+
+	if (!zram->hash) {
+		zram_entry_free(zram, entry, len);
+		return true;
+	}
+
+	hash = &zram->hash[entry->checksum % zram->hash_size];
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount && !RB_EMPTY_NODE(&entry->rb_node))
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	if (refcount)
+		return false;
+
+	zram_entry_free(zram, entry, len);
+	return true;
+}
+
+static u32 zram_calc_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *new)
+{
+	struct zram_hash *hash = &zram->hash[new->checksum % zram->hash_size];
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (new->checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Compare a stored object against the page being written. The stream
+ * buffer is free at this point and receives the decompressed object.
+ */
+static bool zram_dedup_match(struct zram *zram, struct zram_comp_strm *strm,
+				struct zram_entry *entry, unsigned char *mem)
+{
+	int ret;
+	bool match;
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE) {
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	} else {
+		ret = crypto_comp_decompress(strm->tfm, cmem, entry->len,
+						strm->buffer, &clen);
+		match = !ret && clen == PAGE_SIZE &&
+			!memcmp(mem, strm->buffer, PAGE_SIZE);
+	}
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look up an object with the given checksum and contents and take a
+ * reference on it. Only the first object with a matching checksum is
+ * compared: a 32-bit collision between different live pages is rare
+ * enough that it is not worth walking the duplicates.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct zram_comp_strm *strm,
+				unsigned char *mem, u32 checksum)
+{
+	struct zram_hash *hash = &zram->hash[checksum % zram->hash_size];
+	struct rb_node *rb_node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+		entry = NULL;
+	}
+	if (entry)
+		entry->refcount++;
+	spin_unlock(&hash->lock);
+
+	if (!entry)
+		return NULL;
+
+	if (zram_dedup_match(zram, strm, entry, mem))
+		return entry;
+
+	zram_entry_put(zram, entry, entry->len);
+	return NULL;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -152,141 +493,501 @@ static void setup_swap_header(struct zram *zram, union swap_header *s)
 }
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
-static void zram_free_page(struct zram *zram, size_t index)
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_reset_bdev(struct zram *zram)
 {
-	u32 clen;
-	void *obj;
+	if (!zram->bdev)
+		return;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
-		return;
+/*
+ * Attach a backing device for writeback. Called with init_lock held
+ * on a device that is not initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	char *name;
+	unsigned long nr_pages, *bitmap;
+	struct block_device *bdev;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE |
+					FMODE_EXCL, zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!nr_pages) {
+		ret = -EINVAL;
+		goto out;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	name = kstrdup(path, GFP_KERNEL);
+	if (!bitmap || !name) {
+		vfree(bitmap);
+		kfree(name);
+		ret = -ENOMEM;
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	zram_reset_bdev(zram);
+	zram->bdev = bdev;
+	zram->backing_dev = name;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	pr_info("setup backing device %s (%lu pages)\n", path, nr_pages);
+	return 0;
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+
+static int zram_alloc_block(struct zram *zram, unsigned long *blk)
+{
+	unsigned long i;
+
+	do {
+		i = find_first_zero_bit(zram->bitmap, zram->nr_pages);
+		if (i >= zram->nr_pages)
+			return -ENOSPC;
+	} while (test_and_set_bit(i, zram->bitmap));
+
+	atomic_inc(&zram->stats.bd_count);
+	*blk = i;
+	return 0;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	clear_bit(blk, zram->bitmap);
+	atomic_dec(&zram->stats.bd_count);
+}
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
 }
 
-static void handle_zero_page(struct page *page)
+static int zram_bdev_rw_sync(struct zram *zram, int rw, struct page *page,
+				unsigned long blk)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *w = container_of(work, struct zram_bdev_work,
+						work);
+
+	w->ret = zram_bdev_rw_sync(w->zram, READ_SYNC, w->page, w->blk);
+}
+
+/*
+ * We are called from zram_make_request(), where a bio we submit is
+ * only queued on current->bio_list until we return, so waiting for it
+ * would never finish. Issue the read from a worker instead.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+				unsigned long blk)
+{
+	struct zram_bdev_work w;
+
+	w.zram = zram;
+	w.page = page;
+	w.blk = blk;
+
+	INIT_WORK_ONSTACK(&w.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &w.work);
+	flush_work(&w.work);
+	destroy_work_on_stack(&w.work);
+
+	if (!w.ret)
+		atomic_inc(&zram->stats.bd_reads);
+
+	return w.ret;
+}
+#else
+static inline void zram_reset_bdev(struct zram *zram) { }
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
+/*
+ * Release the memory backing a slot. Called with the slot locked.
+ */
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct zram_entry *entry = zram->table[index].entry;
+	u16 len;
+
+	/* Tell a writeback in progress that the slot changed under it */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, zram->table[index].element);
+		zram->table[index].element = 0;
+		return;
+	}
+#endif
+
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (!zram->table[index].element)
+			atomic_dec(&zram->stats.pages_zero);
+		atomic_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
+		return;
+	}
+
+	if (unlikely(!entry))
+		return;
+
+	len = zram_get_obj_size(zram, index);
+	if (!zram_entry_put(zram, entry, len))
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, len);
+	atomic_dec(&zram->stats.pages_stored);
+
+	zram->table[index].entry = NULL;
+	zram_set_obj_size(zram, index, 0);
+}
+
+static void handle_same_page(struct page *page, unsigned long element)
 {
 	void *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	zram_fill_page(user_mem, element);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
-static void handle_uncompressed_page(struct zram *zram,
+/*
+ * Decompress the object stored in table[index] into mem. Called with
+ * the slot locked.
+ */
+static int zram_decompress_entry(struct zram *zram,
+				struct zram_comp_strm *strm,
+				u32 index, void *mem)
+{
+	int ret;
+	unsigned int clen = PAGE_SIZE;
+	unsigned int len = zram_get_obj_size(zram, index);
+	unsigned long handle;
+	unsigned char *cmem;
+	ktime_t start;
+
+	handle = zram_entry_handle(zram, zram->table[index].entry);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(len == PAGE_SIZE)) {
+		memcpy(mem, cmem, PAGE_SIZE);
+		zs_unmap_object(zram->mem_pool, handle);
+		return 0;
+	}
+
+	start = ktime_get();
+	ret = crypto_comp_decompress(strm->tfm, cmem, len, mem, &clen);
+	zram_lat_hist_add(zram->stats.decompr_lat, start);
+
+	zs_unmap_object(zram->mem_pool, handle);
+
+	return ret;
+}
+
+/*
+ * *strm is the caller's compression stream. It is released while the
+ * page is read from the backing device, so that other users of the
+ * stream do not wait for disk I/O, and *strm is then updated with the
+ * stream taken again afterwards.
+ */
+static int zram_read_page(struct zram *zram, struct zram_comp_strm **strm,
 				struct page *page, u32 index)
 {
-	unsigned char *user_mem, *cmem;
+	int ret;
+	struct zram_entry *entry;
+	unsigned char *user_mem;
 
-	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	zram_slot_lock(zram, index);
+	zram_accessed(zram, index);
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		unsigned long element = zram->table[index].element;
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
+		zram_slot_unlock(zram, index);
+		handle_same_page(page, element);
+		return 0;
+	}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk = zram->table[index].element;
+
+		zram_slot_unlock(zram, index);
+
+		zram_comp_strm_release(*strm);
+		ret = zram_read_from_bdev(zram, page, blk);
+		*strm = zram_comp_strm_find(zram);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, "
+				"page=%u\n", ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			return ret;
+		}
+		flush_dcache_page(page);
+		return 0;
+	}
+#endif
+
+	/* Requested page is not present in compressed area */
+	entry = zram->table[index].entry;
+	if (unlikely(!entry)) {
+		zram_slot_unlock(zram, index);
+		pr_debug("Read before write: page=%u\n", index);
+		handle_same_page(page, 0);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zram_decompress_entry(zram, *strm, index, user_mem);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+
+	zram_slot_unlock(zram, index);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
 
 	flush_dcache_page(page);
+	return 0;
 }
 
+/*
+ * The whole bio is handled with one compression stream, taken once,
+ * rather than a stream lock round-trip per segment. It is only given
+ * up for reads from the backing device.
+ */
 static void zram_read(struct zram *zram, struct bio *bio)
 {
-
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_comp_strm *strm;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	strm = zram_comp_strm_find(zram);
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		if (zram_read_page(zram, &strm, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
+	zram_comp_strm_release(strm);
 
-		page = bvec->bv_page;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+out:
+	zram_comp_strm_release(strm);
+	bio_io_error(bio);
+}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+/*
+ * Install a stored object of len bytes in table[index], releasing
+ * whatever the slot held before.
+ */
+static void zram_set_entry(struct zram *zram, u32 index,
+				struct zram_entry *entry, unsigned int len)
+{
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	zram->table[index].entry = entry;
+	zram_set_obj_size(zram, index, len);
+	zram_accessed(zram, index);
+	zram_slot_unlock(zram, index);
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
+	atomic_inc(&zram->stats.pages_stored);
+}
+
+/*
+ * Compress a page and install the result in table[index].
+ *
+ * Compression and allocation of the new object are done without
+ * holding the slot lock, using the caller's per-CPU stream, so that
+ * writers only contend on the slot lock for the short table update
+ * at the end.
+ */
+static int zram_write_page(struct zram *zram, struct zram_comp_strm *strm,
+				struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen;
+	unsigned long element;
+	unsigned long handle;
+	u32 checksum = 0;
+	ktime_t start;
+	struct zram_entry *entry;
+	unsigned char *user_mem, *cmem, *src;
+
+	src = strm->buffer;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		zram_accessed(zram, index);
+		zram_slot_unlock(zram, index);
+
+		if (!element)
+			atomic_inc(&zram->stats.pages_zero);
+		atomic_inc(&zram->stats.pages_same);
+		return 0;
+	}
+
+	if (zram->hash) {
+		checksum = zram_calc_checksum(user_mem);
+		entry = zram_dedup_find(zram, strm, user_mem, checksum);
+		if (entry) {
+			kunmap_atomic(user_mem, KM_USER0);
+
+			zram_set_entry(zram, index, entry, entry->len);
+			zram_stat64_add(zram, &zram->stats.dup_data_size,
+					entry->len);
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			return 0;
 		}
+	}
+
+	clen = 2 * PAGE_SIZE;
+	start = ktime_get();
+	ret = crypto_comp_compress(strm->tfm, user_mem, PAGE_SIZE, src, &clen);
+	zram_lat_hist_add(zram->stats.compr_lat, start);
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		return ret;
+	}
 
-		user_mem = kmap_atomic(page, KM_USER0);
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size))
 		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	entry = zram_entry_alloc(zram, clen, checksum);
+	if (!entry) {
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%u\n", index, clen);
+		return -ENOMEM;
+	}
+
+	if (unlikely(clen == PAGE_SIZE))
+		src = kmap_atomic(page, KM_USER0);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	handle = zram_entry_handle(zram, entry);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, src, clen);
+	zs_unmap_object(zram->mem_pool, handle);
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	if (unlikely(clen == PAGE_SIZE))
+		kunmap_atomic(src, KM_USER0);
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (unlikely(clen == PAGE_SIZE))
+		atomic_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
+
+	if (zram->hash)
+		zram_dedup_insert(zram, entry);
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now and publish the new object.
+	 */
+	zram_set_entry(zram, index, entry, clen);
+
+	return 0;
+}
+
+static void zram_write(struct zram *zram, struct zram_comp_strm *strm,
+			struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, strm, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
-
-		flush_dcache_page(page);
 		index++;
 	}
 
@@ -298,130 +999,177 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Move stored pages to the backing device: incompressible ones if
+ * huge is set, otherwise those not accessed for at least age jiffies.
+ * Called with init_lock held on an initialized device.
+ *
+ * Each page is decompressed with its slot locked and the slot marked
+ * ZRAM_UNDER_WB. Any write or free of the slot while the block is
+ * written out clears the mark, in which case the block is dropped
+ * and the slot left alone.
+ */
+int zram_writeback(struct zram *zram, bool huge, unsigned long age)
 {
-	int i;
+	int ret = 0;
 	u32 index;
-	struct bio_vec *bvec;
+	unsigned long blk;
+	struct page *page;
+	struct zram_entry *entry;
+	struct zram_comp_strm *strm;
+	void *mem;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (!zram->bdev)
+		return -ENODEV;
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		strm = zram_comp_strm_find(zram);
+		zram_slot_lock(zram, index);
+
+		entry = zram->table[index].entry;
+		if (zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB) || !entry)
+			goto next;
+		if (huge && zram_get_obj_size(zram, index) != PAGE_SIZE)
+			goto next;
+		if (!huge && time_before(jiffies,
+					zram->table[index].ac_time + age))
+			goto next;
+		/* Shared with other slots, writing it back frees nothing */
+		if (zram->hash && entry->refcount > 1)
+			goto next;
+
+		mem = kmap_atomic(page, KM_USER0);
+		ret = zram_decompress_entry(zram, strm, index, mem);
+		kunmap_atomic(mem, KM_USER0);
+		if (ret)
+			goto next;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+		zram_comp_strm_release(strm);
 
-		mutex_lock(&zram->lock);
+		ret = zram_alloc_block(zram, &blk);
+		if (!ret) {
+			ret = zram_bdev_rw_sync(zram, WRITE_SYNC, page, blk);
+			if (ret)
+				zram_free_block(zram, blk);
+		}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
+		zram_slot_lock(zram, index);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, index);
+			if (!ret)
+				zram_free_block(zram, blk);
+			if (ret == -ENOSPC)
+				break;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].element = blk;
+		zram_slot_unlock(zram, index);
 
-		kunmap_atomic(user_mem, KM_USER0);
+		atomic_inc(&zram->stats.bd_writes);
+		continue;
+next:
+		zram_slot_unlock(zram, index);
+		zram_comp_strm_release(strm);
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	__free_page(page);
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+	return ret == -ENOSPC ? ret : 0;
+}
+#endif /* CONFIG_ZRAM_WRITEBACK */
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+static void zram_bio_work(struct work_struct *work)
+{
+	struct zram_bio_queue *q = container_of(work, struct zram_bio_queue,
+						work);
+	struct zram *zram = q->zram;
+	struct zram_comp_strm *strm;
+	struct bio *bio, *next;
+	ktime_t queued;
+
+	spin_lock(&q->lock);
+	bio = bio_list_get(&q->list);
+	queued = q->queued;
+	spin_unlock(&q->lock);
+
+	if (!bio)
+		return;
+
+	zram_lat_hist_add(zram->stats.queue_lat, queued);
+
+	strm = zram_comp_strm_find(zram);
+	while (bio) {
+		next = bio->bi_next;
+		bio->bi_next = NULL;
+		zram_write(zram, strm, bio);
+		bio = next;
+	}
+	zram_comp_strm_release(strm);
+}
 
-memstore:
-		zram->table[index].offset = offset;
+/*
+ * Hand a write bio to the worker of the local CPU, so that the
+ * submitter (typically kswapd) does not wait for compression.
+ */
+static void zram_queue_bio(struct zram *zram, struct bio *bio)
+{
+	int cpu = get_cpu();
+	struct zram_bio_queue *q = per_cpu_ptr(zram->bio_queue, cpu);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	spin_lock(&q->lock);
+	if (bio_list_empty(&q->list))
+		q->queued = ktime_get();
+	bio_list_add(&q->list, bio);
+	spin_unlock(&q->lock);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	queue_work_on(cpu, zram_wq, &q->work);
+	put_cpu();
+}
 
-		memcpy(cmem, src, clen);
+static int zram_bio_queue_create(struct zram *zram)
+{
+	int cpu;
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	zram->bio_queue = alloc_percpu(struct zram_bio_queue);
+	if (!zram->bio_queue)
+		return -ENOMEM;
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	for_each_possible_cpu(cpu) {
+		struct zram_bio_queue *q = per_cpu_ptr(zram->bio_queue, cpu);
 
-		mutex_unlock(&zram->lock);
-		index++;
+		spin_lock_init(&q->lock);
+		bio_list_init(&q->list);
+		INIT_WORK(&q->work, zram_bio_work);
+		q->zram = zram;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	return 0;
+}
 
-out:
-	bio_io_error(bio);
+static void zram_bio_hist_add(struct zram *zram, struct bio *bio)
+{
+	unsigned int pages = bio->bi_size >> PAGE_SHIFT;
+	int bucket;
+
+	if (!pages)
+		return;
+
+	bucket = fls(pages) - 1;
+	if (bucket >= ZRAM_BIO_HIST_BUCKETS)
+		bucket = ZRAM_BIO_HIST_BUCKETS - 1;
+	atomic_inc(&zram->stats.bio_size[bucket]);
 }
 
 /*
@@ -447,6 +1195,7 @@ static inline int valid_io_request(struct zram *zram, struct bio *bio)
 static int zram_make_request(struct request_queue *queue, struct bio *bio)
 {
 	struct zram *zram = queue->queuedata;
+	struct zram_comp_strm *strm;
 
 	if (!valid_io_request(zram, bio)) {
 		zram_stat64_inc(zram, &zram->stats.invalid_io);
@@ -459,13 +1208,21 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 		return 0;
 	}
 
+	zram_bio_hist_add(zram, bio);
+
 	switch (bio_data_dir(bio)) {
 	case READ:
 		zram_read(zram, bio);
 		break;
 
 	case WRITE:
-		zram_write(zram, bio);
+		if (zram->async_write) {
+			zram_queue_bio(zram, bio);
+			break;
+		}
+		strm = zram_comp_strm_find(zram);
+		zram_write(zram, strm, bio);
+		zram_comp_strm_release(strm);
 		break;
 	}
 
@@ -479,34 +1236,23 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Complete writes still queued for the worker */
+	flush_workqueue(zram_wq);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_comp_strm_destroy(zram);
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram_hash_destroy(zram);
+	zram_reset_bdev(zram);
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -521,7 +1267,8 @@ int zram_init_device(struct zram *zram)
 	int ret;
 	size_t num_pages;
 #ifdef CONFIG_ZRAM_FOR_ANDROID
-	struct page *page;
+	struct zram_entry *entry;
+	unsigned long handle;
 	union swap_header *swap_header;
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
@@ -534,17 +1281,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_comp_strm_create(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -558,31 +1298,46 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		ret = zram_hash_create(zram);
+		if (ret) {
+			pr_err("Error allocating dedup hash\n");
+			goto fail;
+		}
+	}
+
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	if (!zram->mem_pool) {
+		pr_err("Error creating memory pool\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 #ifdef CONFIG_ZRAM_FOR_ANDROID
-	page = alloc_page(__GFP_ZERO);
-	if (!page) {
+	entry = zram_entry_alloc(zram, PAGE_SIZE, 0);
+	if (!entry) {
 		pr_err("Error allocating swap header page\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
-	zram->table[0].page = page;
-	zram_set_flag(zram, 0, ZRAM_UNCOMPRESSED);
-	swap_header = kmap(page);
+	handle = zram_entry_handle(zram, entry);
+	swap_header = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memset(swap_header, 0, PAGE_SIZE);
 	setup_swap_header(zram, swap_header);
-	kunmap(page);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	/* Not indexed for dedup, nothing else would ever match it */
+	zram->table[0].entry = entry;
+	zram_set_obj_size(zram, 0, PAGE_SIZE);
+	zram_stat64_add(zram, &zram->stats.compr_size, PAGE_SIZE);
+	atomic_inc(&zram->stats.pages_expand);
+	atomic_inc(&zram->stats.pages_stored);
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
-	if (!zram->mem_pool) {
-		pr_err("Error creating memory pool\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
 	zram->init_done = 1;
 	mutex_unlock(&zram->init_lock);
 
@@ -602,7 +1357,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -615,9 +1372,17 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+
+	ret = zram_bio_queue_create(zram);
+	if (ret) {
+		pr_err("Error allocating bio queues for device %d\n",
+			device_id);
+		goto out;
+	}
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -687,6 +1452,9 @@ static void destroy_device(struct zram *zram)
 
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
+
+	flush_workqueue(zram_wq);
+	free_percpu(zram->bio_queue);
 }
 
 static int __init zram_init(void)
@@ -712,12 +1480,25 @@ static int __init zram_init(void)
 		num_devices = 1;
 	}
 
+	/* Runs compression for async writes, so may be used in reclaim */
+	zram_wq = alloc_workqueue("zram", WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
+	if (!zram_wq) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto destroy_wq;
+	}
+
 	/* Allocate the device array and initialize each one */
 	pr_info("Creating %u devices ...\n", num_devices);
 	devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
 	if (!devices) {
 		ret = -ENOMEM;
-		goto unregister;
+		goto destroy_cache;
 	}
 
 	for (dev_id = 0; dev_id < num_devices; dev_id++) {
@@ -732,6 +1513,10 @@ free_devices:
 	while (dev_id)
 		destroy_device(&devices[--dev_id]);
 	kfree(devices);
+destroy_cache:
+	kmem_cache_destroy(zram_entry_cache);
+destroy_wq:
+	destroy_workqueue(zram_wq);
 unregister:
 	unregister_blkdev(zram_major, "zram");
 out:
@@ -749,9 +1534,12 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_bdev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_wq);
+	kmem_cache_destroy(zram_entry_cache);
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
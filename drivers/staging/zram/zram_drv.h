@@ -17,8 +17,14 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/bio.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/rbtree.h>
+#include <linux/percpu.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +32,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -49,11 +43,8 @@ static const unsigned default_disksize_perc_ram = 25;
  */
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
-/*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
- */
+/* Compression backend used unless one is set via 'comp_algorithm' */
+static const char default_compressor[] = "lzo";
 
 /*-- End of configurable params */
 
@@ -63,25 +54,83 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
-/* Flags for zram pages (table[page_no].flags) */
+/*
+ * Latency histograms have one log2 bucket per power of two
+ * nanoseconds; the last bucket also counts everything slower.
+ */
+#define ZRAM_LAT_HIST_BUCKETS	32
+
+/* Bio size histogram: log2 of the size in pages, 1 .. 512+ pages */
+#define ZRAM_BIO_HIST_BUCKETS	10
+
+/*
+ * Dedup hash: one bucket for every 2^ZRAM_HASH_SHIFT disk pages,
+ * clamped to [ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX].
+ */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 4)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+/*
+ * Flags for zram pages (table[page_no].flags). The bits above them
+ * hold the size of the stored object; pages stored uncompressed are
+ * recognized by a size of PAGE_SIZE.
+ */
 enum zram_pageflags {
-	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Slot lock bit: held while the table entry is read or updated */
+	ZRAM_ACCESS,
+
+	/* Page lives on the backing device, at block table.element */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the slot changes */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+#define ZRAM_SIZE_SHIFT		__NR_ZRAM_PAGEFLAGS
+
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * A stored (compressed or incompressible) object, only allocated with
+ * dedup enabled. Several table slots may then point to the same entry;
+ * each of them holds one reference and the object is freed with the
+ * last one. Without dedup, table.entry is the zsmalloc handle itself.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash[checksum % hash_size] */
+	u32 checksum;		/* of the uncompressed page */
+	u16 len;		/* size of the stored object */
+	int refcount;		/* protected by the hash bucket lock */
+	unsigned long handle;	/* zsmalloc handle of the stored object */
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+/*
+ * Allocated for each disk page.
+ *
+ * entry/element and all bits of flags other than ZRAM_ACCESS are only
+ * read or modified with the ZRAM_ACCESS bit lock held, so that I/O to
+ * different slots never serializes on a device-wide lock.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	union {
+		struct zram_entry *entry;	/* stored object, if any */
+		unsigned long element;		/* fill word if ZRAM_SAME */
+	};
+	unsigned long flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of the last read or write */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -92,20 +141,63 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dup_data_size;	/* compressed bytes saved by dedup */
+	u64 dedup_hits;		/* writes satisfied by an existing object */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of same filled pages, incl. zero */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic_t bd_count;	/* no. of pages on the backing device */
+	atomic_t bd_reads;	/* no. of pages read from it */
+	atomic_t bd_writes;	/* no. of pages written back to it */
+#endif
+	/* per-page compression/decompression time, log2(ns) buckets */
+	atomic_t compr_lat[ZRAM_LAT_HIST_BUCKETS];
+	atomic_t decompr_lat[ZRAM_LAT_HIST_BUCKETS];
+	/* time write batches wait for the worker, log2(ns) buckets */
+	atomic_t queue_lat[ZRAM_LAT_HIST_BUCKETS];
+	/* bios received, by log2 of their size in pages */
+	atomic_t bio_size[ZRAM_BIO_HIST_BUCKETS];
+};
+
+/*
+ * Compression workspace. One is allocated for each possible CPU so
+ * that concurrent writers compress in parallel; the mutex only
+ * matters when a task is migrated while it holds its stream.
+ */
+struct zram_comp_strm {
+	struct mutex lock;
+	struct crypto_comp *tfm;
+	void *buffer;
+};
+
+/*
+ * Per-CPU queue of write bios waiting for the worker when async_write
+ * is set. The worker takes the whole list at once and compresses it
+ * with a single stream.
+ */
+struct zram_bio_queue {
+	spinlock_t lock;
+	struct bio_list list;
+	ktime_t queued;		/* when the list last became non-empty */
+	struct work_struct work;
+	struct zram *zram;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp_strm __percpu *comp_strm;
+	struct zram_bio_queue __percpu *bio_queue;
+	/* Complete write bios from a worker instead of the submitter */
+	bool async_write;
 	struct table *table;
+	/* dedup index of stored objects, keyed by content checksum */
+	struct zram_hash *hash;
+	size_t hash_size;
+	bool use_dedup;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +208,19 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* crypto API name of the compression backend */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Backing device for written back pages and a bitmap of its
+	 * page-sized blocks in use. Set up through 'backing_dev' before
+	 * the device is initialized and released on reset.
+	 */
+	struct block_device *bdev;
+	char *backing_dev;	/* path it was opened by */
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 
 	struct zram_stats stats;
 };
@@ -128,5 +233,9 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, bool huge, unsigned long age);
+#endif
 
 #endif
@@ -15,6 +15,9 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/crypto.h>
+#include <linux/slab.h>
+#include <linux/string.h>
 
 #include "zram_drv.h"
 
@@ -188,7 +191,64 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_zero));
+}
+
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_same));
+}
+
+static ssize_t dup_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dup_data_size));
+}
+
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->use_dedup);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change dedup for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = !!val;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
 }
 
 static ssize_t orig_data_size_show(struct device *dev,
@@ -197,7 +257,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -215,12 +275,273 @@ static ssize_t mem_used_total_show(struct device *dev,
 	u64 val = 0;
 	struct zram *zram = dev_to_zram(dev);
 
+	if (zram->init_done)
+		val = zs_get_total_size_bytes(zram->mem_pool);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	unsigned long freed;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	freed = zs_compact(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	pr_debug("compaction freed %lu pages\n", freed);
+	return len;
+}
+
+/*
+ * One line per size class in use: object size, pages per zspage,
+ * zspages, object slots and live objects. The unused slots are the
+ * fragmentation that 'compact' can recover.
+ */
+static ssize_t mem_pool_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zs_class_stats stats;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return 0;
+	}
+
+	sz += scnprintf(buf + sz, PAGE_SIZE - sz,
+			"size pages_per_zspage zspages objs_allocated "
+			"objs_used\n");
+	for (i = 0; i < zs_get_nr_classes(); i++) {
+		zs_get_class_stats(zram->mem_pool, i, &stats);
+		if (!stats.zspages)
+			continue;
+
+		sz += scnprintf(buf + sz, PAGE_SIZE - sz,
+				"%u %u %lu %lu %lu\n",
+				stats.size, stats.pages_per_zspage,
+				stats.zspages, stats.objs_allocated,
+				stats.objs_used);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return sz;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	sz = sprintf(buf, "%s\n",
+		zram->backing_dev ? zram->backing_dev : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	char *path;
+	struct zram *zram = dev_to_zram(dev);
+
+	path = kstrndup(buf, len, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+	strim(path);
+
+	mutex_lock(&zram->init_lock);
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
-			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
+		mutex_unlock(&zram->init_lock);
+		kfree(path);
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		return -EBUSY;
 	}
+	ret = zram_set_backing_dev(zram, path);
+	mutex_unlock(&zram->init_lock);
 
-	return sprintf(buf, "%llu\n", val);
+	kfree(path);
+	return ret ? ret : len;
+}
+
+/*
+ * "huge" writes back all incompressible pages, "idle <seconds>" the
+ * pages that were not read or written for at least that long.
+ */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	bool huge = false;
+	unsigned long secs = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "huge"))
+		huge = true;
+	else if (sscanf(buf, "idle %lu", &secs) != 1)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	ret = zram_writeback(zram, huge, secs * HZ);
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u %u %u\n",
+		atomic_read(&zram->stats.bd_count),
+		atomic_read(&zram->stats.bd_reads),
+		atomic_read(&zram->stats.bd_writes));
+}
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
+/* Backends offered by comp_algorithm; each needs its CRYPTO_* option */
+static const char * const zram_backends[] = {
+	"lzo",
+	"lz4",
+	NULL
+};
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	for (i = 0; zram_backends[i]; i++) {
+		if (!strcmp(zram->compressor, zram_backends[i]))
+			sz += sprintf(buf + sz, "[%s] ", zram_backends[i]);
+		else if (crypto_has_comp(zram_backends[i], 0, 0))
+			sz += sprintf(buf + sz, "%s ", zram_backends[i]);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	sz += sprintf(buf + sz, "\n");
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char name[CRYPTO_MAX_ALG_NAME];
+	struct zram *zram = dev_to_zram(dev);
+
+	strlcpy(name, buf, sizeof(name));
+	strim(name);
+
+	if (!crypto_has_comp(name, 0, 0))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+	strlcpy(zram->compressor, name, sizeof(zram->compressor));
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t lat_hist_show(atomic_t *hist, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; i < ZRAM_LAT_HIST_BUCKETS; i++)
+		sz += sprintf(buf + sz, "%llu %u\n", 1ULL << i,
+				atomic_read(&hist[i]));
+
+	return sz;
+}
+
+static ssize_t queue_lat_hist_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return lat_hist_show(zram->stats.queue_lat, buf);
+}
+
+static ssize_t bio_size_hist_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	for (i = 0; i < ZRAM_BIO_HIST_BUCKETS; i++)
+		sz += sprintf(buf + sz, "%u %u\n", 1U << i,
+				atomic_read(&zram->stats.bio_size[i]));
+
+	return sz;
+}
+
+static ssize_t async_write_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->async_write);
+}
+
+static ssize_t async_write_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->async_write = !!val;
+	return len;
+}
+
+static ssize_t compr_lat_hist_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return lat_hist_show(zram->stats.compr_lat, buf);
+}
+
+static ssize_t decompr_lat_hist_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return lat_hist_show(zram->stats.decompr_lat, buf);
 }
 
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
@@ -232,9 +553,30 @@ static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dup_data_size, S_IRUGO, dup_data_size_show, NULL);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(use_dedup, S_IRUGO | S_IWUSR,
+		use_dedup_show, use_dedup_store);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(mem_pool_stats, S_IRUGO, mem_pool_stats_show, NULL);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(compr_lat_hist, S_IRUGO, compr_lat_hist_show, NULL);
+static DEVICE_ATTR(decompr_lat_hist, S_IRUGO, decompr_lat_hist_show, NULL);
+static DEVICE_ATTR(queue_lat_hist, S_IRUGO, queue_lat_hist_show, NULL);
+static DEVICE_ATTR(bio_size_hist, S_IRUGO, bio_size_hist_show, NULL);
+static DEVICE_ATTR(async_write, S_IRUGO | S_IWUSR,
+		async_write_show, async_write_store);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(bd_stat, S_IRUGO, bd_stat_show, NULL);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -245,9 +587,26 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dup_data_size.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_use_dedup.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_mem_pool_stats.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_compr_lat_hist.attr,
+	&dev_attr_decompr_lat_hist.attr,
+	&dev_attr_queue_lat_hist.attr,
+	&dev_attr_bio_size_hist.attr,
+	&dev_attr_async_write.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
+#endif
 	NULL,
 };
 
@@ -0,0 +1,663 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *handle_cachep;
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage that leaves the smallest
+ * fraction of it unused by whole objects.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_pages = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_pages = i;
+		}
+	}
+
+	return max_usedpc_pages;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+						struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max)
+		return ZS_FULL;
+	if (inuse <= 3 * max / fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+				enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+}
+
+/*
+ * Move a zspage to the list matching its current number of objects.
+ * Returns the new group; ZS_EMPTY zspages are left on no list and
+ * must be freed by the caller.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+						struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg != zspage->fullness) {
+		remove_zspage(class, zspage);
+		insert_zspage(class, zspage, newfg);
+	}
+
+	return newfg;
+}
+
+/* Returns a zspage with at least one free slot, fullest first */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+		return list_first_entry(&class->fullness_list[ZS_ALMOST_FULL],
+					struct zspage, list);
+
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+		return list_first_entry(&class->fullness_list[ZS_ALMOST_EMPTY],
+					struct zspage, list);
+
+	return NULL;
+}
+
+static void free_zspage_pages(struct zspage *zspage, int nr_pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	}
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+					struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			class->objs_per_zspage * sizeof(unsigned long),
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i]) {
+			free_zspage_pages(zspage, i);
+			kfree(zspage);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->handles[i] = ((unsigned long)(i + 1) << 1) |
+					ZS_OBJ_FREE_TAG;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->inuse = 0;
+	zspage->first_free = 0;
+	zspage->fullness = ZS_EMPTY;
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	struct size_class *class = zspage->class;
+
+	free_zspage_pages(zspage, class->pages_per_zspage);
+	kfree(zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/* Take the first free slot of a zspage for handle. Class lock held. */
+static unsigned int obj_alloc(struct zspage *zspage,
+				struct zs_handle *handle)
+{
+	struct size_class *class = zspage->class;
+	unsigned int idx = zspage->first_free;
+	unsigned int next = zspage->handles[idx] >> 1;
+
+	zspage->first_free = next < class->objs_per_zspage ?
+				next : ZS_NO_FREE;
+	zspage->handles[idx] = (unsigned long)handle;
+	zspage->inuse++;
+	class->objs_used++;
+
+	handle->zspage = zspage;
+	handle->idx = idx;
+
+	return idx;
+}
+
+/* Return slot idx of a zspage to its free chain. Class lock held. */
+static void obj_free(struct zspage *zspage, unsigned int idx)
+{
+	struct size_class *class = zspage->class;
+	unsigned int next = zspage->first_free;
+
+	if (next == ZS_NO_FREE)
+		next = class->objs_per_zspage;
+
+	zspage->handles[idx] = ((unsigned long)next << 1) | ZS_OBJ_FREE_TAG;
+	zspage->first_free = idx;
+	zspage->inuse--;
+	class->objs_used--;
+}
+
+static void obj_location(struct zspage *zspage, unsigned int idx,
+			struct page **page, unsigned long *offset)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+/*
+ * Copy size bytes starting at byte offset off of a zspage to or from
+ * buf, one page at a time.
+ */
+static void zs_copy_span(struct zspage *zspage, unsigned long off,
+			char *buf, int size, int to_buf)
+{
+	while (size) {
+		unsigned long offset = off & ~PAGE_MASK;
+		int len = min_t(int, size, PAGE_SIZE - offset);
+		char *addr;
+
+		addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER1);
+		if (to_buf)
+			memcpy(buf, addr + offset, len);
+		else
+			memcpy(addr + offset, buf, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		off += len;
+		size -= len;
+	}
+}
+
+/* Copy an object between two slots of the same class */
+static void zs_copy_object(struct zspage *dst, unsigned int didx,
+			struct zspage *src, unsigned int sidx)
+{
+	int size = src->class->size;
+	unsigned long soff = (unsigned long)sidx * size;
+	unsigned long doff = (unsigned long)didx * size;
+
+	while (size) {
+		unsigned long s_offset = soff & ~PAGE_MASK;
+		unsigned long d_offset = doff & ~PAGE_MASK;
+		int len = min_t(int, size, PAGE_SIZE - s_offset);
+		char *saddr, *daddr;
+
+		len = min_t(int, len, PAGE_SIZE - d_offset);
+
+		saddr = kmap_atomic(src->pages[soff >> PAGE_SHIFT], KM_USER0);
+		daddr = kmap_atomic(dst->pages[doff >> PAGE_SHIFT], KM_USER1);
+		memcpy(daddr + d_offset, saddr + s_offset, len);
+		kunmap_atomic(daddr, KM_USER1);
+		kunmap_atomic(saddr, KM_USER0);
+
+		soff += len;
+		doff += len;
+		size -= len;
+	}
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, for diagnostics only
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, fg;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = min_t(int, ZS_MIN_ALLOC_SIZE +
+					i * ZS_SIZE_CLASS_DELTA,
+					ZS_MAX_ALLOC_SIZE);
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		if (class->zspages)
+			pr_warning("zsmalloc: %s: freeing non-empty class "
+				"of size %d\n", pool->name, class->size);
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				unsigned int idx;
+
+				for (idx = 0; idx < class->objs_per_zspage;
+						idx++) {
+					unsigned long entry;
+
+					entry = zspage->handles[idx];
+					if (!(entry & ZS_OBJ_FREE_TAG))
+						kmem_cache_free(handle_cachep,
+							(void *)entry);
+				}
+				list_del(&zspage->list);
+				free_zspage(pool, zspage);
+			}
+		}
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, a handle to the allocated object is returned,
+ * otherwise 0. The handle stays valid when compaction moves the
+ * object; use zs_map_object() to access it.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(handle_cachep, pool->flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+	handle->flags = 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(handle_cachep, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj_alloc(zspage, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	/* The pin keeps compaction from moving the object under us */
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->flags);
+	zspage = handle->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(zspage, handle->idx);
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+
+	if (fg == ZS_EMPTY)
+		free_zspage(pool, zspage);
+
+	kmem_cache_free(handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the mapping will be used
+ *
+ * The object stays pinned, and preemption disabled, until
+ * zs_unmap_object() is called. Only one object can be mapped at a
+ * time on a CPU. The mapping is done with kmap_atomic, so nested
+ * atomic mappings taken after this one must be released first.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct zspage *zspage;
+	struct mapping_area *area;
+	struct page *page;
+	unsigned long offset;
+	int size;
+
+	BUG_ON(!handle);
+
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->flags);
+	zspage = handle->zspage;
+	size = zspage->class->size;
+	obj_location(zspage, handle->idx, &page, &offset);
+
+	area = &__get_cpu_var(zs_map_area);
+	area->mm = mm;
+
+	if (offset + size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(page, KM_USER1);
+		return area->vaddr + offset;
+	}
+
+	/* Object spans two pages: assemble it in the per-cpu buffer */
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_span(zspage, (unsigned long)handle->idx * size,
+				area->buf, size, 1);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		struct zspage *zspage = handle->zspage;
+		int size = zspage->class->size;
+
+		zs_copy_span(zspage, (unsigned long)handle->idx * size,
+				area->buf, size, 0);
+	}
+
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Move objects out of the least used zspages of a class into fuller
+ * ones and free the zspages that become empty. Objects that are
+ * mapped or being freed are skipped.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+					struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct list_head *almost_empty;
+
+	almost_empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	spin_lock(&class->lock);
+	while (!list_empty(almost_empty)) {
+		struct zspage *src, *dst;
+		unsigned int idx;
+
+		src = list_entry(almost_empty->prev, struct zspage, list);
+		/* Keep src from being picked as a destination */
+		remove_zspage(class, src);
+
+		for (idx = 0; idx < class->objs_per_zspage && src->inuse;
+				idx++) {
+			unsigned long entry = src->handles[idx];
+			struct zs_handle *handle;
+
+			if (entry & ZS_OBJ_FREE_TAG)
+				continue;
+
+			dst = find_get_zspage(class);
+			if (!dst)
+				break;
+
+			handle = (struct zs_handle *)entry;
+			if (!bit_spin_trylock(ZS_HANDLE_PIN_BIT, &handle->flags))
+				continue;
+
+			zs_copy_object(dst, obj_alloc(dst, handle), src, idx);
+			obj_free(src, idx);
+			fix_fullness_group(class, dst);
+
+			bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+		}
+
+		if (src->inuse) {
+			/* Pinned objects or no room elsewhere: give up */
+			insert_zspage(class, src,
+				get_fullness_group(class, src));
+			break;
+		}
+
+		src->fullness = ZS_EMPTY;
+		class->zspages--;
+		spin_unlock(&class->lock);
+
+		free_zspage(pool, src);
+		freed += class->pages_per_zspage;
+		cond_resched();
+
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Release partially used zspages
+ * @pool: pool to compact
+ *
+ * Must be called from process context. Returns the number of pages
+ * given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+int zs_get_nr_classes(void)
+{
+	return ZS_SIZE_CLASSES;
+}
+EXPORT_SYMBOL_GPL(zs_get_nr_classes);
+
+void zs_get_class_stats(struct zs_pool *pool, int class_idx,
+			struct zs_class_stats *stats)
+{
+	struct size_class *class = &pool->size_class[class_idx];
+
+	spin_lock(&class->lock);
+	stats->size = class->size;
+	stats->pages_per_zspage = class->pages_per_zspage;
+	stats->zspages = class->zspages;
+	stats->objs_allocated = class->zspages * class->objs_per_zspage;
+	stats->objs_used = class->objs_used;
+	spin_unlock(&class->lock);
+}
+EXPORT_SYMBOL_GPL(zs_get_class_stats);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).buf);
+		per_cpu(zs_map_area, cpu).buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf) {
+			zs_free_map_areas();
+			kmem_cache_destroy(handle_cachep);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Compressed page allocator");
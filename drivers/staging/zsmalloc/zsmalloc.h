@@ -0,0 +1,54 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/*
+ * How the caller is going to use a mapped object. Objects that span
+ * two pages are copied through a per-cpu buffer, and this lets map
+ * and unmap skip the copy that is not needed.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,	/* read and write */
+	ZS_MM_RO,	/* read only */
+	ZS_MM_WO	/* write only, contents are not read in */
+};
+
+struct zs_class_stats {
+	unsigned int size;		/* object size for this class */
+	unsigned int pages_per_zspage;
+	unsigned long zspages;		/* zspages currently allocated */
+	unsigned long objs_allocated;	/* object slots in those zspages */
+	unsigned long objs_used;	/* slots holding live objects */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+unsigned long zs_compact(struct zs_pool *pool);
+
+int zs_get_nr_classes(void);
+void zs_get_class_stats(struct zs_pool *pool, int class_idx,
+			struct zs_class_stats *stats);
+
+#endif
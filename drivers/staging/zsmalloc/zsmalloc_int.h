@@ -0,0 +1,128 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order pages
+ * holding objects of a single size class back to back. Objects may
+ * cross the boundary between two pages of the same zspage, which is
+ * what keeps internal fragmentation low for sizes that do not divide
+ * PAGE_SIZE. The number of pages is chosen per class to minimize the
+ * unused tail.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart, so at most that
+ * much (less one byte) is wasted per object by rounding up.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		(DIV_ROUND_UP(ZS_MAX_ALLOC_SIZE - \
+				ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA) + 1)
+
+/*
+ * Free object slots are chained through the handles[] array of their
+ * zspage. A free entry holds the index of the next free slot (or
+ * objs_per_zspage at the end of the chain) shifted left by one with
+ * the low bit set; live entries hold the (aligned) handle pointer,
+ * whose low bit is always clear.
+ */
+#define ZS_OBJ_FREE_TAG		1UL
+#define ZS_NO_FREE		(~0U)
+
+/* Bit in zs_handle.flags pinning the object at its current location */
+#define ZS_HANDLE_PIN_BIT	0
+
+/*
+ * A zspage is ZS_ALMOST_EMPTY when at most this fraction (in quarters)
+ * of its slots are used. Compaction moves objects out of almost empty
+ * zspages into fuller ones of the same class.
+ */
+static const int fullness_threshold_frac = 4;
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	/* Empty zspages are freed and never kept on a list */
+	ZS_EMPTY
+};
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	unsigned int inuse;		/* live objects */
+	unsigned int first_free;	/* first free slot or ZS_NO_FREE */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long handles[0];	/* one per slot, see ZS_OBJ_FREE_TAG */
+};
+
+/*
+ * Handles given out by zs_malloc() point to one of these. The extra
+ * indirection lets compaction move an object without its user
+ * noticing: only the handle is updated.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned int idx;
+	unsigned long flags;
+};
+
+struct size_class {
+	/*
+	 * Protects the fullness lists, the zspages on them and the
+	 * location stored in handles of objects in this class.
+	 */
+	spinlock_t lock;
+	int index;
+	int size;			/* object size */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	unsigned long zspages;
+	unsigned long objs_used;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	gfp_t flags;	/* allocation flags used when growing pool */
+	const char *name;
+	atomic_long_t pages_allocated;
+};
+
+/*
+ * Per-cpu state of the object currently mapped on this CPU. Objects
+ * spanning two pages are assembled in buf; those within one page are
+ * accessed in place through vaddr.
+ */
+struct mapping_area {
+	char *buf;
+	char *vaddr;
+	enum zs_mapmode mm;
+};
+
+#endif
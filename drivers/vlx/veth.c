@@ -35,6 +35,9 @@
 #include <linux/if_ether.h>
 #include <linux/rtnetlink.h>
 #include <linux/skbuff.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <nk/nkern.h>
 
 /*----- Local configuration -----*/
@@ -85,26 +88,32 @@
 typedef struct net_device_stats veth_stats;
 
     /*
-     * The communication relies on a data ring with VETH_RING_SIZE
-     * slots. The ring descriptor and the data slots are all allocated
-     * in the same shared memory segment. For performance, it is needed
-     * that data copied in the ring be aligned on cache lines. Therefore
-     * each slot, IP header and shared info structure are aligned.
+     * The communication relies on a ring with VETH_RING_SIZE slots and
+     * on VETH_BUF_NUM page sized buffers. The ring descriptor, the slot
+     * descriptors and the buffers are all allocated in the same shared
+     * memory segment, the buffers starting on a page boundary.
+     *
+     * The buffers belong to the consumer: it hands one to the producer
+     * in each slot, and keeps VETH_SPARE_NUM spare ones. A received
+     * frame is attached to the skb as a page fragment, and the consumer
+     * gives the producer a spare buffer in place of the one it took.
+     * The page is a spare buffer again once the network stack has
+     * released it, i.e. when its reference count is back to one. Small
+     * frames, or frames received while no spare buffer is left, are
+     * copied instead and the buffer stays in its slot.
      */
 typedef struct {
     volatile nku32_f	p_idx;		/* producer index */
     volatile nku32_f	freed_idx;	/* freed slot index */
     volatile nku32_f	c_idx;		/* consumer index */
     volatile nku8_f	stopped;	/* states: started/stopped */
+    volatile nku8_f	polling;	/* consumer polls, no rx xirq needed */
     nku16_f		size_unused;	/* size of ring (number of slots) */
 } VEthRingDesc;
 
-struct VEthLink;
-
 typedef struct {
-    nku32_f		len;
-    struct VEthLink*	link_unused;
-    void*		data;
+    nku32_f		len;		/* frame length */
+    nku32_f		buf;		/* index of the buffer holding it */
 } VEthSlotDesc;
 
 #if VETH_RING_SIZE & (VETH_RING_SIZE-1)
@@ -115,38 +124,53 @@ typedef struct {
 	(((x) + (VETH_L1_CACHE_BYTES -1)) & ~(VETH_L1_CACHE_BYTES -1))
 #define RING_INDEX_MASK		(VETH_RING_SIZE -1)
 
-    /*
-     * The skb_shared_info structure is located at the end of the skb data.
-     * The size of this structure may vary, depending on the Linux version.
-     * Because the SLOT_SIZE must always be the same, we cannot use
-     * sizeof, and therefore a fixed value is given and a test is done
-     * to verify that this value is great enough.
-     */
-#define SKB_SHINFO_SIZE     0x200
-
 #define VETH_STATIC_ASSERT(x) \
     extern char veth_static_assert [(x) ? 1 : -1]
 
-VETH_STATIC_ASSERT (sizeof (struct skb_shared_info) <= SKB_SHINFO_SIZE);
+#define VETH_BUF_SIZE	    4096
+#define VETH_SPARE_NUM	    (VETH_RING_SIZE / 2)
+#define VETH_BUF_NUM	    (VETH_RING_SIZE + VETH_SPARE_NUM)
 
-#define SLOT_HLEN_SIZE      RING_ALIGN (ETH_HLEN)
-#define SLOT_HLEN_PAD       (SLOT_HLEN_SIZE - ETH_HLEN)
-#define SLOT_DATA_SIZE      RING_ALIGN (ETH_HLEN + ETH_DATA_LEN + \
-					SKB_SHINFO_SIZE)
-#define DATA_SIZE           (VETH_RING_SIZE * (SLOT_HLEN_SIZE + SLOT_DATA_SIZE))
+VETH_STATIC_ASSERT (VETH_BUF_SIZE == PAGE_SIZE);
 
 #define SLOT_DESC_SIZE	    RING_ALIGN (sizeof (VEthSlotDesc))
 #define DESC_SIZE	    (VETH_RING_SIZE * SLOT_DESC_SIZE)
 
 #define RING_DESC_SIZE	    RING_ALIGN (sizeof (VEthRingDesc))
 
-#define PMEM_SIZE	    (RING_DESC_SIZE + DESC_SIZE + DATA_SIZE)
+#define BUF_OFFSET	    ALIGN (RING_DESC_SIZE + DESC_SIZE, VETH_BUF_SIZE)
+#define DATA_SIZE	    (VETH_BUF_NUM * VETH_BUF_SIZE)
+
+#define PMEM_SIZE	    (BUF_OFFSET + DATA_SIZE)
 
 #define RING_P_ROOM(rng)     (VETH_RING_SIZE - ((rng)->p_idx - (rng)->freed_idx))
 #define RING_IS_FULL(rng)    (((rng)->p_idx - (rng)->freed_idx) >= VETH_RING_SIZE)
 #define RING_IS_EMPTY(rng)   ((rng)->p_idx == (rng)->freed_idx)
 #define RING_C_ROOM(rng)     ((rng)->p_idx - (rng)->c_idx)
 
+#define RING_SLOT(rng,idx) \
+    ((VEthSlotDesc*) ((nku8_f*) (rng) + RING_DESC_SIZE + \
+		      ((idx) & RING_INDEX_MASK) * SLOT_DESC_SIZE))
+#define RING_BUF(rng,buf) \
+    ((nku8_f*) (rng) + BUF_OFFSET + (buf) * VETH_BUF_SIZE)
+
+    /*
+     * Frames up to VETH_RX_COPYBREAK bytes are copied on reception.
+     * Of larger ones, the first VETH_RX_HDR_LEN bytes (enough for the
+     * usual Ethernet, IP and TCP headers) are copied to the skb head
+     * and the rest is attached as a page fragment.
+     */
+#define VETH_RX_COPYBREAK   256
+#define VETH_RX_HDR_LEN	    128
+
+    /*
+     * A stopped producer is only woken up once this many slots are
+     * free, so that it is not sent one tx_ready xirq per frame.
+     */
+#define VETH_TX_WAKE_ROOM   (VETH_RING_SIZE / 4)
+
+#define VETH_NAPI_WEIGHT    64
+
 typedef struct {
     NkOsId	osid;
     NkXIrq	rx_xirq;	/* store rx xirq number */
@@ -179,6 +203,25 @@ typedef struct VEthLink {
     VEthLocal     local;
     VEthPeer      peer;
 
+	/*
+	 * Loopback stand-in: the peer is another veth device of this
+	 * OS, whose xirq handlers are called directly.
+	 */
+    struct VEthLink* loop;
+
+	/*
+	 * RX buffers, owned by the consumer. The slot descriptors are
+	 * in shared memory, so the buffer given in each slot is also
+	 * kept here rather than trusted from there.
+	 */
+    nku32_f	  rx_slot_buf [VETH_RING_SIZE];
+    nku32_f	  rx_spare [VETH_BUF_NUM];	/* free buffers */
+    unsigned int  rx_spare_num;
+    nku32_f	  rx_held [VETH_BUF_NUM];	/* buffers attached to skbs */
+    unsigned int  rx_held_num;
+    struct page*  rx_page [VETH_BUF_NUM];
+    _Bool	  rx_zcopy;	/* buffers can be attached to skbs */
+
     _Bool         enabled;
 } VEthLink;
 
@@ -189,273 +232,282 @@ typedef struct VEth {
     veth_stats		stats;	/* net statistics     */
     VEthLink		link;	/* link with peer OS data */
     struct net_device*	netdev;	/* Linux net device   */
+    struct napi_struct	napi;	/* RX polling */
 } VEth;
 
 static VEth*		veth_devices [VETH_MAX];
 static unsigned int	veth_devices_num;
 static NkXIrqId		veth_sysconf_id;
 
-#define VETH_PMEM_ID	4
+static int		veth_loopback;
+module_param_named (loopback, veth_loopback, bool, 0444);
+MODULE_PARM_DESC (loopback, "Create a pair of veth devices linked to each "
+			    "other, to measure throughput without a peer OS");
+
+static NkDevVlink*	veth_loop_vlinks;
+static VEthRingDesc*	veth_loop_rings [2];
+
+#define VETH_PMEM_ID	5	/* 4 was the former, slot based, layout */
 #define VETH_RXIRQ_ID	6
 #define VETH_TXIRQ_ID	7
 
 /*----- Data transfer -----*/
 
     /*
-     * Helper functions to push/pull data in rx or tx rings.
+     * Helper function to push data in tx rings.
+     * The frame is copied to the buffer the consumer gave in the slot.
      */
 
     static int
-veth_ring_push_data (VEthRingDesc* ring, const nku8_f* src,
-		     const unsigned int len)
+veth_ring_push_skb (VEthRingDesc* ring, const struct sk_buff* skb)
 {
-    const int		tmp = ring->p_idx - ring->c_idx;
+    const int		tmp = ring->p_idx - ring->freed_idx;
     VEthSlotDesc*	sd;
-    nku8_f*		dst;
+    nku32_f		buf;
 
     if ((unsigned) tmp > VETH_RING_SIZE) {
 	VETH_ERR ("tx ring corrupted\n");
 	return -EINVAL;
     }
-    dst = (nku8_f*) ring + RING_DESC_SIZE;
-    dst += (ring->p_idx & RING_INDEX_MASK) * SLOT_DESC_SIZE;
-
-    sd = (VEthSlotDesc*) dst;
-    sd->len = len;
-    VETH_OTRACE ("%p -> %p\n", src, sd->data);
-    memcpy ((char*) sd->data + SLOT_HLEN_PAD, src, len);
-
+    if (skb->len > VETH_BUF_SIZE) {
+	VETH_DTRACE ("frame too long (%u bytes)\n", skb->len);
+	return -EMSGSIZE;
+    }
+	/* Read the slot only once the consumer has freed it */
+    rmb();
+    sd  = RING_SLOT (ring, ring->p_idx);
+    buf = sd->buf;
+    if (buf >= VETH_BUF_NUM) {
+	VETH_ERR ("tx ring corrupted (buffer %u)\n", buf);
+	return -EINVAL;
+    }
+    VETH_OTRACE ("%p -> %u\n", skb->data, buf);
+    if (skb_copy_bits (skb, 0, RING_BUF (ring, buf), skb->len)) {
+	return -EFAULT;
+    }
+    sd->len = skb->len;
+	/* Publish the frame before the new producer index */
+    wmb();
     ring->p_idx++;
     return 0;
 }
 
-#ifdef CONFIG_SKB_DESTRUCTOR
     /*
-     * This code needs a modification in Linux sk_buff management.
-     * Files net/core/skbuff.c and include/linux/skbuff.h are modified
-     * to provide a destructor handler specific to the data buffer in
-     * each skb.
-     * Thanks to this feature, it is possible to avoid a second copy
-     * when receiving data. Instead, we link the buffer from the shared
-     * memory to the skb structure and when the last skb referencing
-     * this buffer is freed, we can free the buffer.
+     * Tx_ready xirq handler.
      */
+
     static void
-veth_free_buffer (void* data, VEthLink* link)
+veth_tx_ready_xirq (void* cookie, NkXIrq xirq)
 {
-    VEthSlotDesc* sd;
-    VEthRingDesc* rx_ring = link->rx_ring;
-    nku8_f*	  sptr;
-
-    VETH_OTRACE ("%d %d %d\n",
-		 rx_ring->p_idx, rx_ring->freed_idx, rx_ring->stopped);
-
-    sptr  = (nku8_f*) rx_ring + RING_DESC_SIZE;
-    sptr += (rx_ring->freed_idx & RING_INDEX_MASK) * SLOT_DESC_SIZE;
-    sd = (VEthSlotDesc*) sptr;
-    sd->data = data;
+    VEthLink*		link    = (VEthLink*) cookie;
+    VEth*		veth    = link->veth;
+    VEthRingDesc*	tx_ring = link->tx_ring;
 
-    rx_ring->freed_idx++;
-    if (rx_ring->stopped) {
-	nkops.nk_xirq_trigger (link->peer.tx_ready_xirq, link->peer.osid);
+    (void) xirq;
+    if (link->tx_link->c_state != NK_DEV_VLINK_ON) {
+	VETH_OTRACE ("Ignoring xirq %d from %d because vlink not On\n",
+		     xirq, link->tx_link->s_id);
+	return;
+    }
+    if (tx_ring->stopped && !RING_IS_FULL (tx_ring)) {
+	tx_ring->stopped = 0;
+	netif_wake_queue (veth->netdev);
     }
 }
 
+    /*
+     * Rx xirq handler: frames are received by the NAPI poll handler.
+     * While it is scheduled, the producer does not send this xirq.
+     */
+
     static void
-veth_free_skb (struct skb_shared_info* shinfo, void* cookie)
+veth_rx_xirq (void* cookie, NkXIrq xirq)
 {
-    veth_free_buffer (skb_shinfo_to_head (shinfo), cookie);
+    VEthLink*	link = (VEthLink*) cookie;
+    VEth*	veth = link->veth;
+
+    (void) xirq;
+    if (napi_schedule_prep (&veth->napi)) {
+	link->rx_ring->polling = 1;
+	__napi_schedule (&veth->napi);
+    }
 }
 
     /*
-     * Allocate an sk_buff structure for use in rx handler. This
-     * function is partly copied from alloc_skb in net/core/skbuff.c
+     * Notify the peer. A loopback peer is a local device,
+     * its handlers are called directly.
      */
-
-    static inline struct sk_buff*
-veth_alloc_skb (VEthLink* link)
+    static inline void
+veth_peer_rx_kick (VEthLink* link)
 {
-    const int		tmp = link->rx_ring->p_idx - link->rx_ring->c_idx;
-    struct skb_shared_info* shinfo;
-    struct sk_buff*	skb;
-    nku32_f		size;
-    VEthSlotDesc*	sd;
-    nku8_f*		src;
-
-    if ((unsigned) tmp > VETH_RING_SIZE) {
-	VETH_ERR ("rx ring corrupted\n");
-	return NULL;
+    if (link->loop) {
+	veth_rx_xirq (link->loop, 0);
+    } else {
+	nkops.nk_xirq_trigger (link->peer.rx_xirq, link->peer.osid);
     }
-    skb = ___alloc_skb (GFP_ATOMIC, -1);
-    if (!skb) return NULL;
-
-    memset (skb, 0, offsetof (struct sk_buff, tail));
-    atomic_set (&skb->users, 1);
-
-    src = (nku8_f*) link->rx_ring + RING_DESC_SIZE;
-    src += (link->rx_ring->c_idx & RING_INDEX_MASK) * SLOT_DESC_SIZE;
-    link->rx_ring->c_idx++;
-    sd = (VEthSlotDesc*) src;
-	/*
-	 * Get size and save link address and index for later
-	 * use in veth_free_skb. No need to check size coherency
-	 * as it will later be done in skb_put().
-	 */
-    size      = sd->len;
-
-    skb->len  = 0;
-    skb->head = sd->data;
-    skb->data = sd->data;
-    VETH_OTRACE ("%p\n", sd->data);
-    skb_reset_tail_pointer (skb);
-    skb->end  = skb->tail + RING_ALIGN (SLOT_HLEN_PAD + size);
-    skb->truesize = sizeof (struct sk_buff) + RING_ALIGN (SLOT_HLEN_PAD + size);
-
-    shinfo		= skb_shinfo (skb);
-    atomic_set (&shinfo->dataref, 1);
-    shinfo->nr_frags    = 0;
-    shinfo->gso_size    = 0;
-    shinfo->gso_segs    = 0;
-    shinfo->gso_type    = 0;
-    shinfo->ip6_frag_id = 0;
-    shinfo->frag_list   = NULL;
-    shinfo->destructor  = veth_free_skb;
-    shinfo->cookie      = link;
-    shinfo->orig	= NULL;
-    shinfo->len		= skb_end_pointer (skb) - skb->head;
-
-    skb_reserve (skb, SLOT_HLEN_PAD);
-    skb_put (skb, size);
-    return skb;
 }
-#else	/* not CONFIG_SKB_DESTRUCTOR */
 
-    /* Returned length comprises the 14 byte frame header */
+    static inline void
+veth_peer_tx_ready_kick (VEthLink* link)
+{
+    if (link->loop) {
+	veth_tx_ready_xirq (link->loop, 0);
+    } else {
+	nkops.nk_xirq_trigger (link->peer.tx_ready_xirq, link->peer.osid);
+    }
+}
 
-    static int
-veth_ring_pull_data (VEthRingDesc* ring, nku8_f* dst)
+    /*
+     * Buffers attached to skbs become spare buffers again
+     * once the network stack has dropped its page references.
+     */
+    static void
+veth_rx_reclaim (VEthLink* link)
 {
-    const int		tmp = ring->p_idx - ring->c_idx;
-    VEthSlotDesc*	sd;
-    nku8_f*		src;
-    unsigned int	len;
+    unsigned int i = 0;
 
-    if ((unsigned) tmp > VETH_RING_SIZE) {
-	VETH_ERR ("rx ring corrupted\n");
-	return -EINVAL;
-    }
-    src = (nku8_f*) ring + RING_DESC_SIZE;
-    src += (ring->c_idx & RING_INDEX_MASK) * SLOT_DESC_SIZE;
+    while (i < link->rx_held_num) {
+	const nku32_f buf = link->rx_held [i];
 
-    sd = (VEthSlotDesc*) src;
-    len = sd->len;
-    VETH_OTRACE ("%p <- %p\n", dst, sd->data);
-    memcpy (dst, (char*) sd->data + SLOT_HLEN_PAD, len);
+	if (page_count (link->rx_page [buf]) == 1) {
+	    link->rx_spare [link->rx_spare_num++] = buf;
+	    link->rx_held [i] = link->rx_held [--link->rx_held_num];
+	} else {
+	    i++;
+	}
+    }
+}
 
-    ring->c_idx++;
-    ring->freed_idx++;
+    /*
+     * Build an skb from the frame in the given rx ring slot.
+     * If the frame buffer gets attached to the skb, a spare
+     * buffer is given to the producer in the slot instead.
+     */
+    static struct sk_buff*
+veth_rx_frame (VEthLink* link, VEthSlotDesc* sd, unsigned int slot)
+{
+    VEth*		veth = link->veth;
+    const nku32_f	len  = sd->len;
+    nku32_f		buf  = link->rx_slot_buf [slot];
+    const nku8_f*	data = RING_BUF (link->rx_ring, buf);
+    struct sk_buff*	skb;
+    struct page*	page;
 
-    return len;
+    if (len < ETH_HLEN || len > VETH_BUF_SIZE) {
+	VETH_ERR ("rx ring corrupted (frame length %u)\n", len);
+	veth->stats.rx_length_errors++;
+	veth->stats.rx_errors++;
+	return NULL;
+    }
+    if (len <= VETH_RX_COPYBREAK || !link->rx_zcopy || !link->rx_spare_num) {
+	skb = netdev_alloc_skb_ip_align (veth->netdev, len);
+	if (!skb) {
+	    veth->stats.rx_dropped++;
+	    return NULL;
+	}
+	memcpy (skb_put (skb, len), data, len);
+	return skb;
+    }
+    skb = netdev_alloc_skb_ip_align (veth->netdev, VETH_RX_HDR_LEN);
+    if (!skb) {
+	veth->stats.rx_dropped++;
+	return NULL;
+    }
+    memcpy (skb_put (skb, VETH_RX_HDR_LEN), data, VETH_RX_HDR_LEN);
+
+    page = link->rx_page [buf];
+    get_page (page);
+    skb_fill_page_desc (skb, 0, page, VETH_RX_HDR_LEN, len - VETH_RX_HDR_LEN);
+    skb->len      += len - VETH_RX_HDR_LEN;
+    skb->data_len += len - VETH_RX_HDR_LEN;
+    skb->truesize += VETH_BUF_SIZE;
+
+    link->rx_held [link->rx_held_num++] = buf;
+    buf = link->rx_spare [--link->rx_spare_num];
+    link->rx_slot_buf [slot] = buf;
+    sd->buf = buf;
+    return skb;
 }
-#endif	/* not CONFIG_SKB_DESTRUCTOR */
 
     /*
-     * Rx xirq handler to receive frames as a rx_ring consumer
+     * NAPI poll handler to receive frames as a rx_ring consumer
      */
 
-    static void
-veth_rx_xirq (void* cookie, NkXIrq xirq)
+    static int
+veth_napi_poll (struct napi_struct* napi, int budget)
 {
-    VEthLink*		link = (VEthLink*) cookie;
-    VEth*		veth = link->veth;
+    VEth*		veth    = container_of (napi, VEth, napi);
+    VEthLink*		link    = &veth->link;
     struct net_device*	netdev  = veth->netdev;
     VEthRingDesc*	rx_ring = link->rx_ring;
     struct sk_buff*	skb;
-#ifndef CONFIG_SKB_DESTRUCTOR
-    int			len;
-#endif
+    int			done = 0;
+
+    veth_rx_reclaim (link);
 
-    while (RING_C_ROOM (rx_ring) > 0) {
+    while (done < budget && RING_C_ROOM (rx_ring) > 0) {
 	    /*
 	     * Check the peer state and account
 	     * error if it is not ON.
 	     */
 	if (link->rx_link->c_state != NK_DEV_VLINK_ON) {
 	    VETH_DTRACE ("peer driver not ready\n");
-	    netif_carrier_off (veth->netdev);
+	    netif_carrier_off (netdev);
 	    veth->stats.rx_errors++;
-	    return;
+	    napi_complete (napi);
+	    rx_ring->polling = 0;
+	    return done;
 	}
-#ifdef CONFIG_SKB_DESTRUCTOR
-	skb  = veth_alloc_skb (link);
-	if (!skb) {
-	    nku8_f* src = (nku8_f*) rx_ring + RING_DESC_SIZE;
-
-	    src += (rx_ring->c_idx & RING_INDEX_MASK) * SLOT_DESC_SIZE;
-	    rx_ring->c_idx++;
-	    veth_free_buffer (src, link);
-	    veth->stats.rx_dropped++;
-	    continue;
+	if ((unsigned) RING_C_ROOM (rx_ring) > VETH_RING_SIZE) {
+	    VETH_ERR ("rx ring corrupted\n");
+	    veth->stats.rx_errors++;
+	    rx_ring->c_idx     = rx_ring->p_idx;
+	    rx_ring->freed_idx = rx_ring->p_idx;
+	    break;
 	}
-#else
-	skb = dev_alloc_skb (ETH_FRAME_LEN); // over allocate (1514)
+	    /* Read the slot only once the producer has published it */
+	rmb();
+	skb = veth_rx_frame (link, RING_SLOT (rx_ring, rx_ring->c_idx),
+			     rx_ring->c_idx & RING_INDEX_MASK);
+	    /* Publish the slot buffer before freeing the slot */
+	wmb();
+	rx_ring->c_idx++;
+	rx_ring->freed_idx++;
+	done++;
+
 	if (!skb) {
-	    rx_ring->c_idx++;
-	    rx_ring->freed_idx++;
-	    veth->stats.rx_dropped++;
-	    continue;
+	    continue;	/* Error already accounted */
 	}
-	len = veth_ring_pull_data (rx_ring, skb->data);
-	if (len < 0) {
-		/* Error message already issued */
-	    dev_kfree_skb_any (skb);
-	    rx_ring->c_idx++;
-	    rx_ring->freed_idx++;
-	    veth->stats.rx_errors++;
-	    continue;
-	}
-	skb_put (skb, len);
-#endif
-	skb->dev       = veth->netdev;
-	skb->protocol  = eth_type_trans (skb, veth->netdev);
+	skb->protocol  = eth_type_trans (skb, netdev);
 	skb->ip_summed = CHECKSUM_UNNECESSARY;
 
 	veth->stats.rx_packets++;
 	veth->stats.rx_bytes += skb->len;
 
-	netif_rx (skb);
+	napi_gro_receive (napi, skb);
     }
     netdev->last_rx = jiffies;
-
-#ifndef CONFIG_SKB_DESTRUCTOR
-	/* Send tx ready xirq if producer ring was stopped (full) */
-    if (rx_ring->stopped) {
-	nkops.nk_xirq_trigger (link->peer.tx_ready_xirq, link->peer.osid);
-    }
-#endif
-}
-
-    /*
-     * Tx_ready xirq handler.
-     */
-
-    static void
-veth_tx_ready_xirq (void* cookie, NkXIrq xirq)
-{
-    VEthLink*		link    = (VEthLink*) cookie;
-    VEth*		veth    = link->veth;
-    VEthRingDesc*	tx_ring = link->tx_ring;
-
-    (void) xirq;
-    if (link->tx_link->c_state != NK_DEV_VLINK_ON) {
-	VETH_OTRACE ("Ignoring xirq %d from %d because vlink not On\n",
-		     xirq, link->tx_link->s_id);
-	return;
+	/*
+	 * Send tx ready xirq if producer ring was stopped (full),
+	 * once there is room for a batch of frames.
+	 */
+    mb();
+    if (rx_ring->stopped && RING_P_ROOM (rx_ring) >= VETH_TX_WAKE_ROOM) {
+	veth_peer_tx_ready_kick (link);
     }
-    if (tx_ring->stopped && !RING_IS_FULL (tx_ring)) {
-	tx_ring->stopped = 0;
-	netif_wake_queue (veth->netdev);
+    if (done < budget) {
+	napi_complete (napi);
+	rx_ring->polling = 0;
+	    /*
+	     * The producer may have seen the polling flag
+	     * set and not sent the rx xirq for a new frame.
+	     */
+	mb();
+	if (RING_C_ROOM (rx_ring) > 0 && napi_reschedule (napi)) {
+	    rx_ring->polling = 1;
+	}
     }
+    return done;
 }
 
     static _Bool
@@ -509,15 +561,21 @@ veth_ndo_open (struct net_device* dev)
     VETH_DTRACE ("%s\n", dev->name);
 	/* Reset stats */
     memset (&veth->stats, 0, sizeof veth->stats);
+    napi_enable (&veth->napi);
     netif_start_queue (dev);
+	/* Receive the frames queued while the interface was down */
+    veth_rx_xirq (&veth->link, 0);
     return 0;
 }
 
     static int
 veth_ndo_close (struct net_device* dev)
 {
+    VEth* veth = netdev_priv (dev);
+
     VETH_DTRACE ("%s\n", dev->name);
     netif_stop_queue (dev);
+    napi_disable (&veth->napi);
     return 0;
 }
 
@@ -542,23 +600,28 @@ veth_ndo_start_xmit (struct sk_buff* skb, struct net_device* dev)
 	return NETDEV_TX_OK;
     }
 	/*
-	 * Interface is overrunning.
+	 * Interface is overrunning. The queue is normally stopped
+	 * before the ring gets full, so this should be rare. The
+	 * skb is requeued by the caller and must not be freed.
 	 */
     if (RING_IS_FULL (tx_ring)) {
-	tx_ring->stopped = 1;
 	netif_stop_queue (dev);
-	veth->stats.tx_fifo_errors++;
-	dev_kfree_skb_any (skb);
-	return NETDEV_TX_BUSY;
+	tx_ring->stopped = 1;
+	mb();
+	if (RING_IS_FULL (tx_ring)) {
+	    veth->stats.tx_fifo_errors++;
+	    return NETDEV_TX_BUSY;
+	}
+	tx_ring->stopped = 0;
+	netif_start_queue (dev);
     }
 	/*
 	 * Everything is OK, start xmit.
 	 */
-    if (veth_ring_push_data (tx_ring, skb->data, skb->len)) {
-	netif_stop_queue (dev);
-	veth->stats.tx_fifo_errors++;
+    if (veth_ring_push_skb (tx_ring, skb)) {
+	veth->stats.tx_dropped++;
 	dev_kfree_skb_any (skb);
-	return NETDEV_TX_BUSY;
+	return NETDEV_TX_OK;
     }
 	/*
 	 * Statistics.
@@ -569,13 +632,27 @@ veth_ndo_start_xmit (struct sk_buff* skb, struct net_device* dev)
 
     dev_kfree_skb_any (skb);
 	/*
-	 * Ring is full, stop interface and avoid dropping packets
+	 * Ring is full, stop interface and avoid dropping packets.
+	 * The consumer may have freed slots before seeing the
+	 * stopped flag, so check again.
 	 */
     if (RING_IS_FULL (tx_ring)) {
-	tx_ring->stopped = 1;
 	netif_stop_queue (dev);
+	tx_ring->stopped = 1;
+	mb();
+	if (!RING_IS_FULL (tx_ring)) {
+	    tx_ring->stopped = 0;
+	    netif_wake_queue (dev);
+	}
+    }
+	/*
+	 * No rx xirq is needed while the consumer is polling:
+	 * it checks the ring again before it stops polling.
+	 */
+    mb();
+    if (!tx_ring->polling) {
+	veth_peer_rx_kick (link);
     }
-    nkops.nk_xirq_trigger (link->peer.rx_xirq, link->peer.osid);
     return NETDEV_TX_OK;
 }
 
@@ -610,7 +687,7 @@ veth_ndo_tx_timeout (struct net_device* dev)
 	 * to consume. Otherwise, wake up interface.
 	 */
     if (RING_IS_FULL (tx_ring)) {
-	nkops.nk_xirq_trigger (link->peer.rx_xirq, link->peer.osid);
+	veth_peer_rx_kick (link);
     } else {
 	tx_ring->stopped = 0;
         netif_wake_queue (dev);
@@ -736,7 +813,7 @@ veth_sysconf_xirq (void* cookie, NkXIrq xirq)
 	VEthLink* link         = &veth->link;
 	int	  need_sysconf = 0;
 
-	if (link->enabled) {
+	if (link->enabled && !link->loop) {
 	    need_sysconf  = veth_handshake_rx (link);
 	    need_sysconf |= veth_handshake_tx (link);
 
@@ -755,20 +832,48 @@ veth_sysconf_xirq (void* cookie, NkXIrq xirq)
     }
 }
 
+    static struct page*
+veth_buf_page (const void* addr)
+{
+    if (is_vmalloc_addr (addr)) {
+	return vmalloc_to_page (addr);
+    }
+    if (virt_addr_valid (addr)) {
+	return virt_to_page (addr);
+    }
+    return NULL;
+}
+
+    /*
+     * Give a buffer to each slot of the rx ring, the others are spare.
+     * Buffers are attached to skbs only if each of them is a page of
+     * its own, which the network stack can take references on.
+     */
     static void
-veth_rx_ring_data_init (VEthRingDesc* ring)
+veth_rx_ring_init (VEthLink* link)
 {
-    nku8_f*	sptr = (nku8_f*) ring + RING_DESC_SIZE;
-    nku8_f*	dptr = sptr + DESC_SIZE;
-    unsigned	i;
+    VEthRingDesc*	ring = link->rx_ring;
+    unsigned		i;
 
-    for (i = 0; i < VETH_RING_SIZE; i++) {
-	VEthSlotDesc* sd = (VEthSlotDesc*) sptr;
+    link->rx_zcopy = !((unsigned long) ring & ~PAGE_MASK);
+    for (i = 0; i < VETH_BUF_NUM; i++) {
+	struct page* page = veth_buf_page (RING_BUF (ring, i));
 
-	sd->data = dptr;
-	sptr += SLOT_DESC_SIZE;
-	dptr += SLOT_DATA_SIZE;
+	link->rx_page [i] = page;
+	if (!page || page_count (page) != 1) {
+	    link->rx_zcopy = 0;
+	}
     }
+    for (i = 0; i < VETH_RING_SIZE; i++) {
+	link->rx_slot_buf [i] = i;
+	RING_SLOT (ring, i)->buf = i;
+    }
+    link->rx_spare_num = 0;
+    for (i = VETH_RING_SIZE; i < VETH_BUF_NUM; i++) {
+	link->rx_spare [link->rx_spare_num++] = i;
+    }
+    link->rx_held_num = 0;
+    VETH_DTRACE ("zero-copy rx %s\n", link->rx_zcopy ? "on" : "off");
 }
 
     /*
@@ -802,9 +907,9 @@ veth_alloc_link_resources (VEthLink* link)
 	return -ENOMEM;
     }
     rx_ring->p_idx = 0;
-    veth_rx_ring_data_init (rx_ring);
 
     link->rx_ring    = rx_ring;
+    veth_rx_ring_init (link);
     link->local.osid = rx_link->s_id;
 
 	/* Allocate local rx xirq */
@@ -968,23 +1073,17 @@ static const struct net_device_ops veth_netdev_ops = {
 
     /*
      * Allocate VEth structure.
-     * Allocate Linux net_device structure.
+     * Allocate and register Linux net_device structure.
      */
     static int
-veth_dev_create (NkDevVlink* rx_link, NkDevVlink* tx_link)
+veth_dev_alloc (const char* name, NkDevVlink* rx_link, NkDevVlink* tx_link,
+		VEth** pveth)
 {
     struct net_device*	netdev;
     VEth*		veth;
     int			res;
-	/*
-	 * If creation fails before setting veth->enabled,
-	 * cleanup must be done here.
-	 */
-    if (veth_devices_num >= VETH_MAX) {
-	VETH_ERR ("too many veth devices.\n");
-	return -EINVAL;
-    }
-    netdev = alloc_netdev (sizeof (VEth), "rmnet%d", ether_setup);
+
+    netdev = alloc_netdev (sizeof (VEth), name, ether_setup);
     if (!netdev) {
 	VETH_ERR ("alloc_netdev() failed.\n");
 	return -ENOMEM;
@@ -1013,6 +1112,8 @@ veth_dev_create (NkDevVlink* rx_link, NkDevVlink* tx_link)
     netdev->irq                = 0;
     netdev->dma                = 0;
 
+    netif_napi_add (netdev, &veth->napi, veth_napi_poll, VETH_NAPI_WEIGHT);
+
 	/* register new Ethernet interface */
     if ((res = register_netdev (netdev))) {
 	VETH_ERR ("%s: register_netdev() failed (%d)\n", netdev->name, res);
@@ -1022,6 +1123,27 @@ veth_dev_create (NkDevVlink* rx_link, NkDevVlink* tx_link)
 	/* set link as disconnected */
     netif_carrier_off (netdev);
 
+    *pveth = veth;
+    return 0;
+}
+
+    static int
+veth_dev_create (NkDevVlink* rx_link, NkDevVlink* tx_link)
+{
+    VEth*		veth;
+    int			res;
+	/*
+	 * If creation fails before setting veth->enabled,
+	 * cleanup must be done here.
+	 */
+    if (veth_devices_num >= VETH_MAX) {
+	VETH_ERR ("too many veth devices.\n");
+	return -EINVAL;
+    }
+    res = veth_dev_alloc ("rmnet%d", rx_link, tx_link, &veth);
+    if (res) {
+	return res;	/* Error message already issued */
+    }
     res = veth_parse_mac_address (veth, rx_link);
     if (res) {
 	veth_dev_free (veth);
@@ -1049,6 +1171,69 @@ veth_dev_create (NkDevVlink* rx_link, NkDevVlink* tx_link)
     return 0;
 }
 
+    /*
+     * Create a pair of devices linked to each other through rings
+     * in local memory, to exercise the driver without a peer OS.
+     * The vlinks are local stand-ins whose states are set to ON
+     * once both devices are ready.
+     */
+    static int
+veth_loop_create (void)
+{
+    VEth*	veth [2];
+    unsigned	i;
+    int		res;
+
+    if (veth_devices_num + 2 > VETH_MAX) {
+	VETH_ERR ("too many veth devices.\n");
+	return -EINVAL;
+    }
+    veth_loop_vlinks = kzalloc (2 * sizeof (NkDevVlink), GFP_KERNEL);
+    if (!veth_loop_vlinks) {
+	return -ENOMEM;
+    }
+    for (i = 0; i < 2; i++) {
+	veth_loop_rings [i] = vmalloc (PMEM_SIZE);
+	if (!veth_loop_rings [i]) {
+	    VETH_ERR ("cannot allocate loopback ring (%d bytes).\n",
+		      PMEM_SIZE);
+	    return -ENOMEM;
+	}
+	memset (veth_loop_rings [i], 0, PMEM_SIZE);
+    }
+	/*
+	 * Device i receives through vlink and ring i,
+	 * and sends through the other ones.
+	 */
+    for (i = 0; i < 2; i++) {
+	res = veth_dev_alloc ("vethlo%d", &veth_loop_vlinks [i],
+			      &veth_loop_vlinks [1 - i], &veth [i]);
+	if (res) {
+	    return res;	/* Error message already issued */
+	}
+	veth [i]->link.rx_ring   = veth_loop_rings [i];
+	veth [i]->link.tx_ring   = veth_loop_rings [1 - i];
+	veth [i]->link.peer.osid = veth [i]->link.local.osid;
+	veth_rx_ring_init (&veth [i]->link);
+	random_ether_addr (veth [i]->netdev->dev_addr);
+
+	veth_devices [veth_devices_num] = veth [i];
+	veth_devices_num++;
+	veth [i]->link.enabled = 1;
+    }
+    veth [0]->link.loop = &veth [1]->link;
+    veth [1]->link.loop = &veth [0]->link;
+
+    for (i = 0; i < 2; i++) {
+	veth_loop_vlinks [i].s_state = NK_DEV_VLINK_ON;
+	veth_loop_vlinks [i].c_state = NK_DEV_VLINK_ON;
+    }
+    for (i = 0; i < 2; i++) {
+	veth_link_state_notify (&veth [i]->link);
+    }
+    return 0;
+}
+
     static NkDevVlink*
 veth_find_pair_vlink (NkDevVlink* l)
 {
@@ -1131,6 +1316,16 @@ veth_module_init (void)
 	    }
 	}
     }
+    if (veth_loopback) {
+	int res = veth_loop_create();
+
+	if (res) {
+		/* Error message already issued */
+	    veth_module_cleanup();
+	    return res;
+	}
+	device_count += 2;
+    }
     VETH_INFO ("%u device(s)\n", device_count);
     return 0;
 }
@@ -1160,11 +1355,20 @@ veth_module_cleanup (void)
 	    if (link->local.tx_ready_xid) {
 		nkops.nk_xirq_detach (link->local.tx_ready_xid);
 	    }
-	    veth_sysconf_trigger (link->peer.osid);
+	    if (!link->loop) {
+		veth_sysconf_trigger (link->peer.osid);
+	    }
 	    veth_dev_free (veth);
 	}
     }
     veth_devices_num = 0;
+	/* Loopback rings and vlinks are freed with both their devices */
+    for (minor = 0; minor < 2; minor++) {
+	vfree (veth_loop_rings [minor]);
+	veth_loop_rings [minor] = NULL;
+    }
+    kfree (veth_loop_vlinks);
+    veth_loop_vlinks = NULL;
 }
 
     static void __exit
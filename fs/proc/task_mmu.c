@@ -593,6 +593,46 @@ const struct file_operations proc_clear_refs_operations = {
 	.llseek		= noop_llseek,
 };
 
+#ifdef CONFIG_PROCESS_RECLAIM
+static ssize_t reclaim_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct task_struct *task;
+	char buffer[PROC_NUMBUF];
+	struct mm_struct *mm;
+
+	memset(buffer, 0, sizeof(buffer));
+	if (count > sizeof(buffer) - 1)
+		count = sizeof(buffer) - 1;
+	if (copy_from_user(buffer, buf, count))
+		return -EFAULT;
+	/* Only private anonymous pages can be reclaimed for now */
+	if (strcmp(strstrip(buffer), "anon"))
+		return -EINVAL;
+	task = get_proc_task(file->f_path.dentry->d_inode);
+	if (!task)
+		return -ESRCH;
+	/* Pushing a task's memory out is as intrusive as attaching to it */
+	if (!ptrace_may_access(task, PTRACE_MODE_ATTACH)) {
+		put_task_struct(task);
+		return -EACCES;
+	}
+	mm = get_task_mm(task);
+	if (mm) {
+		reclaim_mm_anon_pages(mm);
+		mmput(mm);
+	}
+	put_task_struct(task);
+
+	return count;
+}
+
+const struct file_operations proc_reclaim_operations = {
+	.write		= reclaim_write,
+	.llseek		= noop_llseek,
+};
+#endif
+
 struct pagemapread {
 	int pos, len;
 	u64 *buffer;
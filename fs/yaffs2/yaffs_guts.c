@@ -34,6 +34,7 @@
 #include "yaffs_allocator.h"
 
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
 #define YAFFS_GC_GOOD_ENOUGH 2
@@ -45,6 +46,8 @@
 
 static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 			     const u8 * buffer, int n_bytes, int use_reserve);
+static int yaffs_rd_data_obj(struct yaffs_obj *in, int inode_chunk,
+			     u8 * buffer);
 
 
 
@@ -146,6 +149,8 @@ u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 {
 	int i, j;
 
+	spin_lock(&dev->state_lock);
+
 	dev->temp_in_use++;
 	if (dev->temp_in_use > dev->max_temp)
 		dev->max_temp = dev->temp_in_use;
@@ -160,6 +165,7 @@ u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 					    dev->temp_buffer[j].line;
 			}
 
+			spin_unlock(&dev->state_lock);
 			return dev->temp_buffer[i].buffer;
 		}
 	}
@@ -176,7 +182,8 @@ u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 	 */
 
 	dev->unmanaged_buffer_allocs++;
-	return kmalloc(dev->data_bytes_per_chunk, GFP_NOFS);
+	spin_unlock(&dev->state_lock);
+	return kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 
 }
 
@@ -184,15 +191,20 @@ void yaffs_release_temp_buffer(struct yaffs_dev *dev, u8 * buffer, int line_no)
 {
 	int i;
 
+	spin_lock(&dev->state_lock);
+
 	dev->temp_in_use--;
 
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->temp_buffer[i].buffer == buffer) {
 			dev->temp_buffer[i].line = 0;
+			spin_unlock(&dev->state_lock);
 			return;
 		}
 	}
 
+	spin_unlock(&dev->state_lock);
+
 	if (buffer) {
 		/* assume it is an unmanaged one. */
 		yaffs_trace(YAFFS_TRACE_BUFFERS,
@@ -268,6 +280,70 @@ void yaffs_handle_chunk_error(struct yaffs_dev *dev,
 	}
 }
 
+/*
+ * Locking, see struct yaffs_dev.
+ * A task holding the block lock can hit a NAND read error, and handling
+ * it updates the block state. yaffs_block_lock_unless_held() lets the
+ * read path take the lock only when its caller does not hold it already.
+ */
+void yaffs_block_lock(struct yaffs_dev *dev)
+{
+	mutex_lock(&dev->block_lock);
+	dev->block_lock_owner = current;
+}
+
+void yaffs_block_unlock(struct yaffs_dev *dev)
+{
+	dev->block_lock_owner = NULL;
+	mutex_unlock(&dev->block_lock);
+}
+
+/* Returns 1 if the lock was taken, then the caller must release it */
+int yaffs_block_lock_unless_held(struct yaffs_dev *dev)
+{
+	if (dev->block_lock_owner == current)
+		return 0;
+	yaffs_block_lock(dev);
+	return 1;
+}
+
+void yaffs_obj_lock(struct yaffs_obj *obj)
+{
+	down_write(&obj->lock);
+	obj->lock_owner = current;
+}
+
+void yaffs_obj_unlock(struct yaffs_obj *obj)
+{
+	obj->lock_owner = NULL;
+	up_write(&obj->lock);
+}
+
+void yaffs_obj_lock_shared(struct yaffs_obj *obj)
+{
+	down_read(&obj->lock);
+}
+
+void yaffs_obj_unlock_shared(struct yaffs_obj *obj)
+{
+	up_read(&obj->lock);
+}
+
+/*
+ * For GC and cache writeback, which must not wait for an object and may
+ * be running on behalf of its writer. Returns 1 if obj is now locked and
+ * must be unlocked, 0 if the caller holds it already, -1 if it is busy.
+ */
+static int yaffs_obj_trylock(struct yaffs_obj *obj)
+{
+	if (obj->lock_owner == current)
+		return 0;
+	if (!down_write_trylock(&obj->lock))
+		return -1;
+	obj->lock_owner = current;
+	return 1;
+}
+
 static void yaffs_handle_chunk_wr_error(struct yaffs_dev *dev, int nand_chunk,
 					int erased_ok)
 {
@@ -604,6 +680,8 @@ static int yaffs_write_new_chunk(struct yaffs_dev *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_handle_chunk_wr_ok(dev, chunk, data, tags);
 
+		yaffs_summary_add(dev, tags, chunk);
+
 	} while (write_ok != YAFFS_OK &&
 		 (yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1394,38 +1472,80 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache 
  *   provides write buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The number of cache chunks per device is set by the cache-size mount
+ *   option (10 by default). Caches in use are hashed by object and chunk,
+ *   and all caches are kept on an LRU list with the free ones first, so
+ *   lookups and replacement stay cheap with a large cache.
+ *
+ *   The hash, the LRU list and the cache fields are protected by
+ *   dev->state_lock. The data of a cache belongs to the holder of its
+ *   object's lock. A writer marks the cache it fills as locked, so that
+ *   writers of other objects don't take it over meanwhile.
  */
 
+static struct hlist_head *yaffs_cache_bucket(struct yaffs_dev *dev,
+					     const struct yaffs_obj *obj,
+					     int chunk_id)
+{
+	return &dev->cache_hash[jhash_2words(obj->obj_id, chunk_id, 0) &
+				dev->cache_hash_mask];
+}
+
+/* Hook a cache up to a chunk of an object, or free it if obj is NULL. */
+static void yaffs_set_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
+			    struct yaffs_obj *obj, int chunk_id)
+{
+	if (cache->object)
+		hlist_del(&cache->hash_link);
+
+	cache->object = obj;
+	cache->chunk_id = chunk_id;
+	cache->dirty = 0;
+
+	if (obj) {
+		hlist_add_head(&cache->hash_link,
+			       yaffs_cache_bucket(dev, obj, chunk_id));
+		list_move_tail(&cache->lru, &dev->cache_lru);
+	} else {
+		list_move(&cache->lru, &dev->cache_lru);
+	}
+}
+
 static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
 	int i;
 	struct yaffs_cache *cache;
 	int n_caches = obj->my_dev->param.n_caches;
+	int dirty = 0;
 
-	for (i = 0; i < n_caches; i++) {
+	spin_lock(&dev->state_lock);
+	for (i = 0; i < n_caches && !dirty; i++) {
 		cache = &dev->cache[i];
 		if (cache->object == obj && cache->dirty)
-			return 1;
+			dirty = 1;
 	}
+	spin_unlock(&dev->state_lock);
 
-	return 0;
+	return dirty;
 }
 
+/* Write out the dirty caches of obj. The caller holds obj's lock. */
 static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
 	int lowest = -99;	/* Stop compiler whining. */
 	int i;
 	struct yaffs_cache *cache;
-	int chunk_written = 0;
+	int chunk_written;
 	int n_caches = obj->my_dev->param.n_caches;
 
 	if (n_caches > 0) {
 		do {
 			cache = NULL;
+			chunk_written = 0;
+
+			spin_lock(&dev->state_lock);
 
 			/* Find the dirty cache for this object with the lowest chunk id. */
 			for (i = 0; i < n_caches; i++) {
@@ -1441,17 +1561,24 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 			}
 
 			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+				cache->locked = 1;
+				spin_unlock(&dev->state_lock);
 
+				/* Write it out and free it up */
 				chunk_written =
 				    yaffs_wr_data_obj(cache->object,
 						      cache->chunk_id,
 						      cache->data,
 						      cache->n_bytes, 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+
+				spin_lock(&dev->state_lock);
+				dev->cache_writebacks++;
+				yaffs_set_cache(dev, cache, NULL, 0);
+				cache->locked = 0;
 			}
 
+			spin_unlock(&dev->state_lock);
+
 		} while (cache && chunk_written > 0);
 
 		if (cache)
@@ -1465,7 +1592,8 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 
 /*yaffs_flush_whole_cache(dev)
  *
- *
+ * Only called with the gross lock held exclusive, so nobody else holds
+ * the objects.
  */
 
 void yaffs_flush_whole_cache(struct yaffs_dev *dev)
@@ -1479,11 +1607,13 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev)
 	 */
 	do {
 		obj = NULL;
+		spin_lock(&dev->state_lock);
 		for (i = 0; i < n_caches && !obj; i++) {
 			if (dev->cache[i].object && dev->cache[i].dirty)
 				obj = dev->cache[i].object;
 
 		}
+		spin_unlock(&dev->state_lock);
 		if (obj)
 			yaffs_flush_file_cache(obj);
 
@@ -1491,75 +1621,85 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev)
 
 }
 
-/* Grab us a cache chunk for use.
+/* Grab us a cache chunk for use, hooked up to chunk_id of obj and locked.
  * First look for an empty one.
  * Then look for the least recently used non-dirty one.
  * Then look for the least recently used dirty one...., flush and look again.
+ * Flushing needs the lock of the dirty cache's object, so caches of objects
+ * busy elsewhere are passed over. Returns NULL if no cache could be had.
  */
-static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
+static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_obj *obj,
+						  int chunk_id)
 {
-	int i;
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
+	struct yaffs_cache *lru;
+	struct yaffs_obj *victim;
+	int victim_locked = 0;
+	int tries;
 
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
-	}
+	if (dev->param.n_caches < 1)
+		return NULL;
 
-	return NULL;
-}
+	for (tries = 0; tries < 2; tries++) {
+		cache = NULL;
+		victim = NULL;
 
-static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
-{
-	struct yaffs_cache *cache;
-	struct yaffs_obj *the_obj;
-	int usage;
-	int i;
-	int pushout;
+		spin_lock(&dev->state_lock);
 
-	if (dev->param.n_caches > 0) {
-		/* Try find a non-dirty one... */
+		/* Free caches are at the head of the LRU list */
+		list_for_each_entry(lru, &dev->cache_lru, lru) {
+			if (lru->locked)
+				continue;
+			if (!lru->dirty) {
+				cache = lru;
+				break;
+			}
+			victim_locked = yaffs_obj_trylock(lru->object);
+			if (victim_locked >= 0) {
+				victim = lru->object;
+				break;
+			}
+		}
 
-		cache = yaffs_grab_chunk_worker(dev);
+		if (victim || (cache && cache->object))
+			dev->cache_evictions++;
+		if (cache) {
+			yaffs_set_cache(dev, cache, obj, chunk_id);
+			cache->locked = 1;
+		}
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+		spin_unlock(&dev->state_lock);
 
-			/* With locking we can't assume we can use entry zero */
+		if (!victim)
+			return cache;
 
-			the_obj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+		/* Flush and try again */
+		yaffs_flush_file_cache(victim);
+		if (victim_locked > 0)
+			yaffs_obj_unlock(victim);
+	}
 
-			for (i = 0; i < dev->param.n_caches; i++) {
-				if (dev->cache[i].object &&
-				    !dev->cache[i].locked &&
-				    (dev->cache[i].last_use < usage
-				     || !cache)) {
-					usage = dev->cache[i].last_use;
-					the_obj = dev->cache[i].object;
-					cache = &dev->cache[i];
-					pushout = i;
-				}
-			}
+	return NULL;
+}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_flush_file_cache(the_obj);
-				cache = yaffs_grab_chunk_worker(dev);
-			}
+static struct yaffs_cache *yaffs_lookup_chunk_cache(const struct yaffs_obj *obj,
+						    int chunk_id)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
+	struct hlist_node *node;
 
+	if (dev->param.n_caches > 0) {
+		hlist_for_each_entry(cache, node,
+				     yaffs_cache_bucket(dev, obj, chunk_id),
+				     hash_link) {
+			if (cache->object == obj &&
+			    cache->chunk_id == chunk_id)
+				return cache;
 		}
-		return cache;
-	} else {
-		return NULL;
-        }
+	}
+	return NULL;
 }
 
 /* Find a cached chunk */
@@ -1567,18 +1707,16 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == obj &&
-			    dev->cache[i].chunk_id == chunk_id) {
-				dev->cache_hits++;
+	struct yaffs_cache *cache = NULL;
 
-				return &dev->cache[i];
-			}
-		}
+	if (dev->param.n_caches > 0) {
+		cache = yaffs_lookup_chunk_cache(obj, chunk_id);
+		if (cache)
+			dev->cache_hits++;
+		else
+			dev->cache_misses++;
 	}
-	return NULL;
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -1587,22 +1725,72 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 {
 
 	if (dev->param.n_caches > 0) {
-		if (dev->cache_last_use < 0 || dev->cache_last_use > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.n_caches; i++)
-				dev->cache[i].last_use = 0;
+		list_move_tail(&cache->lru, &dev->cache_lru);
 
-			dev->cache_last_use = 0;
-		}
+		if (is_write)
+			cache->dirty = 1;
+	}
+}
 
-		dev->cache_last_use++;
+/* Load a newly grabbed cache for a partial write.
+ * Chunks starting at or past the end of file hold no data yet, so they
+ * are not read. That way small appending writes (eg. journals) get
+ * combined in the cache without a NAND read for every chunk started.
+ */
+static void yaffs_fill_chunk_cache(struct yaffs_obj *in,
+				   struct yaffs_cache *cache)
+{
+	struct yaffs_dev *dev = in->my_dev;
+	u32 chunk_start = (cache->chunk_id - 1) * dev->data_bytes_per_chunk;
 
-		cache->last_use = dev->cache_last_use;
+	if (chunk_start >= in->variant.file_variant.file_size) {
+		memset(cache->data, 0, dev->data_bytes_per_chunk);
+		spin_lock(&dev->state_lock);
+		dev->cache_fills_skipped++;
+		spin_unlock(&dev->state_lock);
+	} else {
+		yaffs_rd_data_obj(in, cache->chunk_id, cache->data);
+	}
+}
 
-		if (is_write)
-			cache->dirty = 1;
+/* Find or grab the cache for a partial write to chunk_id of obj, and lock
+ * it. Returns NULL if the write has to go around the cache.
+ */
+static struct yaffs_cache *yaffs_write_chunk_cache(struct yaffs_obj *obj,
+						   int chunk_id)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
+	int space;
+
+	if (dev->param.n_caches < 1)
+		return NULL;
+
+	yaffs_block_lock(dev);
+	space = yaffs_check_alloc_available(dev, 1);
+	yaffs_block_unlock(dev);
+
+	spin_lock(&dev->state_lock);
+	cache = yaffs_find_chunk_cache(obj, chunk_id);
+	if (cache && !cache->dirty && !space) {
+		/* Drop the cache if it was a read cache item and
+		 * no space check has been made for it.
+		 */
+		yaffs_set_cache(dev, cache, NULL, 0);
+		cache = NULL;
+	} else if (cache) {
+		cache->locked = 1;
 	}
+	spin_unlock(&dev->state_lock);
+
+	/* If we can't find the data in the cache, then load the cache */
+	if (!cache && space) {
+		cache = yaffs_grab_chunk_cache(obj, chunk_id);
+		if (cache)
+			yaffs_fill_chunk_cache(obj, cache);
+	}
+
+	return cache;
 }
 
 /* Invalidate a single cache page.
@@ -1611,12 +1799,16 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
  */
 static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 {
-	if (object->my_dev->param.n_caches > 0) {
-		struct yaffs_cache *cache =
-		    yaffs_find_chunk_cache(object, chunk_id);
+	struct yaffs_dev *dev = object->my_dev;
+
+	if (dev->param.n_caches > 0) {
+		struct yaffs_cache *cache;
 
+		spin_lock(&dev->state_lock);
+		cache = yaffs_lookup_chunk_cache(object, chunk_id);
 		if (cache)
-			cache->object = NULL;
+			yaffs_set_cache(dev, cache, NULL, 0);
+		spin_unlock(&dev->state_lock);
 	}
 }
 
@@ -1630,10 +1822,12 @@ static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 
 	if (dev->param.n_caches > 0) {
 		/* Invalidate it. */
+		spin_lock(&dev->state_lock);
 		for (i = 0; i < dev->param.n_caches; i++) {
 			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
+				yaffs_set_cache(dev, &dev->cache[i], NULL, 0);
 		}
+		spin_unlock(&dev->state_lock);
 	}
 }
 
@@ -1688,22 +1882,26 @@ void yaffs_handle_defered_free(struct yaffs_obj *obj)
 
 static int yaffs_generic_obj_del(struct yaffs_obj *in)
 {
+	struct yaffs_dev *dev = in->my_dev;
 
 	/* First off, invalidate the file's data in the cache, without flushing. */
 	yaffs_invalidate_whole_cache(in);
 
-	if (in->my_dev->param.is_yaffs2 && (in->parent != in->my_dev->del_dir)) {
+	if (dev->param.is_yaffs2 && (in->parent != dev->del_dir)) {
 		/* Move to the unlinked directory so we have a record that it was deleted. */
-		yaffs_change_obj_name(in, in->my_dev->del_dir, _Y("deleted"), 0,
+		yaffs_change_obj_name(in, dev->del_dir, _Y("deleted"), 0,
 				      0);
 
 	}
 
 	yaffs_remove_obj_from_dir(in);
-	yaffs_chunk_del(in->my_dev, in->hdr_chunk, 1, __LINE__);
+
+	yaffs_block_lock(dev);
+	yaffs_chunk_del(dev, in->hdr_chunk, 1, __LINE__);
 	in->hdr_chunk = 0;
 
 	yaffs_free_obj(in);
+	yaffs_block_unlock(dev);
 	return YAFFS_OK;
 
 }
@@ -1849,6 +2047,7 @@ static struct yaffs_obj *yaffs_alloc_empty_obj(struct yaffs_dev *dev)
 		/* Now sweeten it up... */
 
 		memset(obj, 0, sizeof(struct yaffs_obj));
+		init_rwsem(&obj->lock);
 		obj->being_created = 1;
 
 		obj->my_dev = dev;
@@ -2380,6 +2579,12 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 
 	bi->block_state = YAFFS_BLOCK_STATE_DIRTY;
 
+	/* The summary chunk is not in use by any object, free it now */
+	if (bi->has_summary) {
+		bi->has_summary = 0;
+		dev->n_free_chunks++;
+	}
+
 	/* If this is the block being garbage collected then stop gc'ing this block */
 	if (block_no == dev->gc_block)
 		dev->gc_block = 0;
@@ -2439,6 +2644,13 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 
 
 
+/*
+ * Called with gc_lock and the block lock held. Other tasks run alongside
+ * with the gross lock shared, so a chunk can only be moved with its
+ * object locked. GC must not wait for an object, whose holder may be
+ * waiting for GC: if one is busy the pass ends there and the next pass
+ * carries on from that chunk.
+ */
 static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 {
 	int old_chunk;
@@ -2449,6 +2661,7 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 	int is_checkpt_block;
 	int matching_chunk;
 	int max_copies;
+	int obj_locked;
 
 	int chunks_before = yaffs_get_erased_chunks(dev);
 	int chunks_after;
@@ -2473,8 +2686,6 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 	bi->has_shrink_hdr = 0;	/* clear the flag so that the block can erase */
 
-	dev->gc_disable = 1;
-
 	if (is_checkpt_block || !yaffs_still_some_chunks(dev, block)) {
 		yaffs_trace(YAFFS_TRACE_TRACING,
 			"Collecting block %d that has no chunks in use",
@@ -2498,8 +2709,6 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 				/* This page is in use and might need to be copied off */
 
-				max_copies--;
-
 				mark_flash = 1;
 
 				yaffs_init_tags(&tags);
@@ -2509,6 +2718,16 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 				object = yaffs_find_by_number(dev, tags.obj_id);
 
+				obj_locked = object ? yaffs_obj_trylock(object) : 0;
+				if (obj_locked < 0) {
+					yaffs_trace(YAFFS_TRACE_GC,
+						"yaffs: GC of block %d waits for object %d",
+						block, tags.obj_id);
+					break;
+				}
+
+				max_copies--;
+
 				yaffs_trace(YAFFS_TRACE_GC_DETAIL,
 					"Collecting chunk in block %d, %d %d %d ",
 					dev->gc_chunk, tags.obj_id,
@@ -2571,19 +2790,6 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 						dev->n_clean_ups++;
 					}
 					mark_flash = 0;
-				} else if (0) {
-					/* Todo object && object->deleted && object->n_data_chunks == 0 */
-					/* Deleted object header with no data chunks.
-					 * Can be discarded and the file deleted.
-					 */
-					object->hdr_chunk = 0;
-					yaffs_free_tnode(object->my_dev,
-							 object->
-							 variant.file_variant.
-							 top);
-					object->variant.file_variant.top = NULL;
-					yaffs_generic_obj_del(object);
-
 				} else if (object) {
 					/* It's either a data chunk in a live file or
 					 * an ObjectHeader, so we're interested in it.
@@ -2664,6 +2870,8 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 					yaffs_chunk_del(dev, old_chunk,
 							mark_flash, __LINE__);
 
+				if (obj_locked > 0)
+					yaffs_obj_unlock(object);
 			}
 		}
 
@@ -2681,24 +2889,31 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 		bi->block_state = YAFFS_BLOCK_STATE_FULL;
 	} else {
 		/* The gc completed. */
-		/* Do any required cleanups */
+		/* Do any required cleanups. Deleting an object rewrites
+		 * headers, which takes the block lock. The objects are
+		 * deleted ones, only reachable by GC, which we hold.
+		 */
+		yaffs_block_unlock(dev);
 		for (i = 0; i < dev->n_clean_ups; i++) {
 			/* Time to delete the file too */
 			object =
 			    yaffs_find_by_number(dev, dev->gc_cleanup_list[i]);
 			if (object) {
+				yaffs_block_lock(dev);
 				yaffs_free_tnode(dev,
 						 object->variant.
 						 file_variant.top);
 				object->variant.file_variant.top = NULL;
+				yaffs_block_unlock(dev);
 				yaffs_trace(YAFFS_TRACE_GC,
 					"yaffs: About to finally delete object %d",
 					object->obj_id);
 				yaffs_generic_obj_del(object);
-				object->my_dev->n_deleted_files--;
+				dev->n_deleted_files--;
 			}
 
 		}
+		yaffs_block_lock(dev);
 
 		chunks_after = yaffs_get_erased_chunks(dev);
 		if (chunks_before >= chunks_after)
@@ -2710,8 +2925,6 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 		dev->n_clean_ups = 0;
 	}
 
-	dev->gc_disable = 0;
-
 	return ret_val;
 }
 
@@ -2895,11 +3108,15 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	if (dev->param.gc_control && (dev->param.gc_control(dev) & 1) == 0)
 		return YAFFS_OK;
 
-	if (dev->gc_disable) {
+	if (dev->gc_disable || dev->gc_owner == current) {
 		/* Bail out so we don't get recursive gc */
 		return YAFFS_OK;
 	}
 
+	mutex_lock(&dev->gc_lock);
+	dev->gc_owner = current;
+	yaffs_block_lock(dev);
+
 	/* This loop should pass the first time.
 	 * We'll only see looping here if the collection does not increase space.
 	 */
@@ -2971,6 +3188,10 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	} while ((dev->n_erased_blocks < dev->param.n_reserved_blocks) &&
 		 (dev->gc_block > 0) && (max_tries < 2));
 
+	yaffs_block_unlock(dev);
+	dev->gc_owner = NULL;
+	mutex_unlock(&dev->gc_lock);
+
 	return aggressive ? gc_ok : YAFFS_OK;
 }
 
@@ -2981,12 +3202,18 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
  */
 int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency)
 {
-	int erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+	int erased_chunks;
+	int n_free_chunks;
+
+	yaffs_block_lock(dev);
+	erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+	n_free_chunks = dev->n_free_chunks;
+	yaffs_block_unlock(dev);
 
 	yaffs_trace(YAFFS_TRACE_BACKGROUND, "Background gc %u", urgency);
 
 	yaffs_check_gc(dev, 1);
-	return erased_chunks > dev->n_free_chunks / 2;
+	return erased_chunks > n_free_chunks / 2;
 }
 
 /*-------------------- Data file manipulation -----------------*/
@@ -3091,14 +3318,18 @@ static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 
 	yaffs_check_gc(dev, 0);
 
+	yaffs_block_lock(dev);
+
 	/* Get the previous chunk at this location in the file if it exists.
 	 * If it does not exist then put a zero into the tree. This creates
 	 * the tnode now, rather than later when it is harder to clean up.
 	 */
 	prev_chunk_id = yaffs_find_chunk_in_file(in, inode_chunk, &prev_tags);
 	if (prev_chunk_id < 1 &&
-	    !yaffs_put_chunk_in_file(in, inode_chunk, 0, 0))
+	    !yaffs_put_chunk_in_file(in, inode_chunk, 0, 0)) {
+		yaffs_block_unlock(dev);
 		return 0;
+	}
 
 	/* Set up new tags */
 	yaffs_init_tags(&new_tags);
@@ -3127,6 +3358,7 @@ static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 
 		yaffs_verify_file_sane(in);
 	}
+	yaffs_block_unlock(dev);
 	return new_chunk_id;
 
 }
@@ -3491,6 +3723,7 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
 		yaffs_verify_oh(in, oh, &new_tags, 1);
 
 		/* Create new chunk in NAND */
+		yaffs_block_lock(dev);
 		new_chunk_id =
 		    yaffs_write_new_chunk(dev, buffer, &new_tags,
 					  (prev_chunk_id > 0) ? 1 : 0);
@@ -3517,6 +3750,7 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
 			}
 
 		}
+		yaffs_block_unlock(dev);
 
 		ret_val = new_chunk_id;
 
@@ -3566,50 +3800,33 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 		else
 			n_copy = dev->data_bytes_per_chunk - start;
 
-		cache = yaffs_find_chunk_cache(in, chunk);
-
-		/* If the chunk is already in the cache or it is less than a whole chunk
-		 * or we're using inband tags then use the cache (if there is caching)
-		 * else bypass the cache.
+		/*
+		 * Reads may run concurrently under the shared gross lock, so
+		 * the short op cache is only used when it already holds the
+		 * chunk (it may hold data not yet written). Anything else
+		 * is read from flash; the page cache above us caches reads.
 		 */
-		if (cache || n_copy != dev->data_bytes_per_chunk
-		    || dev->param.inband_tags) {
-			if (dev->param.n_caches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache =
-					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
-					cache->n_bytes = 0;
-				}
-
-				yaffs_use_cache(dev, cache, 0);
-
-				cache->locked = 1;
+		spin_lock(&dev->state_lock);
+		cache = yaffs_find_chunk_cache(in, chunk);
+		if (cache) {
+			yaffs_use_cache(dev, cache, 0);
+			memcpy(buffer, &cache->data[start], n_copy);
+		}
+		spin_unlock(&dev->state_lock);
 
-				memcpy(buffer, &cache->data[start], n_copy);
+		if (cache) {
+			/* Already copied */
+		} else if (n_copy != dev->data_bytes_per_chunk
+			   || dev->param.inband_tags) {
+			/* Read into the local buffer then copy.. */
 
-				cache->locked = 0;
-			} else {
-				/* Read into the local buffer then copy.. */
+			u8 *local_buffer =
+			    yaffs_get_temp_buffer(dev, __LINE__);
+			yaffs_rd_data_obj(in, chunk, local_buffer);
 
-				u8 *local_buffer =
-				    yaffs_get_temp_buffer(dev, __LINE__);
-				yaffs_rd_data_obj(in, chunk, local_buffer);
-
-				memcpy(buffer, &local_buffer[start], n_copy);
-
-				yaffs_release_temp_buffer(dev, local_buffer,
-							  __LINE__);
-			}
+			memcpy(buffer, &local_buffer[start], n_copy);
 
+			yaffs_release_temp_buffer(dev, local_buffer, __LINE__);
 		} else {
 
 			/* A full chunk. Read directly into the supplied buffer. */
@@ -3699,55 +3916,28 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 			/* An incomplete start or end chunk (or maybe both start and end chunk),
 			 * or we're using inband tags, so we want to use the cache buffers.
 			 */
-			if (dev->param.n_caches > 0) {
-				struct yaffs_cache *cache;
-				/* If we can't find the data in the cache, then load the cache */
-				cache = yaffs_find_chunk_cache(in, chunk);
-
-				if (!cache
-				    && yaffs_check_alloc_available(dev, 1)) {
-					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
+			struct yaffs_cache *cache =
+			    yaffs_write_chunk_cache(in, chunk);
+
+			if (cache) {
+				memcpy(&cache->data[start], buffer, n_copy);
+				cache->n_bytes = n_writeback;
+
+				if (write_trhrough)
+					chunk_written =
+					    yaffs_wr_data_obj(in,
+							      cache->chunk_id,
+							      cache->data,
+							      cache->n_bytes, 1);
+
+				spin_lock(&dev->state_lock);
+				yaffs_use_cache(dev, cache, 1);
+				if (write_trhrough)
 					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
-				} else if (cache &&
-					   !cache->dirty &&
-					   !yaffs_check_alloc_available(dev,
-									1)) {
-					/* Drop the cache if it was a read cache item and
-					 * no space check has been made for it.
-					 */
-					cache = NULL;
-				}
-
-				if (cache) {
-					yaffs_use_cache(dev, cache, 1);
-					cache->locked = 1;
-
-					memcpy(&cache->data[start], buffer,
-					       n_copy);
-
-					cache->locked = 0;
-					cache->n_bytes = n_writeback;
-
-					if (write_trhrough) {
-						chunk_written =
-						    yaffs_wr_data_obj
-						    (cache->object,
-						     cache->chunk_id,
-						     cache->data,
-						     cache->n_bytes, 1);
-						cache->dirty = 0;
-					}
-
-				} else {
-					chunk_written = -1;	/* fail the write */
-				}
+				cache->locked = 0;
+				spin_unlock(&dev->state_lock);
 			} else {
-				/* An incomplete start or end chunk (or maybe both start and end chunk)
+				/* No cache to be had.
 				 * Read into the local buffer then copy, then copy over and write back.
 				 */
 
@@ -3857,7 +4047,9 @@ void yaffs_resize_file_down(struct yaffs_obj *obj, loff_t new_size)
 
 	yaffs_addr_to_chunk(dev, new_size, &new_full, &new_partial);
 
+	yaffs_block_lock(dev);
 	yaffs_prune_chunks(obj, new_size);
+	yaffs_block_unlock(dev);
 
 	if (new_partial != 0) {
 		int last_chunk = 1 + new_full;
@@ -3876,7 +4068,9 @@ void yaffs_resize_file_down(struct yaffs_obj *obj, loff_t new_size)
 
 	obj->variant.file_variant.file_size = new_size;
 
+	yaffs_block_lock(dev);
 	yaffs_prune_tree(dev, &obj->variant.file_variant);
+	yaffs_block_unlock(dev);
 }
 
 int yaffs_resize_file(struct yaffs_obj *in, loff_t new_size)
@@ -4764,6 +4958,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	int init_failed = 0;
 	unsigned x;
 	int bits;
+	u32 t_start = Y_TIME_US();
+	u32 t_phase;
 
 	yaffs_trace(YAFFS_TRACE_TRACING, "yaffs: yaffs_guts_initialise()" );
 
@@ -4776,6 +4972,10 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		return YAFFS_FAIL;
 	}
 
+	mutex_init(&dev->gc_lock);
+	mutex_init(&dev->block_lock);
+	spin_lock_init(&dev->state_lock);
+
 	dev->internal_start_block = dev->param.start_block;
 	dev->internal_end_block = dev->param.end_block;
 	dev->block_offset = 0;
@@ -4939,38 +5139,58 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	dev->cache_hash = NULL;
 	dev->gc_cleanup_list = NULL;
+	dev->sum_tags = NULL;
+
+	if (!init_failed && !yaffs_summary_init(dev))
+		init_failed = 1;
 
 	if (!init_failed && dev->param.n_caches > 0) {
 		int i;
 		void *buf;
-		int cache_bytes =
-		    dev->param.n_caches * sizeof(struct yaffs_cache);
+		int cache_bytes;
+		int n_buckets;
 
 		if (dev->param.n_caches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.n_caches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		cache_bytes = dev->param.n_caches * sizeof(struct yaffs_cache);
+		n_buckets = roundup_pow_of_two(dev->param.n_caches);
+
 		dev->cache = kmalloc(cache_bytes, GFP_NOFS);
+		dev->cache_hash = kmalloc(n_buckets * sizeof(struct hlist_head),
+					  GFP_NOFS);
+		dev->cache_hash_mask = n_buckets - 1;
+		INIT_LIST_HEAD(&dev->cache_lru);
 
 		buf = (u8 *) dev->cache;
+		if (!dev->cache_hash)
+			buf = NULL;
 
 		if (dev->cache)
 			memset(dev->cache, 0, cache_bytes);
 
+		for (i = 0; dev->cache_hash && i < n_buckets; i++)
+			INIT_HLIST_HEAD(&dev->cache_hash[i]);
+
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
 			dev->cache[i].dirty = 0;
+			INIT_HLIST_NODE(&dev->cache[i].hash_link);
+			list_add_tail(&dev->cache[i].lru, &dev->cache_lru);
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->cache_last_use = 0;
 	}
 
 	dev->cache_hits = 0;
+	dev->cache_misses = 0;
+	dev->cache_evictions = 0;
+	dev->cache_writebacks = 0;
+	dev->cache_fills_skipped = 0;
 
 	if (!init_failed) {
 		dev->gc_cleanup_list =
@@ -4994,12 +5214,16 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	if (!init_failed) {
 		/* Now scan the flash. */
 		if (dev->param.is_yaffs2) {
+			t_phase = Y_TIME_US();
 			if (yaffs2_checkpt_restore(dev)) {
 				yaffs_check_obj_details_loaded(dev->root_dir);
 				yaffs_trace(YAFFS_TRACE_CHECKPOINT | YAFFS_TRACE_MOUNT,
-					"yaffs: restored from checkpoint"
-					);
+					"yaffs: restored from checkpoint in %u us",
+					Y_TIME_US() - t_phase);
 			} else {
+				yaffs_trace(YAFFS_TRACE_MOUNT,
+					"yaffs: no checkpoint, tried for %u us",
+					Y_TIME_US() - t_phase);
 
 				/* Clean up the mess caused by an aborted checkpoint load
 				 * and scan backwards.
@@ -5032,10 +5256,14 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 			init_failed = 1;
                 }
 
+		t_phase = Y_TIME_US();
 		yaffs_strip_deleted_objs(dev);
 		yaffs_fix_hanging_objs(dev);
 		if (dev->param.empty_lost_n_found)
 			yaffs_empty_l_n_f(dev);
+		yaffs_trace(YAFFS_TRACE_MOUNT,
+			"yaffs: object clean up took %u us",
+			Y_TIME_US() - t_phase);
 	}
 
 	if (init_failed) {
@@ -5065,6 +5293,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 
 	yaffs_trace(YAFFS_TRACE_TRACING,
 	  "yaffs: yaffs_guts_initialise() done.");
+	yaffs_trace(YAFFS_TRACE_MOUNT,
+		"yaffs: mounted in %u us", Y_TIME_US() - t_start);
 	return YAFFS_OK;
 
 }
@@ -5088,8 +5318,13 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 			dev->cache = NULL;
 		}
 
+		kfree(dev->cache_hash);
+		dev->cache_hash = NULL;
+
 		kfree(dev->gc_cleanup_list);
 
+		yaffs_summary_deinit(dev);
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			kfree(dev->temp_buffer[i].buffer);
 
@@ -5116,7 +5351,7 @@ int yaffs_count_free_chunks(struct yaffs_dev *dev)
 		case YAFFS_BLOCK_STATE_FULL:
 			n_free +=
 			    (dev->param.chunks_per_block - blk->pages_in_use +
-			     blk->soft_del_pages);
+			     blk->soft_del_pages - blk->has_summary);
 			break;
 		default:
 			break;
@@ -5136,24 +5371,28 @@ int yaffs_get_n_free_chunks(struct yaffs_dev *dev)
 	int blocks_for_checkpt;
 	int i;
 
+	yaffs_block_lock(dev);
 	n_free = dev->n_free_chunks;
+	/* Now we figure out how much to reserve for the checkpoint and report that... */
+	blocks_for_checkpt = yaffs_calc_checkpt_blocks_required(dev);
+	yaffs_block_unlock(dev);
+
 	n_free += dev->n_deleted_files;
 
 	/* Now count the number of dirty chunks in the cache and subtract those */
 
+	spin_lock(&dev->state_lock);
 	for (n_dirty_caches = 0, i = 0; i < dev->param.n_caches; i++) {
 		if (dev->cache[i].dirty)
 			n_dirty_caches++;
 	}
+	spin_unlock(&dev->state_lock);
 
 	n_free -= n_dirty_caches;
 
 	n_free -=
 	    ((dev->param.n_reserved_blocks + 1) * dev->param.chunks_per_block);
 
-	/* Now we figure out how much to reserve for the checkpoint and report that... */
-	blocks_for_checkpt = yaffs_calc_checkpt_blocks_required(dev);
-
 	n_free -= (blocks_for_checkpt * dev->param.chunks_per_block);
 
 	if (n_free < 0)
@@ -80,10 +80,11 @@
 
 /* Pseudo object ids for checkpointing */
 #define YAFFS_OBJECTID_SB_HEADER	0x10
+#define YAFFS_OBJECTID_SUMMARY		0x11
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -110,10 +111,11 @@
 struct yaffs_cache {
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
+	struct hlist_node hash_link;	/* In dev->cache_hash while object is set */
+	struct list_head lru;	/* In dev->cache_lru, least recently used first */
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
-	int locked;		/* Can't push out or flush while locked. */
+	int locked;		/* In use by a writer: can't push out or flush. */
 	u8 *data;
 };
 
@@ -281,6 +283,7 @@ struct yaffs_block_info {
 
 #ifdef CONFIG_YAFFS_YAFFS2
 	u32 has_shrink_hdr:1;	/* This block has at least one shrink object header */
+	u32 has_summary:1;	/* The last chunk of this block holds a block summary */
 	u32 seq_number;		/* block sequence number for yaffs2 */
 #endif
 
@@ -404,6 +407,14 @@ struct yaffs_obj {
 
 	struct yaffs_dev *my_dev;	/* The device I'm on */
 
+	/*
+	 * Guards the data of a file (tnode tree, size, short op cache
+	 * entries) and the object header. Readers take it shared, writers
+	 * and GC exclusive. lock_owner is the task holding it exclusive.
+	 */
+	struct rw_semaphore lock;
+	struct task_struct *lock_owner;
+
 	struct list_head hash_link;	/* list of objects in this hash bucket */
 
 	struct list_head hard_links;	/* all the equivalent hard linked objects */
@@ -506,8 +517,10 @@ struct yaffs_param {
 	/* reserved blocks on NOR and RAM. */
 
 	int n_caches;		/* If <= 0, then short op caching is disabled, else
-				 * the number of short op caches (don't use too many).
-				 * 10 to 20 is a good bet.
+				 * the number of short op caches, at most
+				 * YAFFS_MAX_SHORT_OP_CACHES.
+				 * 10 to 20 is a good bet, more helps small
+				 * scattered writes.
 				 */
 	int use_nand_ecc;	/* Flag to decide whether or not to use NANDECC on data (yaffs1) */
 	int no_tags_ecc;	/* Flag to decide whether or not to do ECC on packed tags (yaffs2) */
@@ -574,6 +587,8 @@ struct yaffs_param {
 	int auto_unicode;
 #endif
 	int always_check_erased;	/* Force chunk erased check always on */
+
+	int enable_summary;	/* yaffs2 only: write block summaries, see yaffs_summary.c */
 };
 
 struct yaffs_dev {
@@ -685,7 +700,9 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct hlist_head *cache_hash;	/* Caches in use, by object and chunk */
+	u32 cache_hash_mask;
+	struct list_head cache_lru;	/* All caches, free ones first */
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted files live. */
@@ -702,6 +719,30 @@ struct yaffs_dev {
 	int unmanaged_buffer_allocs;
 	int unmanaged_buffer_deallocs;
 
+	/*
+	 * Locking. Only namespace and whole device operations take the gross
+	 * lock (see yaffs_vfs.c) exclusive. File I/O, fsync and background GC
+	 * take it shared and then lock the objects they work on.
+	 *
+	 * gc_lock serialises garbage collection. GC only ever trylocks
+	 * objects, and leaves a chunk for the next pass if its object is busy.
+	 *
+	 * block_lock protects the allocator and block state: block info and
+	 * chunk bits, the allocation block, n_free_chunks, tnode and object
+	 * memory, summaries and checkpoint validity. NAND writes and erases
+	 * happen under it.
+	 *
+	 * state_lock protects what readers touch: temp buffers, the short op
+	 * cache lists and stats.
+	 *
+	 * Order: gross, object, gc_lock, block_lock, state_lock.
+	 */
+	struct mutex gc_lock;
+	struct task_struct *gc_owner;
+	struct mutex block_lock;
+	struct task_struct *block_lock_owner;
+	spinlock_t state_lock;
+
 	/* yaffs2 runtime stuff */
 	unsigned seq_number;	/* Sequence number of currently allocating block */
 	unsigned oldest_dirty_seq;
@@ -713,6 +754,12 @@ struct yaffs_dev {
 	/* Dirty directory handling */
 	struct list_head dirty_dirs;	/* List of dirty directories */
 
+	/* Block summaries */
+	int chunks_per_summary;	/* Data chunks covered by a summary, 0 if not writing them */
+	struct yaffs_summary_tags *sum_tags;	/* Summary of the allocation block */
+	int sum_block;		/* Block sum_tags is being collected for, -1 if none */
+	int sum_next;		/* Next chunk expected in sum_block */
+
 	/* Statistcs */
 	u32 n_page_writes;
 	u32 n_page_reads;
@@ -734,6 +781,10 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 cache_misses;
+	u32 cache_evictions;	/* Caches reused for another chunk */
+	u32 cache_writebacks;	/* Dirty caches written to NAND */
+	u32 cache_fills_skipped;	/* Partial writes past EOF, not read first */
 
 };
 
@@ -870,6 +921,15 @@ int yaffs_check_ff(u8 * buffer, int n_bytes);
 void yaffs_handle_chunk_error(struct yaffs_dev *dev,
 			      struct yaffs_block_info *bi);
 
+void yaffs_block_lock(struct yaffs_dev *dev);
+void yaffs_block_unlock(struct yaffs_dev *dev);
+int yaffs_block_lock_unless_held(struct yaffs_dev *dev);
+
+void yaffs_obj_lock(struct yaffs_obj *obj);
+void yaffs_obj_unlock(struct yaffs_obj *obj);
+void yaffs_obj_lock_shared(struct yaffs_obj *obj);
+void yaffs_obj_unlock_shared(struct yaffs_obj *obj);
+
 u8 *yaffs_get_temp_buffer(struct yaffs_dev *dev, int line_no);
 void yaffs_release_temp_buffer(struct yaffs_dev *dev, u8 * buffer, int line_no);
 
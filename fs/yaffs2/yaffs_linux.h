@@ -17,6 +17,7 @@
 #define __YAFFS_LINUX_H__
 
 #include "yportenv.h"
+#include <linux/rwsem.h>
 
 struct yaffs_linux_context {
 	struct list_head context_list;	/* List of these we have mounted */
@@ -24,10 +25,7 @@ struct yaffs_linux_context {
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
-	struct mutex gross_lock;	/* Gross locking mutex*/
-	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
-				 * at compile time so we have to allocate it.
-				 */
+	struct rw_semaphore gross_lock;	/* Gross lock, shared by file I/O */
 	struct list_head search_contexts;
 	void (*put_super_fn) (struct super_block * sb);
 
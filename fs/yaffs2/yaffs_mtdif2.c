@@ -125,7 +125,7 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 		ops.len = data ? dev->data_bytes_per_chunk : packed_tags_size;
 		ops.ooboffs = 0;
 		ops.datbuf = data;
-		ops.oobbuf = yaffs_dev_to_lc(dev)->spare_buffer;
+		ops.oobbuf = packed_tags_ptr;
 		retval = mtd->read_oob(mtd, addr, &ops);
 	}
 
@@ -138,12 +138,8 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 			yaffs_unpack_tags2_tags_only(tags, pt2tp);
 		}
 	} else {
-		if (tags) {
-			memcpy(packed_tags_ptr,
-			       yaffs_dev_to_lc(dev)->spare_buffer,
-			       packed_tags_size);
+		if (tags)
 			yaffs_unpack_tags2(tags, &pt, !dev->param.no_tags_ecc);
-		}
 	}
 
 	if (local_data)
@@ -152,12 +148,16 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 	if (tags && retval == -EBADMSG
 	    && tags->ecc_result == YAFFS_ECC_RESULT_NO_ERROR) {
 		tags->ecc_result = YAFFS_ECC_RESULT_UNFIXED;
+		spin_lock(&dev->state_lock);
 		dev->n_ecc_unfixed++;
+		spin_unlock(&dev->state_lock);
 	}
 	if (tags && retval == -EUCLEAN
 	    && tags->ecc_result == YAFFS_ECC_RESULT_NO_ERROR) {
 		tags->ecc_result = YAFFS_ECC_RESULT_FIXED;
+		spin_lock(&dev->state_lock);
 		dev->n_ecc_fixed++;
+		spin_unlock(&dev->state_lock);
 	}
 	if (retval == 0)
 		return YAFFS_OK;
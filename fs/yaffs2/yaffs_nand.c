@@ -25,7 +25,9 @@ int yaffs_rd_chunk_tags_nand(struct yaffs_dev *dev, int nand_chunk,
 
 	int realigned_chunk = nand_chunk - dev->chunk_offset;
 
+	spin_lock(&dev->state_lock);
 	dev->n_page_reads++;
+	spin_unlock(&dev->state_lock);
 
 	/* If there are no tags provided, use local tags to get prioritised gc working */
 	if (!tags)
@@ -41,10 +43,15 @@ int yaffs_rd_chunk_tags_nand(struct yaffs_dev *dev, int nand_chunk,
 	if (tags && tags->ecc_result > YAFFS_ECC_RESULT_NO_ERROR) {
 
 		struct yaffs_block_info *bi;
+		int locked;
+
 		bi = yaffs_get_block_info(dev,
 					  nand_chunk /
 					  dev->param.chunks_per_block);
+		locked = yaffs_block_lock_unless_held(dev);
 		yaffs_handle_chunk_error(dev, bi);
+		if (locked)
+			yaffs_block_unlock(dev);
 	}
 
 	return result;
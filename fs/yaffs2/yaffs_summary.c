@@ -0,0 +1,226 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * With summaries enabled the tags of the data chunks of a block are also
+ * collected in RAM as the block is written. Once all but the last chunk
+ * of the block have been written, they are written out in the last
+ * chunk, so that a scan can get the tags of the whole block from one
+ * chunk instead of reading every chunk's tags.
+ *
+ * The summary chunk carries tags with obj_id YAFFS_OBJECTID_SUMMARY. It
+ * is not part of any object: it is not counted in pages_in_use nor set
+ * in the chunk bitmap. It is accounted for by bi->has_summary and gets
+ * freed when the block is erased.
+ *
+ * Blocks that were not written in order from their first chunk (eg. due
+ * to a write failure or a remount) just don't get a summary and are
+ * scanned the slow way.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_trace.h"
+#include "yaffs_nand.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_tagsvalidity.h"
+
+static int yaffs_summary_bytes(struct yaffs_dev *dev)
+{
+	return (dev->param.chunks_per_block - 1) *
+	    sizeof(struct yaffs_summary_tags);
+}
+
+static u32 yaffs_summary_sum(const u8 *p, int n_bytes)
+{
+	u32 sum = 0;
+
+	while (n_bytes--)
+		sum = ((sum << 1) | (sum >> 31)) + *p++;
+
+	return sum;
+}
+
+int yaffs_summary_init(struct yaffs_dev *dev)
+{
+	int n_bytes = yaffs_summary_bytes(dev);
+
+	dev->chunks_per_summary = 0;
+	dev->sum_block = -1;
+	dev->sum_tags = NULL;
+
+	if (!dev->param.is_yaffs2 || !dev->param.enable_summary)
+		return YAFFS_OK;
+
+	if (sizeof(struct yaffs_summary_header) + n_bytes >
+	    dev->data_bytes_per_chunk) {
+		yaffs_trace(YAFFS_TRACE_ALWAYS,
+			"yaffs: block summary does not fit in a chunk, not using summaries");
+		return YAFFS_OK;
+	}
+
+	dev->sum_tags = kmalloc(n_bytes, GFP_NOFS);
+	if (!dev->sum_tags)
+		return YAFFS_FAIL;
+
+	dev->chunks_per_summary = dev->param.chunks_per_block - 1;
+
+	return YAFFS_OK;
+}
+
+void yaffs_summary_deinit(struct yaffs_dev *dev)
+{
+	kfree(dev->sum_tags);
+	dev->sum_tags = NULL;
+	dev->chunks_per_summary = 0;
+}
+
+static void yaffs_summary_write(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	int n_bytes = yaffs_summary_bytes(dev);
+	int chunk = blk * dev->param.chunks_per_block + dev->chunks_per_summary;
+	u8 *buffer;
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.seq = bi->seq_number;
+	hdr.sum = yaffs_summary_sum((u8 *) dev->sum_tags, n_bytes);
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+	memset(buffer, 0xff, dev->data_bytes_per_chunk);
+	memcpy(buffer, &hdr, sizeof(hdr));
+	memcpy(buffer + sizeof(hdr), dev->sum_tags, n_bytes);
+
+	yaffs_init_tags(&tags);
+	tags.obj_id = YAFFS_OBJECTID_SUMMARY;
+	tags.chunk_id = 1;
+	tags.n_bytes = sizeof(hdr) + n_bytes;
+
+	if (yaffs_wr_chunk_tags_nand(dev, chunk, buffer, &tags) == YAFFS_OK) {
+		bi->has_summary = 1;
+		dev->n_free_chunks--;
+	} else {
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"**>> yaffs summary write of block %d failed", blk);
+		yaffs_handle_chunk_error(dev, bi);
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+}
+
+/*
+ * yaffs_summary_add() records the tags of a data chunk that was written
+ * successfully, and writes the summary out once the block is full.
+ */
+void yaffs_summary_add(struct yaffs_dev *dev, const struct yaffs_ext_tags *tags,
+		       int chunk_in_nand)
+{
+	int blk = chunk_in_nand / dev->param.chunks_per_block;
+	int c = chunk_in_nand % dev->param.chunks_per_block;
+	struct yaffs_summary_tags *sum_tags;
+
+	if (!dev->chunks_per_summary)
+		return;
+
+	if (c == 0) {
+		dev->sum_block = blk;
+	} else if (blk != dev->sum_block || c != dev->sum_next) {
+		/* Not filled in order, no summary for this block */
+		dev->sum_block = -1;
+		return;
+	}
+
+	sum_tags = &dev->sum_tags[c];
+	sum_tags->obj_id = tags->obj_id;
+	sum_tags->chunk_id = tags->chunk_id;
+	sum_tags->n_bytes = tags->n_bytes;
+
+	dev->sum_next = c + 1;
+
+	if (dev->sum_next == dev->chunks_per_summary &&
+	    dev->alloc_block == blk) {
+		yaffs_summary_write(dev, blk);
+		dev->sum_block = -1;
+		yaffs_skip_rest_of_block(dev);
+	}
+}
+
+/*
+ * yaffs_summary_read() reads the summary in the last chunk of a block
+ * into buffer. Returns the summary tags, or NULL if there is no valid
+ * summary.
+ */
+struct yaffs_summary_tags *yaffs_summary_read(struct yaffs_dev *dev, int blk,
+					      u8 *buffer)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	int n_bytes = yaffs_summary_bytes(dev);
+	int chunk = (blk + 1) * dev->param.chunks_per_block - 1;
+
+	if (sizeof(hdr) + n_bytes > dev->data_bytes_per_chunk)
+		return NULL;
+
+	yaffs_rd_chunk_tags_nand(dev, chunk, buffer, &tags);
+
+	if (!tags.chunk_used ||
+	    tags.ecc_result == YAFFS_ECC_RESULT_UNFIXED ||
+	    tags.obj_id != YAFFS_OBJECTID_SUMMARY ||
+	    tags.n_bytes != sizeof(hdr) + n_bytes)
+		return NULL;
+
+	memcpy(&hdr, buffer, sizeof(hdr));
+
+	if (hdr.version != YAFFS_SUMMARY_VERSION ||
+	    hdr.block != blk ||
+	    hdr.seq != bi->seq_number ||
+	    hdr.sum != yaffs_summary_sum(buffer + sizeof(hdr), n_bytes)) {
+		yaffs_trace(YAFFS_TRACE_SCAN,
+			"Block %d has a bad summary, scanning it", blk);
+		return NULL;
+	}
+
+	return (struct yaffs_summary_tags *)(buffer + sizeof(hdr));
+}
+
+/*
+ * yaffs_summary_fetch() fills in the tags of a chunk from the summary of
+ * its block. Object headers carry extra information in their tags that
+ * is not in the summary, so their tags are still read from NAND.
+ */
+void yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+			 const struct yaffs_summary_tags *sum_tags, int blk,
+			 int chunk_in_block)
+{
+	const struct yaffs_summary_tags *st = &sum_tags[chunk_in_block];
+
+	if (st->chunk_id == 0) {
+		yaffs_rd_chunk_tags_nand(dev,
+				blk * dev->param.chunks_per_block +
+				chunk_in_block, NULL, tags);
+		return;
+	}
+
+	yaffs_init_tags(tags);
+	tags->chunk_used = 1;
+	tags->obj_id = st->obj_id;
+	tags->chunk_id = st->chunk_id;
+	tags->n_bytes = st->n_bytes;
+	tags->ecc_result = YAFFS_ECC_RESULT_NO_ERROR;
+	tags->seq_number = yaffs_get_block_info(dev, blk)->seq_number;
+}
@@ -0,0 +1,51 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+/*
+ * Block summaries
+ */
+
+#ifndef __YAFFS_SUMMARY_H__
+#define __YAFFS_SUMMARY_H__
+
+#include "yaffs_guts.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+/* Tags of one data chunk as recorded in a summary */
+struct yaffs_summary_tags {
+	u32 obj_id;
+	u32 chunk_id;
+	u32 n_bytes;
+};
+
+struct yaffs_summary_header {
+	u32 version;
+	u32 block;
+	u32 seq;
+	u32 sum;	/* Checksum of the summary tags */
+};
+
+int yaffs_summary_init(struct yaffs_dev *dev);
+void yaffs_summary_deinit(struct yaffs_dev *dev);
+void yaffs_summary_add(struct yaffs_dev *dev, const struct yaffs_ext_tags *tags,
+		       int chunk_in_nand);
+struct yaffs_summary_tags *yaffs_summary_read(struct yaffs_dev *dev, int blk,
+					      u8 *buffer);
+void yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+			 const struct yaffs_summary_tags *sum_tags, int blk,
+			 int chunk_in_block);
+
+#endif
@@ -266,11 +266,15 @@ static int yaffs_rd_chunk_nand(struct yaffs_dev *dev,
 static void yaffs_handle_rd_data_error(struct yaffs_dev *dev, int nand_chunk)
 {
 	int flash_block = nand_chunk / dev->param.chunks_per_block;
+	int locked;
 
 	/* Mark the block for retirement */
+	locked = yaffs_block_lock_unless_held(dev);
 	yaffs_get_block_info(dev,
 			     flash_block + dev->block_offset)->needs_retiring =
 	    1;
+	if (locked)
+		yaffs_block_unlock(dev);
 	yaffs_trace(YAFFS_TRACE_ERROR | YAFFS_TRACE_BAD_BLOCKS,
 		"**>>Block %d marked for retirement",
 		flash_block);
@@ -124,14 +124,35 @@ static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 static void yaffs_gross_lock(struct yaffs_dev *dev)
 {
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking %p", current);
-	mutex_lock(&(yaffs_dev_to_lc(dev)->gross_lock));
+	down_write(&(yaffs_dev_to_lc(dev)->gross_lock));
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked %p", current);
 }
 
 static void yaffs_gross_unlock(struct yaffs_dev *dev)
 {
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs unlocking %p", current);
-	mutex_unlock(&(yaffs_dev_to_lc(dev)->gross_lock));
+	up_write(&(yaffs_dev_to_lc(dev)->gross_lock));
+}
+
+/*
+ * The gross lock is taken exclusive only by operations on the namespace
+ * and on the whole device. Reading and writing file data, fsync, reading
+ * symlinks, statfs and background GC take it shared, and lock the object
+ * they work on (yaffs_obj_lock()): readers shared, writers exclusive.
+ * The guts lock the allocator and block state themselves, see struct
+ * yaffs_dev.
+ */
+static void yaffs_gross_lock_shared(struct yaffs_dev *dev)
+{
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking shared %p", current);
+	down_read(&(yaffs_dev_to_lc(dev)->gross_lock));
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked shared %p", current);
+}
+
+static void yaffs_gross_unlock_shared(struct yaffs_dev *dev)
+{
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs unlocking shared %p", current);
+	up_read(&(yaffs_dev_to_lc(dev)->gross_lock));
 }
 
 static void yaffs_fill_inode_from_obj(struct inode *inode,
@@ -452,9 +473,11 @@ static int yaffs_sync_object(struct file *file, int datasync)
 	dev = obj->my_dev;
 
 	yaffs_trace(YAFFS_TRACE_OS | YAFFS_TRACE_SYNC, "yaffs_sync_object");
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
+	yaffs_obj_lock(obj);
 	yaffs_flush_file(obj, 1, datasync);
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock(obj);
+	yaffs_gross_unlock_shared(dev);
 	return 0;
 }
 /*
@@ -921,11 +944,13 @@ static int yaffs_file_flush(struct file *file, fl_owner_t id)
 	  	"yaffs_file_flush object %d (%s)",
 		obj->obj_id, obj->dirty ? "dirty" : "clean");
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
+	yaffs_obj_lock(obj);
 
 	yaffs_flush_file(obj, 1, 0);
 
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock(obj);
+	yaffs_gross_unlock_shared(dev);
 
 	return 0;
 }
@@ -1021,11 +1046,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user * buffer,
 
 	struct yaffs_dev *dev = yaffs_dentry_to_obj(dentry)->my_dev;
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
 
 	alias = yaffs_get_symlink_alias(yaffs_dentry_to_obj(dentry));
 
-	yaffs_gross_unlock(dev);
+	yaffs_gross_unlock_shared(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -1041,10 +1066,10 @@ static void *yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	void *ret;
 	struct yaffs_dev *dev = yaffs_dentry_to_obj(dentry)->my_dev;
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
 
 	alias = yaffs_get_symlink_alias(yaffs_dentry_to_obj(dentry));
-	yaffs_gross_unlock(dev);
+	yaffs_gross_unlock_shared(dev);
 
 	if (!alias) {
 		ret = ERR_PTR(-ENOMEM);
@@ -1153,12 +1178,14 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
+	yaffs_obj_lock_shared(obj);
 
 	ret = yaffs_file_rd(obj, pg_buf,
 			    pg->index << PAGE_CACHE_SHIFT, PAGE_CACHE_SIZE);
 
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock_shared(obj);
+	yaffs_gross_unlock_shared(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -1250,7 +1277,8 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 
 	obj = yaffs_inode_to_obj(inode);
 	dev = obj->my_dev;
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
+	yaffs_obj_lock(obj);
 
 	yaffs_trace(YAFFS_TRACE_OS,
 		"yaffs_writepage at %08x, size %08x",
@@ -1268,7 +1296,8 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 		"writepag1: obj = %05x, ino = %05x",
 		(int)obj->variant.file_variant.file_size, (int)inode->i_size);
 
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock(obj);
+	yaffs_gross_unlock_shared(dev);
 
 	kunmap(page);
 	set_page_writeback(page);
@@ -1297,11 +1326,11 @@ static ssize_t yaffs_hold_space(struct file *f)
 
 	dev = obj->my_dev;
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
 
 	n_free_chunks = yaffs_get_n_free_chunks(dev);
 
-	yaffs_gross_unlock(dev);
+	yaffs_gross_unlock_shared(dev);
 
 	return (n_free_chunks > 20) ? 1 : 0;
 }
@@ -1315,9 +1344,9 @@ static void yaffs_release_space(struct file *f)
 
 	dev = obj->my_dev;
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
 
-	yaffs_gross_unlock(dev);
+	yaffs_gross_unlock_shared(dev);
 }
 
 static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
@@ -1387,7 +1416,8 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 
 	dev = obj->my_dev;
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
+	yaffs_obj_lock(obj);
 
 	inode = f->f_dentry->d_inode;
 
@@ -1425,7 +1455,8 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 		}
 
 	}
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock(obj);
+	yaffs_gross_unlock_shared(dev);
 	return (n_written == 0) && (n > 0) ? -ENOSPC : n_written;
 }
 
@@ -1468,7 +1499,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 	yaffs_trace(YAFFS_TRACE_OS, "yaffs_statfs");
 
-	yaffs_gross_lock(dev);
+	yaffs_gross_lock_shared(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -1520,7 +1551,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_gross_unlock(dev);
+	yaffs_gross_unlock_shared(dev);
 	return 0;
 }
 
@@ -1647,16 +1678,18 @@ static int yaffs_bg_thread_fn(void *data)
 		if (try_to_freeze())
 			continue;
 
-		yaffs_gross_lock(dev);
-
 		now = jiffies;
 
 		if (time_after(now, next_dir_update) && yaffs_bg_enable) {
+			yaffs_gross_lock(dev);
 			yaffs_update_dirty_dirs(dev);
+			yaffs_gross_unlock(dev);
 			next_dir_update = now + HZ;
 		}
 
 		if (time_after(now, next_gc) && yaffs_bg_enable) {
+			/* GC runs alongside file I/O, see yaffs_gc_block() */
+			yaffs_gross_lock_shared(dev);
 			if (!dev->is_checkpointed) {
 				urgency = yaffs_bg_gc_urgency(dev);
 				gc_result = yaffs_bg_gc(dev, urgency);
@@ -1673,8 +1706,8 @@ static int yaffs_bg_thread_fn(void *data)
 				 */
 				next_gc = next_dir_update;
                         }
+			yaffs_gross_unlock_shared(dev);
 		}
-		yaffs_gross_unlock(dev);
 		expires = next_dir_update;
 		if (time_before(next_gc, expires))
 			expires = next_gc;
@@ -1769,6 +1802,9 @@ struct yaffs_options {
 	int lazy_loading_overridden;
 	int empty_lost_and_found;
 	int empty_lost_and_found_overridden;
+	int summary;
+	int n_caches;
+	int n_caches_overridden;
 };
 
 #define MAX_OPT_LEN 30
@@ -1816,6 +1852,12 @@ static int yaffs_parse_options(struct yaffs_options *options,
 		} else if (!strcmp(cur_opt, "empty-lost-and-found-on")) {
 			options->empty_lost_and_found = 1;
 			options->empty_lost_and_found_overridden = 1;
+		} else if (!strcmp(cur_opt, "summary")) {
+			options->summary = 1;
+		} else if (!strncmp(cur_opt, "cache-size=", 11)) {
+			options->n_caches =
+			    simple_strtoul(cur_opt + 11, NULL, 10);
+			options->n_caches_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
@@ -1985,11 +2027,6 @@ static void yaffs_put_super(struct super_block *sb)
 	list_del_init(&(yaffs_dev_to_lc(dev)->context_list));
 	mutex_unlock(&yaffs_context_lock);
 
-	if (yaffs_dev_to_lc(dev)->spare_buffer) {
-		kfree(yaffs_dev_to_lc(dev)->spare_buffer);
-		yaffs_dev_to_lc(dev)->spare_buffer = NULL;
-	}
-
 	kfree(dev);
 }
 
@@ -2221,6 +2258,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->total_bytes_per_chunk = YAFFS_BYTES_PER_CHUNK;
 	param->n_reserved_blocks = 5;
 	param->n_caches = (options.no_cache) ? 0 : 10;
+	if (!options.no_cache && options.n_caches_overridden)
+		param->n_caches = options.n_caches;
 	param->inband_tags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2244,6 +2283,13 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	if (options.tags_ecc_overridden)
 		param->no_tags_ecc = !options.tags_ecc_on;
 
+	/*
+	 * Block summaries are always used when scanning. Writing them is
+	 * optional since yaffs without summary support would take the
+	 * summary chunks for file data.
+	 */
+	param->enable_summary = options.summary;
+
 #ifdef CONFIG_YAFFS_EMPTY_LOST_AND_FOUND
 	param->empty_lost_n_found = 1;
 #endif
@@ -2267,8 +2313,6 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 		param->read_chunk_tags_fn = nandmtd2_read_chunk_tags;
 		param->bad_block_fn = nandmtd2_mark_block_bad;
 		param->query_block_fn = nandmtd2_query_block;
-		yaffs_dev_to_lc(dev)->spare_buffer = 
-		                kmalloc(mtd->oobsize, GFP_NOFS);
 		param->is_yaffs2 = 1;
 		param->total_bytes_per_chunk = mtd->writesize;
 		param->chunks_per_block = mtd->erasesize / mtd->writesize;
@@ -2325,7 +2369,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	INIT_LIST_HEAD(&(yaffs_dev_to_lc(dev)->search_contexts));
 	param->remove_obj_fn = yaffs_remove_obj_callback;
 
-	mutex_init(&(yaffs_dev_to_lc(dev)->gross_lock));
+	init_rwsem(&(yaffs_dev_to_lc(dev)->gross_lock));
 
 	yaffs_gross_lock(dev);
 
@@ -2445,6 +2489,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->n_reserved_blocks);
 	buf += sprintf(buf, "always_check_erased... %d\n",
 			param->always_check_erased);
+	buf += sprintf(buf, "enable_summary........ %d\n",
+			param->enable_summary);
 
 	return buf;
 }
@@ -2489,6 +2535,13 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "cache_misses.......... %u\n", dev->cache_misses);
+	buf += sprintf(buf, "cache_evictions....... %u\n",
+			dev->cache_evictions);
+	buf += sprintf(buf, "cache_writebacks...... %u\n",
+			dev->cache_writebacks);
+	buf += sprintf(buf, "cache_fills_skipped... %u\n",
+			dev->cache_fills_skipped);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
@@ -20,6 +20,7 @@
 #include "yaffs_getblockinfo.h"
 #include "yaffs_verify.h"
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /*
  * Checkpoints are really no benefit on very small partitions.
@@ -886,11 +887,13 @@ int yaffs2_handle_hole(struct yaffs_obj *obj, loff_t new_size)
 
 	increase = new_size - old_file_size;
 
+	yaffs_block_lock(dev);
 	if (increase < YAFFS_SMALL_HOLE_THRESHOLD * dev->data_bytes_per_chunk &&
 	    yaffs_check_alloc_available(dev, YAFFS_SMALL_HOLE_THRESHOLD + 1))
 		small_hole = 1;
 	else
 		small_hole = 0;
+	yaffs_block_unlock(dev);
 
 	if (small_hole)
 		local_buffer = yaffs_get_temp_buffer(dev, __LINE__);
@@ -987,6 +990,16 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
 
+	u8 *sum_buffer;
+	struct yaffs_summary_tags *sum_tags;
+	int n_summaries = 0;
+
+	/* Time stamps and read counts for the mount time breakdown */
+	u32 t_start = Y_TIME_US();
+	u32 t_states, t_sort, t_chunks;
+	u32 reads_start = dev->n_page_reads;
+	u32 reads_states;
+
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
 		dev->internal_start_block, dev->internal_end_block);
@@ -1012,6 +1025,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	dev->blocks_in_checkpt = 0;
 
 	chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
+	sum_buffer = yaffs_get_temp_buffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
 	bi = dev->block_info;
@@ -1069,6 +1083,9 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 		bi++;
 	}
 
+	t_states = Y_TIME_US();
+	reads_states = dev->n_page_reads;
+
 	yaffs_trace(YAFFS_TRACE_SCAN, "%d blocks to be sorted...", n_to_scan);
 
 	cond_resched();
@@ -1079,6 +1096,8 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	cond_resched();
 
+	t_sort = Y_TIME_US();
+
 	yaffs_trace(YAFFS_TRACE_SCAN, "...done");
 
 	/* Now scan the blocks looking at the data. */
@@ -1101,6 +1120,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 		state = bi->block_state;
 
 		deleted = 0;
+		sum_tags = NULL;
 
 		/* For each chunk in each block that needs scanning.... */
 		found_chunks = 0;
@@ -1114,12 +1134,33 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (sum_tags)
+				yaffs_summary_fetch(dev, &tags, sum_tags,
+						    blk, c);
+			else
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
-			if (!tags.chunk_used) {
+			if (c == dev->param.chunks_per_block - 1 &&
+			    tags.chunk_used &&
+			    tags.obj_id == YAFFS_OBJECTID_SUMMARY &&
+			    tags.ecc_result != YAFFS_ECC_RESULT_UNFIXED &&
+			    tags.seq_number == bi->seq_number) {
+				/* The block summary. It means the block is
+				 * full and, if it is valid, holds the tags of
+				 * all the other chunks.
+				 */
+				found_chunks = 1;
+				bi->has_summary = 1;
+
+				sum_tags = yaffs_summary_read(dev, blk,
+							      sum_buffer);
+				if (sum_tags)
+					n_summaries++;
+
+			} else if (!tags.chunk_used) {
 				/* An unassigned chunk in the block.
 				 * If there are used chunks after this one, then
 				 * it is a chunk that was skipped due to failing the erased
@@ -1575,6 +1616,8 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	yaffs_skip_rest_of_block(dev);
 
+	t_chunks = Y_TIME_US();
+
 	if (alt_block_index)
 		vfree(block_index);
 	else
@@ -1587,8 +1630,18 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	 */
 	yaffs_link_fixup(dev, hard_list);
 
+	yaffs_release_temp_buffer(dev, sum_buffer, __LINE__);
 	yaffs_release_temp_buffer(dev, chunk_data, __LINE__);
 
+	yaffs_trace(YAFFS_TRACE_MOUNT,
+		"yaffs: scan: block states %u us (%u reads), sort %u us",
+		t_states - t_start, reads_states - reads_start,
+		t_sort - t_states);
+	yaffs_trace(YAFFS_TRACE_MOUNT,
+		"yaffs: scan: %d blocks (%d from summaries) in %u us (%u reads), link fixup %u us",
+		n_to_scan, n_summaries, t_chunks - t_sort,
+		dev->n_page_reads - reads_states, Y_TIME_US() - t_chunks);
+
 	if (alloc_failed)
 		return YAFFS_FAIL;
 
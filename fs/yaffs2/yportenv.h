@@ -20,6 +20,8 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
@@ -30,6 +32,9 @@
 #include <linux/stat.h>
 #include <linux/sort.h>
 #include <linux/bitops.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
@@ -45,6 +50,10 @@
 #define Y_CURRENT_TIME CURRENT_TIME.tv_sec
 #define Y_TIME_CONVERT(x) (x).tv_sec
 
+/* Microsecond time stamp, for timing mount phases. Wraps, so only use
+ * differences. */
+#define Y_TIME_US() ((u32) ktime_to_us(ktime_get()))
+
 #define compile_time_assertion(assertion) \
 	({ int x = __builtin_choose_expr(assertion, 0, (void)0); (void) x; })
 
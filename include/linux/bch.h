@@ -72,8 +72,20 @@ void free_bch(struct bch_control *bch);
 void encode_bch(struct bch_control *bch, const uint8_t *data,
 		unsigned int len, uint8_t *ecc);
 
+void encode_bch_generic(struct bch_control *bch, const uint8_t *data,
+			unsigned int len, uint8_t *ecc);
+
 int decode_bch(struct bch_control *bch, const uint8_t *data, unsigned int len,
 	       const uint8_t *recv_ecc, const uint8_t *calc_ecc,
 	       const unsigned int *syn, unsigned int *errloc);
 
+#ifdef CONFIG_BCH_NEON
+/* largest ecc size, in 32-bit words, encoded with NEON */
+#define BCH_NEON_MAX_WORDS	8
+
+/* private: called by encode_bch() between kernel_neon_begin/end() */
+void encode_bch_neon(const uint32_t *mod8_tab, unsigned int words,
+		     const uint32_t *data, unsigned int len, uint32_t *ecc);
+#endif
+
 #endif /* _BCH_H */
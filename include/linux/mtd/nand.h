@@ -102,6 +102,8 @@ extern int nand_unlock(struct mtd_info *mtd, loff_t ofs, uint64_t len);
 #define NAND_CMD_READSTART	0x30
 #define NAND_CMD_RNDOUTSTART	0xE0
 #define NAND_CMD_CACHEDPROG	0x15
+#define NAND_CMD_READCACHESEQ	0x31
+#define NAND_CMD_READCACHEEND	0x3f
 
 /* Extended commands for AG-AND device */
 /*
@@ -220,6 +222,7 @@ typedef enum {
 #define NAND_CANAUTOINCR(chip) (!(chip->options & NAND_NO_AUTOINCR))
 #define NAND_MUST_PAD(chip) (!(chip->options & NAND_NO_PADDING))
 #define NAND_HAS_CACHEPROG(chip) ((chip->options & NAND_CACHEPRG))
+#define NAND_HAS_CACHEREAD(chip) ((chip->options & NAND_USE_CACHE_READ))
 #define NAND_HAS_COPYBACK(chip) ((chip->options & NAND_COPYBACK))
 /* Large page NAND with SOFT_ECC should support subpage reads */
 #define NAND_SUBPAGE_READ(chip) ((chip->ecc.mode == NAND_ECC_SOFT) \
@@ -250,6 +253,17 @@ typedef enum {
 #define NAND_USE_FLASH_BBT_NO_OOB	0x00800000
 /* Create an empty BBT with no vendor information if the BBT is available */
 #define NAND_CREATE_EMPTY_BBT		0x01000000
+/*
+ * The board driver can issue cache read (READCACHESEQ / READCACHEEND)
+ * sequences and the chip supports them: multi-page reads then stream
+ * the pages of a block without a full read command per page.
+ */
+#define NAND_USE_CACHE_READ	0x02000000
+/*
+ * Use cached programming (CACHEDPROG) for multi-page writes on chips
+ * with NAND_CACHEPRG. Off by default, the gain depends on the controller.
+ */
+#define NAND_USE_CACHE_PROG	0x04000000
 
 /* Options set by nand scan */
 /* Nand scan has allocated controller struct */
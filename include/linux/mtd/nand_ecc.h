@@ -23,6 +23,12 @@ struct mtd_info;
 void __nand_calculate_ecc(const u_char *dat, unsigned int eccsize,
 				u_char *ecc_code);
 
+/*
+ * Calculate 3 byte ECC code for eccsize byte block, without SIMD
+ */
+void __nand_calculate_ecc_generic(const u_char *dat, unsigned int eccsize,
+				  u_char *ecc_code);
+
 /*
  * Calculate 3 byte ECC code for 256/512 byte block
  */
@@ -39,4 +45,22 @@ int __nand_correct_data(u_char *dat, u_char *read_ecc, u_char *calc_ecc,
  */
 int nand_correct_data(struct mtd_info *mtd, u_char *dat, u_char *read_ecc, u_char *calc_ecc);
 
+#ifdef CONFIG_MTD_NAND_ECC_NEON
+/*
+ * Longword parities of an eccsize byte block: par is the xor of all
+ * longwords, rpN the xor of the longwords whose index has bit (N-4)/2
+ * clear. rp16 is only meaningful for 512 byte blocks.
+ */
+struct nand_ecc_parity {
+	uint32_t par;
+	uint32_t rp4, rp6, rp8, rp10, rp12, rp14, rp16;
+};
+
+/*
+ * Gather the parities with NEON, between kernel_neon_begin/end()
+ */
+void nand_ecc_neon_parity(const u_char *dat, unsigned int eccsize,
+			  struct nand_ecc_parity *p);
+#endif
+
 #endif /* __MTD_NAND_ECC_H__ */
@@ -42,6 +42,31 @@ enum oom_constraint {
 
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+extern void lowmem_adj_index_add(struct task_struct *p);
+extern void lowmem_adj_index_del(struct task_struct *p);
+extern void lowmem_adj_index_update(struct task_struct *p);
+extern void lowmem_adj_index_replace(struct task_struct *old,
+				     struct task_struct *new);
+#else
+static inline void lowmem_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_index_update(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_index_replace(struct task_struct *old,
+					    struct task_struct *new)
+{
+}
+#endif
+
 extern unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *mem,
 			const nodemask_t *nodemask, unsigned long totalpages);
 extern int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_flags);
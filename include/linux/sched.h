@@ -1280,6 +1280,11 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	/* lowmemorykiller oom_adj bucket, thread group leaders only */
+	struct list_head lmk_adj_node;
+	u64 lmk_adj_seq;		/* when filed in the bucket */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
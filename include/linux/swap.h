@@ -261,6 +261,13 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						unsigned long *nr_scanned);
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
+#ifdef CONFIG_PROCESS_RECLAIM
+extern int isolate_lru_page_compcache(struct page *page);
+extern unsigned long zone_id_shrink_pagelist(struct zone *zone,
+					     struct list_head *page_list);
+/* linux/mm/process_reclaim.c */
+extern unsigned long reclaim_mm_anon_pages(struct mm_struct *mm);
+#endif
 extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
 extern long vm_total_pages;
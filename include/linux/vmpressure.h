@@ -0,0 +1,21 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+
+/*
+ * Reclaim efficiency based memory pressure notification, see
+ * Documentation/vm/vmpressure.txt.
+ */
+#ifdef CONFIG_VMPRESSURE
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern void vmpressure_prio(gfp_t gfp, int prio);
+#else
+static inline void vmpressure(gfp_t gfp, unsigned long scanned,
+			      unsigned long reclaimed) {}
+static inline void vmpressure_prio(gfp_t gfp, int prio) {}
+#endif
+
+#endif /* __LINUX_VMPRESSURE_H */
@@ -71,8 +71,12 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/bitops.h>
+#include <linux/hardirq.h>
 #include <asm/byteorder.h>
 #include <linux/bch.h>
+#ifdef CONFIG_BCH_NEON
+#include <asm/neon.h>
+#endif
 
 #if defined(CONFIG_BCH_CONST_PARAMS)
 #define GF_M(_p)               (CONFIG_BCH_CONST_M)
@@ -167,22 +171,19 @@ static void store_ecc8(struct bch_control *bch, uint8_t *dst,
 	memcpy(dst, pad, BCH_ECC_BYTES(bch)-4*nwords);
 }
 
-/**
- * encode_bch - calculate BCH ecc parity of data
- * @bch:   BCH control structure
- * @data:  data to encode
- * @len:   data length in bytes
- * @ecc:   ecc parity data, must be initialized by caller
- *
- * The @ecc parity array is used both as input and output parameter, in order to
- * allow incremental computations. It should be of the size indicated by member
- * @ecc_bytes of @bch, and should be initialized to 0 before the first call.
- *
- * The exact number of computed ecc parity bits is given by member @ecc_bits of
- * @bch; it may be less than m*t for large values of t.
- */
-void encode_bch(struct bch_control *bch, const uint8_t *data,
-		unsigned int len, uint8_t *ecc)
+#ifdef CONFIG_BCH_NEON
+static bool neon = true;
+module_param(neon, bool, 0644);
+MODULE_PARM_DESC(neon, "Use NEON for BCH encoding if the CPU has it");
+
+#define bch_use_neon(_p)       (neon && cpu_has_neon() && !in_interrupt() && \
+				BCH_ECC_WORDS(_p) <= BCH_NEON_MAX_WORDS)
+#else
+#define bch_use_neon(_p)       0
+#endif
+
+static void __encode_bch(struct bch_control *bch, const uint8_t *data,
+			 unsigned int len, uint8_t *ecc, int use_neon)
 {
 	const unsigned int l = BCH_ECC_WORDS(bch)-1;
 	unsigned int i, mlen;
@@ -227,7 +228,16 @@ void encode_bch(struct bch_control *bch, const uint8_t *data,
 	 *           yyyyyyyy  00000000  00000000  mod g = r2 (precomputed)
 	 * xxxxxxxx  00000000  00000000  00000000  mod g = r3 (precomputed)
 	 * xxxxxxxx  yyyyyyyy  zzzzzzzz  tttttttt  mod g = r0^r1^r2^r3
+	 *
+	 * The NEON version xors the remainder words 4 at a time.
 	 */
+#ifdef CONFIG_BCH_NEON
+	if (use_neon) {
+		kernel_neon_begin();
+		encode_bch_neon(tab0, l+1, pdata, mlen, r);
+		kernel_neon_end();
+	} else
+#endif
 	while (mlen--) {
 		/* input data is read in big-endian format */
 		w = r[0]^cpu_to_be32(*pdata++);
@@ -251,8 +261,45 @@ void encode_bch(struct bch_control *bch, const uint8_t *data,
 	if (ecc)
 		store_ecc8(bch, ecc, bch->ecc_buf);
 }
+
+/**
+ * encode_bch - calculate BCH ecc parity of data
+ * @bch:   BCH control structure
+ * @data:  data to encode
+ * @len:   data length in bytes
+ * @ecc:   ecc parity data, must be initialized by caller
+ *
+ * The @ecc parity array is used both as input and output parameter, in order to
+ * allow incremental computations. It should be of the size indicated by member
+ * @ecc_bytes of @bch, and should be initialized to 0 before the first call.
+ *
+ * The exact number of computed ecc parity bits is given by member @ecc_bits of
+ * @bch; it may be less than m*t for large values of t.
+ */
+void encode_bch(struct bch_control *bch, const uint8_t *data,
+		unsigned int len, uint8_t *ecc)
+{
+	__encode_bch(bch, data, len, ecc, bch_use_neon(bch));
+}
 EXPORT_SYMBOL_GPL(encode_bch);
 
+/**
+ * encode_bch_generic - calculate BCH ecc parity of data without SIMD
+ * @bch:   BCH control structure
+ * @data:  data to encode
+ * @len:   data length in bytes
+ * @ecc:   ecc parity data, must be initialized by caller
+ *
+ * Same as encode_bch(), but never uses an accelerated implementation;
+ * this is the reference for testing them against.
+ */
+void encode_bch_generic(struct bch_control *bch, const uint8_t *data,
+			unsigned int len, uint8_t *ecc)
+{
+	__encode_bch(bch, data, len, ecc, 0);
+}
+EXPORT_SYMBOL_GPL(encode_bch_generic);
+
 static inline int modulo(struct bch_control *bch, unsigned int v)
 {
 	const unsigned int n = GF_N(bch);
@@ -1298,7 +1345,8 @@ struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	bch->ecc_bytes = DIV_ROUND_UP(m*t, 8);
 	bch->a_pow_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_pow_tab), &err);
 	bch->a_log_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_log_tab), &err);
-	bch->mod8_tab  = bch_alloc(words*1024*sizeof(*bch->mod8_tab), &err);
+	/* the NEON encoder reads whole vectors, up to 3 words past a row */
+	bch->mod8_tab  = bch_alloc((words*1024+3)*sizeof(*bch->mod8_tab), &err);
 	bch->ecc_buf   = bch_alloc(words*sizeof(*bch->ecc_buf), &err);
 	bch->ecc_buf2  = bch_alloc(words*sizeof(*bch->ecc_buf2), &err);
 	bch->xi_tab    = bch_alloc(m*sizeof(*bch->xi_tab), &err);
@@ -0,0 +1,74 @@
+/*
+ * NEON version of the BCH encoding loop
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This file is built with -mfpu=neon: GCC turns the operations on the vector
+ * type below into NEON instructions, and may use NEON registers anywhere in
+ * this file. It must only be called between kernel_neon_begin() and
+ * kernel_neon_end(), see encode_bch().
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <asm/byteorder.h>
+#include <linux/bch.h>
+
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+
+/* 4 words of a remainder or of a table row, only word aligned */
+typedef u32x4 u32x4_u __attribute__((aligned(4)));
+
+/**
+ * encode_bch_neon - process 32-bit aligned data words
+ * @mod8_tab: remainder lookup tables of the code, see encode_bch()
+ * @words:    ecc size in 32-bit words, at most BCH_NEON_MAX_WORDS
+ * @data:     data words
+ * @len:      number of data words
+ * @ecc:      ecc parity words, updated
+ *
+ * Same as the scalar loop of encode_bch(), with each new remainder
+ * computed 4 words at a time. The remainder is kept followed by a zero
+ * word, which is shifted in as its last word, and by room for the lanes
+ * past the end of the last vector, which are don't care.
+ */
+void encode_bch_neon(const uint32_t *mod8_tab, unsigned int words,
+		     const uint32_t *data, unsigned int len, uint32_t *ecc)
+{
+	const uint32_t * const tab0 = mod8_tab;
+	const uint32_t * const tab1 = tab0 + 256*words;
+	const uint32_t * const tab2 = tab1 + 256*words;
+	const uint32_t * const tab3 = tab2 + 256*words;
+	const uint32_t *p0, *p1, *p2, *p3;
+	uint32_t r[BCH_NEON_MAX_WORDS+4];
+	unsigned int i;
+	uint32_t w;
+
+	memcpy(r, ecc, words*sizeof(*r));
+	memset(r+words, 0, 4*sizeof(*r));
+
+	while (len--) {
+		/* input data is read in big-endian format */
+		w = r[0]^cpu_to_be32(*data++);
+		p0 = tab0 + words*((w >>  0) & 0xff);
+		p1 = tab1 + words*((w >>  8) & 0xff);
+		p2 = tab2 + words*((w >> 16) & 0xff);
+		p3 = tab3 + words*((w >> 24) & 0xff);
+
+		for (i = 0; i < words; i += 4)
+			*(u32x4_u *)(r+i) = *(const u32x4_u *)(r+i+1)^
+				*(const u32x4_u *)(p0+i)^
+				*(const u32x4_u *)(p1+i)^
+				*(const u32x4_u *)(p2+i)^
+				*(const u32x4_u *)(p3+i);
+
+		r[words] = 0;
+	}
+	memcpy(ecc, r, words*sizeof(*r));
+}
+EXPORT_SYMBOL_GPL(encode_bch_neon);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("NEON support for the BCH library");
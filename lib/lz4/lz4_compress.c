@@ -0,0 +1,178 @@
+/*
+ *  LZ4 block compressor
+ *
+ *  Single-pass greedy matcher over a 4-byte hash table, producing
+ *  the standard LZ4 block format. Favours speed over ratio, which
+ *  matches its use for swap and in-memory compression.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/*
+ * Emit a run length that did not fit into its 4-bit token field.
+ * Returns the new output pointer, or NULL if dst would overflow.
+ */
+static inline unsigned char *lz4_put_length(unsigned char *op,
+		const unsigned char *op_end, size_t len)
+{
+	if (unlikely((size_t)(op_end - op) < len / 255 + 1))
+		return NULL;
+
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *const ip_end = src + src_len;
+	const unsigned char *const mflimit = ip_end - LZ4_MFLIMIT;
+	const unsigned char *const matchlimit = ip_end - LZ4_LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *const op_end = dst + *dst_len;
+	const unsigned char *ref;
+	unsigned char *token;
+	size_t len;
+	u32 h;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < LZ4_MFLIMIT + 1)
+		goto last_literals;
+
+	hash_table[lz4_hash(LZ4_READ32(ip))] = 0;
+	ip++;
+
+	for (;;) {
+		const unsigned char *fwd = ip;
+		unsigned int search = 1U << LZ4_SKIP_TRIGGER;
+		unsigned int step;
+
+		/* Find a match, accelerating through incompressible data */
+		do {
+			ip = fwd;
+			step = search++ >> LZ4_SKIP_TRIGGER;
+			fwd = ip + step;
+			if (unlikely(fwd > mflimit))
+				goto last_literals;
+
+			h = lz4_hash(LZ4_READ32(ip));
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+		} while (ip - ref > LZ4_MAX_DISTANCE ||
+				LZ4_READ32(ref) != LZ4_READ32(ip));
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run */
+		len = ip - anchor;
+		if (unlikely((size_t)(op_end - op) < 1 + len + 2))
+			return LZ4_E_OUTPUT_OVERRUN;
+		token = op++;
+		if (len >= LZ4_RUN_MASK) {
+			*token = LZ4_RUN_MASK << LZ4_ML_BITS;
+			op = lz4_put_length(op, op_end, len - LZ4_RUN_MASK);
+			if (!op || (size_t)(op_end - op) < len + 2)
+				return LZ4_E_OUTPUT_OVERRUN;
+		} else {
+			*token = len << LZ4_ML_BITS;
+		}
+		memcpy(op, anchor, len);
+		op += len;
+
+next_match:
+		if (unlikely((size_t)(op_end - op) < 2))
+			return LZ4_E_OUTPUT_OVERRUN;
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Match length; the first LZ4_MINMATCH bytes are known equal */
+		ip += LZ4_MINMATCH;
+		ref += LZ4_MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - anchor;
+		if (len >= LZ4_ML_MASK) {
+			*token += LZ4_ML_MASK;
+			op = lz4_put_length(op, op_end, len - LZ4_ML_MASK);
+			if (!op)
+				return LZ4_E_OUTPUT_OVERRUN;
+		} else {
+			*token += len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+
+		hash_table[lz4_hash(LZ4_READ32(ip - 2))] = ip - 2 - src;
+
+		/* Immediate follow-up match: no literals in between */
+		h = lz4_hash(LZ4_READ32(ip));
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+		if (ip - ref <= LZ4_MAX_DISTANCE &&
+				LZ4_READ32(ref) == LZ4_READ32(ip)) {
+			if (unlikely(op >= op_end))
+				return LZ4_E_OUTPUT_OVERRUN;
+			token = op++;
+			*token = 0;
+			goto next_match;
+		}
+
+		ip++;
+	}
+
+last_literals:
+	len = ip_end - anchor;
+	if (unlikely(op >= op_end))
+		return LZ4_E_OUTPUT_OVERRUN;
+	token = op++;
+	if (len >= LZ4_RUN_MASK) {
+		*token = LZ4_RUN_MASK << LZ4_ML_BITS;
+		op = lz4_put_length(op, op_end, len - LZ4_RUN_MASK);
+		if (!op)
+			return LZ4_E_OUTPUT_OVERRUN;
+	} else {
+		*token = len << LZ4_ML_BITS;
+	}
+	if (unlikely((size_t)(op_end - op) < len))
+		return LZ4_E_OUTPUT_OVERRUN;
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
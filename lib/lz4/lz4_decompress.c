@@ -0,0 +1,125 @@
+/*
+ *  LZ4 block decompressor
+ *
+ *  Every length and offset read from the stream is checked against
+ *  the input and output bounds, so corrupted data can never cause
+ *  reads or writes outside the supplied buffers.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+		size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *const ip_end = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *const op_end = dst + *dst_len;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+	unsigned char s;
+
+	for (;;) {
+		if (unlikely(ip >= ip_end))
+			goto input_overrun;
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> LZ4_ML_BITS;
+		if (len == LZ4_RUN_MASK) {
+			do {
+				if (unlikely(ip >= ip_end))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+
+		if (unlikely((size_t)(ip_end - ip) < len))
+			goto input_overrun;
+		if (unlikely((size_t)(op_end - op) < len))
+			goto output_overrun;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence carries literals only */
+		if (ip == ip_end)
+			break;
+
+		if (unlikely((size_t)(ip_end - ip) < 2))
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(offset == 0 || offset > (size_t)(op - dst)))
+			goto lookbehind_overrun;
+		ref = op - offset;
+
+		len = token & LZ4_ML_MASK;
+		if (len == LZ4_ML_MASK) {
+			do {
+				if (unlikely(ip >= ip_end))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += LZ4_MINMATCH;
+
+		if (unlikely((size_t)(op_end - op) < len))
+			goto output_overrun;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else if (offset >= LZ4_COPYLENGTH) {
+			/* Overlapping, but each chunk is disjoint */
+			while (len >= LZ4_COPYLENGTH) {
+				memcpy(op, ref, LZ4_COPYLENGTH);
+				op += LZ4_COPYLENGTH;
+				ref += LZ4_COPYLENGTH;
+				len -= LZ4_COPYLENGTH;
+			}
+			while (len--)
+				*op++ = *ref++;
+		} else {
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+input_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
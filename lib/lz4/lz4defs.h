@@ -0,0 +1,21 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_MINMATCH		4
+#define LZ4_COPYLENGTH		8
+#define LZ4_LASTLITERALS	5
+#define LZ4_MFLIMIT		(LZ4_COPYLENGTH + LZ4_MINMATCH)
+#define LZ4_MAX_DISTANCE	0xffff
+#define LZ4_SKIP_TRIGGER	6
+
+#define LZ4_ML_BITS		4
+#define LZ4_ML_MASK		((1U << LZ4_ML_BITS) - 1)
+#define LZ4_RUN_BITS		(8 - LZ4_ML_BITS)
+#define LZ4_RUN_MASK		((1U << LZ4_RUN_BITS) - 1)
+
+#define LZ4_READ32(p)		get_unaligned((const u32 *)(p))
@@ -0,0 +1,141 @@
+/*
+ * mm/process_reclaim.c
+ *
+ * Reclaim the private anonymous pages of a single process, so that a
+ * background app can be pushed out to swap (typically zram) as a whole
+ * instead of being killed when memory runs low.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/mm.h>
+#include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
+#include <linux/swap.h>
+#include <linux/sched.h>
+
+/*
+ * Pages isolated from one page table are collected per zone, since
+ * zone_id_shrink_pagelist() works on the pages of a single zone.
+ */
+struct reclaim_batch {
+	struct vm_area_struct *vma;
+	struct zone *zone[MAX_NR_ZONES];
+	struct list_head list[MAX_NR_ZONES];
+	unsigned long nr_reclaimed;
+};
+
+static void reclaim_batch_flush(struct reclaim_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		if (list_empty(&batch->list[i]))
+			continue;
+		batch->nr_reclaimed += zone_id_shrink_pagelist(batch->zone[i],
+							&batch->list[i]);
+		batch->zone[i] = NULL;
+	}
+}
+
+static int reclaim_pte_range(pmd_t *pmd, unsigned long addr,
+			     unsigned long end, struct mm_walk *walk)
+{
+	struct reclaim_batch *batch = walk->private;
+	struct vm_area_struct *vma = batch->vma;
+	pte_t *orig_pte, *pte, ptent;
+	spinlock_t *ptl;
+	struct page *page;
+	struct zone *zone;
+	int zid;
+
+	split_huge_page_pmd(walk->mm, pmd);
+
+again:
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		ptent = *pte;
+		if (!pte_present(ptent))
+			continue;
+
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !PageAnon(page))
+			continue;
+
+		/*
+		 * Pages shared with other processes, e.g. copy-on-write
+		 * pages inherited from zygote, are left alone: reclaiming
+		 * them would fault them back in for everyone else.
+		 */
+		if (page_mapcount(page) != 1 || PageUnevictable(page))
+			continue;
+
+		zid = page_zonenum(page);
+		zone = page_zone(page);
+		/* Same zone index on another node: flush the batch first */
+		if (batch->zone[zid] && batch->zone[zid] != zone)
+			break;
+
+		if (isolate_lru_page_compcache(page))
+			continue;
+
+		batch->zone[zid] = zone;
+		list_add(&page->lru, &batch->list[zid]);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+	reclaim_batch_flush(batch);
+	cond_resched();
+
+	if (addr != end && !fatal_signal_pending(current))
+		goto again;
+
+	return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/**
+ * reclaim_mm_anon_pages - reclaim the private anonymous pages of an mm
+ * @mm: address space to reclaim from
+ *
+ * Walks the page tables of every VMA, isolating anonymous pages that
+ * are mapped by this mm only, and reclaims them in per-page-table
+ * batches. Returns the number of pages reclaimed.
+ */
+unsigned long reclaim_mm_anon_pages(struct mm_struct *mm)
+{
+	int i;
+	struct vm_area_struct *vma;
+	struct reclaim_batch batch = { .nr_reclaimed = 0 };
+	struct mm_walk reclaim_walk = {
+		.pmd_entry = reclaim_pte_range,
+		.mm = mm,
+		.private = &batch,
+	};
+
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		batch.zone[i] = NULL;
+		INIT_LIST_HEAD(&batch.list[i]);
+	}
+
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (is_vm_hugetlb_page(vma))
+			continue;
+		if (vma->vm_flags & (VM_LOCKED | VM_PFNMAP | VM_IO))
+			continue;
+		/* Only private mappings can hold anonymous pages */
+		if (vma->vm_flags & VM_SHARED)
+			continue;
+
+		batch.vma = vma;
+		if (walk_page_range(vma->vm_start, vma->vm_end,
+				    &reclaim_walk))
+			break;
+	}
+	up_read(&mm->mmap_sem);
+
+	return batch.nr_reclaimed;
+}
+EXPORT_SYMBOL(reclaim_mm_anon_pages);
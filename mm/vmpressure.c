@@ -0,0 +1,305 @@
+/*
+ * mm/vmpressure.c
+ *
+ * Memory pressure notification for userspace.
+ *
+ * Pressure is derived from how efficient page reclaim is: the share of
+ * scanned pages that could not be reclaimed, over a window of scanned
+ * pages. Listeners poll /dev/vmpressure and are woken when a window
+ * ends at or above the level they asked for, so a low memory daemon
+ * can trim caches before the low memory killer has to step in.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Pressure is computed once per window of scanned pages. 512 pages
+ * is what kswapd scans in a few rounds at low priority; a smaller
+ * window reacts faster but is noisier.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Share of scanned pages not reclaimed, in %, for each level */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+/*
+ * Once reclaim drops to this priority it scans 1/8 of the LRU lists
+ * per pass: report critical even if it still manages to reclaim.
+ */
+static const int vmpressure_level_critical_prio = 3;
+
+enum vmpressure_levels {
+	VMPRESSURE_LOW = 0,
+	VMPRESSURE_MEDIUM,
+	VMPRESSURE_CRITICAL,
+	VMPRESSURE_NUM_LEVELS,
+};
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+/*
+ * vmpressure_events[i] counts the windows that ended at level i or
+ * above; a listener has an event pending while the counter for its
+ * level differs from the value it last read.
+ */
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static unsigned long vmpressure_events[VMPRESSURE_NUM_LEVELS];
+static enum vmpressure_levels vmpressure_last;
+
+static atomic_t vmpressure_listeners = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(vmpressure_wait);
+
+struct vmpressure_listener {
+	enum vmpressure_levels level;	/* lowest level reported */
+	unsigned long seen;		/* vmpressure_events[level] at read */
+};
+
+static enum vmpressure_levels vmpressure_calc_level(unsigned long scanned,
+						    unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	/* Slab pages freed along the way can make reclaimed exceed scanned */
+	if (reclaimed >= scanned)
+		return VMPRESSURE_LOW;
+
+	pressure = (scanned - reclaimed) * 100 / scanned;
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	unsigned long scanned, reclaimed;
+	enum vmpressure_levels level;
+	int i;
+
+	spin_lock(&vmpressure_lock);
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	if (!scanned) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+
+	level = vmpressure_calc_level(scanned, reclaimed);
+	vmpressure_last = level;
+	for (i = 0; i <= level; i++)
+		vmpressure_events[i]++;
+	spin_unlock(&vmpressure_lock);
+
+	wake_up_interruptible(&vmpressure_wait);
+}
+
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+/**
+ * vmpressure - account reclaim efficiency
+ * @gfp: reclaimer's gfp mask
+ * @scanned: number of pages scanned
+ * @reclaimed: number of pages reclaimed
+ *
+ * Called by global reclaim after each zone scan. Once a window of
+ * scanned pages is complete, the pressure level is computed and
+ * listeners are notified from a work item, outside of reclaim.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	/*
+	 * Only allocations that can be served from the user memory zones
+	 * or that may do I/O say something about the pressure userspace
+	 * could relieve.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned || !atomic_read(&vmpressure_listeners))
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	scanned = vmpressure_scanned;
+	spin_unlock(&vmpressure_lock);
+
+	if (scanned >= vmpressure_win)
+		schedule_work(&vmpressure_work);
+}
+
+/**
+ * vmpressure_prio - account reclaim priority
+ * @gfp: reclaimer's gfp mask
+ * @prio: reclaimer's priority
+ *
+ * Direct reclaim that gets down to a low priority is about to fail
+ * or to OOM, which is critical whatever the window says so far.
+ */
+void vmpressure_prio(gfp_t gfp, int prio)
+{
+	if (prio > vmpressure_level_critical_prio)
+		return;
+
+	/* A full window with nothing reclaimed always reads critical */
+	vmpressure(gfp, vmpressure_win, 0);
+}
+
+static bool vmpressure_pending(struct vmpressure_listener *listener)
+{
+	return ACCESS_ONCE(vmpressure_events[listener->level]) !=
+		listener->seen;
+}
+
+static int vmpressure_open(struct inode *inode, struct file *file)
+{
+	struct vmpressure_listener *listener;
+
+	listener = kzalloc(sizeof(*listener), GFP_KERNEL);
+	if (!listener)
+		return -ENOMEM;
+
+	spin_lock(&vmpressure_lock);
+	listener->level = VMPRESSURE_LOW;
+	listener->seen = vmpressure_events[VMPRESSURE_LOW];
+	spin_unlock(&vmpressure_lock);
+
+	file->private_data = listener;
+	atomic_inc(&vmpressure_listeners);
+
+	return nonseekable_open(inode, file);
+}
+
+static int vmpressure_release(struct inode *inode, struct file *file)
+{
+	atomic_dec(&vmpressure_listeners);
+	kfree(file->private_data);
+	return 0;
+}
+
+/*
+ * Reading returns the level of the most recent event, at least the
+ * listener's own level, and consumes all pending events. It blocks
+ * until there is one unless the file is non-blocking.
+ */
+static ssize_t vmpressure_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct vmpressure_listener *listener = file->private_data;
+	enum vmpressure_levels level;
+	char kbuf[16];
+	int len, ret;
+
+	if (!vmpressure_pending(listener)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(vmpressure_wait,
+					       vmpressure_pending(listener));
+		if (ret)
+			return ret;
+	}
+
+	spin_lock(&vmpressure_lock);
+	listener->seen = vmpressure_events[listener->level];
+	level = max(vmpressure_last, listener->level);
+	spin_unlock(&vmpressure_lock);
+
+	len = snprintf(kbuf, sizeof(kbuf), "%s\n", vmpressure_str_levels[level]);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, kbuf, len))
+		return -EFAULT;
+
+	return len;
+}
+
+/* Writing a level name sets the lowest level the listener is woken for */
+static ssize_t vmpressure_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct vmpressure_listener *listener = file->private_data;
+	char kbuf[16];
+	int level;
+
+	memset(kbuf, 0, sizeof(kbuf));
+	if (count > sizeof(kbuf) - 1)
+		count = sizeof(kbuf) - 1;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+
+	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++)
+		if (!strcmp(strstrip(kbuf), vmpressure_str_levels[level]))
+			break;
+	if (level == VMPRESSURE_NUM_LEVELS)
+		return -EINVAL;
+
+	spin_lock(&vmpressure_lock);
+	listener->level = level;
+	listener->seen = vmpressure_events[level];
+	spin_unlock(&vmpressure_lock);
+
+	return count;
+}
+
+static unsigned int vmpressure_poll(struct file *file, poll_table *wait)
+{
+	struct vmpressure_listener *listener = file->private_data;
+
+	poll_wait(file, &vmpressure_wait, wait);
+	if (vmpressure_pending(listener))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations vmpressure_fops = {
+	.owner = THIS_MODULE,
+	.open = vmpressure_open,
+	.release = vmpressure_release,
+	.read = vmpressure_read,
+	.write = vmpressure_write,
+	.poll = vmpressure_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice vmpressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "vmpressure",
+	.fops = &vmpressure_fops,
+};
+
+static int __init vmpressure_init(void)
+{
+	int ret;
+
+	ret = misc_register(&vmpressure_misc);
+	if (unlikely(ret)) {
+		printk(KERN_ERR "vmpressure: failed to register misc device!\n");
+		return ret;
+	}
+
+	return 0;
+}
+module_init(vmpressure_init);
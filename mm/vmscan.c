@@ -43,6 +43,7 @@
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
+#include <linux/vmpressure.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -1017,7 +1018,7 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 	return ret;
 }
 
-#ifdef CONFIG_ZRAM_FOR_ANDROID
+#ifdef CONFIG_PROCESS_RECLAIM
 /**
  * isolate_lru_page_compcache - tries to isolate a page for compcache
  * @page: page to isolate from its LRU list
@@ -1519,7 +1520,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	return nr_reclaimed;
 }
 
-#ifdef CONFIG_ZRAM_FOR_ANDROID
+#ifdef CONFIG_PROCESS_RECLAIM
 unsigned long
 zone_id_shrink_pagelist(struct zone *zone, struct list_head *page_list)
 {
@@ -1555,7 +1556,7 @@ zone_id_shrink_pagelist(struct zone *zone, struct list_head *page_list)
 }
 
 EXPORT_SYMBOL(zone_id_shrink_pagelist);
-#endif /* CONFIG_ZRAM_FOR_ANDROID */
+#endif /* CONFIG_PROCESS_RECLAIM */
 
 /*
  * This moves pages from the active list to the inactive list.
@@ -2048,6 +2049,10 @@ restart:
 	}
 	sc->nr_reclaimed += nr_reclaimed;
 
+	if (scanning_global_lru(sc))
+		vmpressure(sc->gfp_mask, sc->nr_scanned - nr_scanned,
+			   nr_reclaimed);
+
 	/*
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
@@ -2179,6 +2184,8 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
 		sc->nr_scanned = 0;
+		if (scanning_global_lru(sc))
+			vmpressure_prio(sc->gfp_mask, priority);
 		if (!priority)
 			disable_swap_token(sc->mem_cgroup);
 		shrink_zones(priority, zonelist, sc);
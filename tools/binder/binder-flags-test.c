@@ -0,0 +1,326 @@
+/*
+ * binder-flags-test.c -- node priority flags accepted by the binder driver
+ *
+ * Sends new local binders with various flat_binder_object flags to a
+ * context manager and checks which ones the driver accepts. Most
+ * importantly the flags libbinder uses for every binder it flattens,
+ * 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS, must be accepted.
+ *
+ * The test becomes the context manager, so nothing else (e.g.
+ * servicemanager) may hold that role while it runs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -Wextra -g -o binder-flags-test binder-flags-test.c */
+
+#define _GNU_SOURCE /* for SCHED_BATCH */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../drivers/staging/android/binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define MAP_SIZE	(128 * 1024)
+
+/* Transaction codes understood by the context manager below */
+#define CODE_NODE	1
+#define CODE_DONE	2
+
+#define POLICY(p)	((p) << FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT)
+#define NICE(n)		((n) & FLAT_BINDER_FLAG_PRIORITY_MASK)
+
+static const struct {
+	const char	*name;
+	unsigned long	flags;
+	int		accept;
+} cases[] = {
+	{ "libbinder default (nice 0x7f, accepts fds)",
+	  0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS,			1 },
+	{ "no flags",			0,				1 },
+	{ "nice -20",			NICE(-20),			1 },
+	{ "nice 19",			NICE(19),			1 },
+	{ "nice -128",			NICE(-128),			1 },
+	{ "SCHED_BATCH nice 0x7f",	POLICY(SCHED_BATCH) | 0x7f,	1 },
+	{ "SCHED_FIFO 1",		POLICY(SCHED_FIFO) | 1,		1 },
+	{ "SCHED_RR 99, inherit RT",	POLICY(SCHED_RR) | 99 |
+					FLAT_BINDER_FLAG_INHERIT_RT,	1 },
+	{ "SCHED_FIFO 0",		POLICY(SCHED_FIFO),		0 },
+	{ "SCHED_RR 0xff",		POLICY(SCHED_RR) | 0xff,	0 },
+};
+
+static int binder_open(void)
+{
+	struct binder_version version;
+	int fd;
+
+	fd = open(BINDER_DEV, O_RDWR);
+	if (fd < 0) {
+		perror("open " BINDER_DEV);
+		exit(1);
+	}
+	if (ioctl(fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED) {
+		perror("mmap " BINDER_DEV);
+		exit(1);
+	}
+	return fd;
+}
+
+static void binder_write(int fd, void *data, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ");
+		exit(1);
+	}
+}
+
+static void binder_free_buffer(int fd, const void *buffer)
+{
+	struct {
+		uint32_t	cmd;
+		const void	*buffer;
+	} __attribute__((packed)) cmd = { BC_FREE_BUFFER, buffer };
+
+	binder_write(fd, &cmd, sizeof(cmd));
+}
+
+/*
+ * Acknowledge reference count requests on our nodes. Returns a pointer
+ * past the command's arguments, or NULL if cmd is something else.
+ */
+static uint32_t *binder_handle_refs(int fd, uint32_t cmd, uint32_t *p)
+{
+	struct binder_ptr_cookie *pc = (struct binder_ptr_cookie *)p;
+	struct {
+		uint32_t		cmd;
+		struct binder_ptr_cookie pc;
+	} __attribute__((packed)) done;
+
+	switch (cmd) {
+	case BR_INCREFS:
+	case BR_ACQUIRE:
+		done.cmd = cmd == BR_INCREFS ? BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+		done.pc = *pc;
+		binder_write(fd, &done, sizeof(done));
+		return (uint32_t *)(pc + 1);
+	case BR_RELEASE:
+	case BR_DECREFS:
+		return (uint32_t *)(pc + 1);
+	}
+	return NULL;
+}
+
+/*
+ * Read returns until a reply or a failure. Returns 1 for BR_REPLY, 0
+ * for BR_FAILED_REPLY or BR_DEAD_REPLY.
+ */
+static int binder_wait_reply(int fd)
+{
+	struct binder_write_read bwr;
+	uint32_t buf[64], *p, *end, *next, cmd;
+	struct binder_transaction_data *txn;
+	int ret = -1;
+
+	while (ret < 0) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(buf);
+		bwr.read_buffer = (unsigned long)buf;
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("BINDER_WRITE_READ");
+			exit(1);
+		}
+
+		p = buf;
+		end = (uint32_t *)((char *)buf + bwr.read_consumed);
+		while (p < end) {
+			cmd = *p++;
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+				break;
+			case BR_REPLY:
+				txn = (struct binder_transaction_data *)p;
+				p = (uint32_t *)(txn + 1);
+				binder_free_buffer(fd, txn->data.ptr.buffer);
+				ret = 1;
+				break;
+			case BR_FAILED_REPLY:
+			case BR_DEAD_REPLY:
+				ret = 0;
+				break;
+			default:
+				next = binder_handle_refs(fd, cmd, p);
+				if (!next) {
+					fprintf(stderr, "unexpected return "
+						"0x%x\n", cmd);
+					exit(1);
+				}
+				p = next;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static int send_node(int fd, unsigned int code, const void *ptr,
+		     unsigned long flags)
+{
+	struct flat_binder_object obj;
+	size_t offset = 0;
+	struct {
+		uint32_t			cmd;
+		struct binder_transaction_data	txn;
+	} __attribute__((packed)) tr;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_BINDER;
+	obj.flags = flags;
+	obj.binder = (void *)ptr;
+	obj.cookie = (void *)ptr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.cmd = BC_TRANSACTION;
+	tr.txn.target.handle = 0;
+	tr.txn.code = code;
+	if (ptr) {
+		tr.txn.data_size = sizeof(obj);
+		tr.txn.offsets_size = sizeof(offset);
+		tr.txn.data.ptr.buffer = &obj;
+		tr.txn.data.ptr.offsets = &offset;
+	}
+
+	binder_write(fd, &tr, sizeof(tr));
+	return binder_wait_reply(fd);
+}
+
+/* Reply to every transaction with an empty reply, until CODE_DONE */
+static void context_manager(int fd)
+{
+	struct binder_write_read bwr;
+	uint32_t buf[64], *p, *end, *next, cmd;
+	struct binder_transaction_data *txn;
+	int done = 0;
+	struct {
+		uint32_t			cmd;
+		struct binder_transaction_data	txn;
+	} __attribute__((packed)) reply;
+
+	while (!done) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(buf);
+		bwr.read_buffer = (unsigned long)buf;
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("BINDER_WRITE_READ");
+			exit(1);
+		}
+
+		p = buf;
+		end = (uint32_t *)((char *)buf + bwr.read_consumed);
+		while (p < end) {
+			cmd = *p++;
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_TRANSACTION:
+				txn = (struct binder_transaction_data *)p;
+				p = (uint32_t *)(txn + 1);
+				if (txn->code == CODE_DONE)
+					done = 1;
+
+				binder_free_buffer(fd, txn->data.ptr.buffer);
+				memset(&reply, 0, sizeof(reply));
+				reply.cmd = BC_REPLY;
+				binder_write(fd, &reply, sizeof(reply));
+				break;
+			default:
+				next = binder_handle_refs(fd, cmd, p);
+				if (!next) {
+					fprintf(stderr, "unexpected return "
+						"0x%x\n", cmd);
+					exit(1);
+				}
+				p = next;
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	int fd, status, failed = 0;
+	unsigned int i;
+	uint32_t cmd;
+	pid_t pid;
+
+	fd = binder_open();
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		return 1;
+	}
+	cmd = BC_ENTER_LOOPER;
+	binder_write(fd, &cmd, sizeof(cmd));
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid) {
+		close(fd);
+		fd = binder_open();
+		for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+			int accepted = send_node(fd, CODE_NODE, &cases[i],
+						 cases[i].flags);
+
+			printf("%-44s flags 0x%04lx: %s\n", cases[i].name,
+			       cases[i].flags,
+			       accepted == cases[i].accept ? "ok" :
+			       accepted ? "FAILED, accepted" :
+			       "FAILED, rejected");
+			if (accepted != cases[i].accept)
+				failed++;
+		}
+		send_node(fd, CODE_DONE, NULL, 0);
+		return failed ? 1 : 0;
+	}
+
+	context_manager(fd);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		printf("binder-flags-test: FAILED\n");
+		return 1;
+	}
+	printf("binder-flags-test: all passed\n");
+	return 0;
+}
@@ -4,6 +4,11 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_zram_rw(int argc, const char **argv, const char *prefix);
+extern int bench_binder_pingpong(int argc, const char **argv, const char *prefix);
+extern int bench_binder_sg(int argc, const char **argv, const char *prefix);
+extern int bench_lmk_stress(int argc, const char **argv, const char *prefix);
+extern int bench_yaffs_rw(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,783 @@
+/*
+ *
+ * binder.c
+ *
+ * pingpong: synchronous transactions between binder client/server pairs
+ *
+ * Every pair is a client process calling a server process over binder,
+ * one transaction at a time, the way most Android IPC is done. The
+ * pairs run in parallel, so running 1, 2, 4, ... pairs up to the number
+ * of CPUs shows how transaction throughput scales with the cores in use.
+ *
+ * sg: large transactions, flattened or scatter-gathered
+ *
+ * Sends 4 KB to 1 MB payloads to a server, once copied into the
+ * transaction buffer as a Parcel would, and once passed in place as a
+ * buffer object with BC_TRANSACTION_SG, which saves the sender's copy.
+ *
+ * The benchmark becomes the binder context manager to introduce clients
+ * to servers, so servicemanager must not be running.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include "../../../drivers/staging/android/binder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* The most the driver maps, so that 1 MB transactions fit */
+#define BINDER_MAP_SIZE		(4 * 1024 * 1024)
+
+/* Transaction codes */
+enum {
+	REG_ADD = 1,		/* context manager: publish a server node */
+	REG_GET,		/* context manager: look up a server node */
+	BENCH_CALL,		/* server: reply with as many bytes as sent */
+	BENCH_SINK,		/* server: empty reply */
+	BENCH_DONE,		/* server, context manager: exit */
+};
+
+/* How clients pass their payload */
+enum xfer {
+	XFER_ECHO,		/* flat, and get as much back */
+	XFER_COPY,		/* flat after copying it into a parcel */
+	XFER_SG,		/* as a buffer object */
+};
+
+/* What libbinder's flatten_binder() sets on every local binder */
+#define LIBBINDER_NODE_FLAGS	(0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS)
+
+static const char *binder_dev = "/dev/binder";
+static int nr_pairs;
+static int pingpong_loops = 100000;
+static int pingpong_size = 16;
+static int sg_loops = 2000;
+static int sg_size;
+
+/* What the clients of the current round do */
+static int loops;
+static int payload;
+static enum xfer xfer;
+
+static const struct option pingpong_options[] = {
+	OPT_STRING('d', "device", &binder_dev, "path",
+		    "Specify the binder device (default: /dev/binder)"),
+	OPT_INTEGER('p', "pairs", &nr_pairs,
+		    "Specify number of client/server pairs (default: 1, 2, 4, ... online CPUs)"),
+	OPT_INTEGER('l', "loop", &pingpong_loops,
+		    "Specify number of transactions per pair"),
+	OPT_INTEGER('s', "size", &pingpong_size,
+		    "Specify bytes sent and replied per transaction"),
+	OPT_END()
+};
+
+static const char * const bench_binder_pingpong_usage[] = {
+	"perf bench binder pingpong <options>",
+	NULL
+};
+
+static const struct option sg_options[] = {
+	OPT_STRING('d', "device", &binder_dev, "path",
+		    "Specify the binder device (default: /dev/binder)"),
+	OPT_INTEGER('l', "loop", &sg_loops,
+		    "Specify number of transactions per size"),
+	OPT_INTEGER('s', "size", &sg_size,
+		    "Specify one payload size in bytes (default: 4 KB to 1 MB)"),
+	OPT_END()
+};
+
+static const char * const bench_binder_sg_usage[] = {
+	"perf bench binder sg <options>",
+	NULL
+};
+
+/*
+ * Every child reports to the parent through a pipe: once when it is set
+ * up, and for clients once more with the time their loop took.
+ */
+struct child_msg {
+	int			err;
+	unsigned long long	ns;
+};
+
+static int status_fd = -1;
+
+static void child_report(int err, unsigned long long ns)
+{
+	struct child_msg msg = { err, ns };
+
+	if (write(status_fd, &msg, sizeof(msg)) != sizeof(msg))
+		exit(1);
+}
+
+static void child_fail(const char *what)
+{
+	fprintf(stderr, "%s: %s\n", what, strerror(errno));
+	child_report(1, 0);
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Binder plumbing. Every process here is single threaded, so commands
+ * are queued in one buffer and go to the driver with the next read,
+ * as libbinder does.
+ */
+static unsigned char wbuf[512];
+static size_t wlen;
+static uint32_t rbuf[256];
+static uint32_t *rpos, *rend;
+
+static int binder_open_dev(void)
+{
+	struct binder_version version;
+	int fd;
+
+	fd = open(binder_dev, O_RDWR);
+	if (fd < 0)
+		child_fail(binder_dev);
+	if (ioctl(fd, BINDER_VERSION, &version) < 0)
+		child_fail("BINDER_VERSION");
+	if (version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		errno = EPROTO;
+		child_fail("BINDER_VERSION");
+	}
+	if (mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED)
+		child_fail("mmap");
+
+	wlen = 0;
+	rpos = rend = rbuf;
+	return fd;
+}
+
+static void binder_queue(uint32_t cmd, const void *arg, size_t size)
+{
+	if (wlen + sizeof(cmd) + size > sizeof(wbuf)) {
+		errno = ENOBUFS;
+		child_fail("binder_queue");
+	}
+	memcpy(wbuf + wlen, &cmd, sizeof(cmd));
+	if (size)
+		memcpy(wbuf + wlen + sizeof(cmd), arg, size);
+	wlen += sizeof(cmd) + size;
+}
+
+static void binder_queue_handle(uint32_t cmd, uint32_t handle)
+{
+	binder_queue(cmd, &handle, sizeof(handle));
+}
+
+static void binder_queue_free(const void *buffer)
+{
+	binder_queue(BC_FREE_BUFFER, &buffer, sizeof(buffer));
+}
+
+/* Send the queued commands, and read more returns if do_read is set */
+static void binder_io(int fd, int do_read)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	do {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.write_size = wlen;
+		bwr.write_buffer = (unsigned long)wbuf;
+		if (do_read) {
+			bwr.read_size = sizeof(rbuf);
+			bwr.read_buffer = (unsigned long)rbuf;
+		}
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+
+		/* An interrupted read has still consumed the commands */
+		wlen -= bwr.write_consumed;
+		memmove(wbuf, wbuf + bwr.write_consumed, wlen);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		child_fail("BINDER_WRITE_READ");
+
+	rpos = rbuf;
+	rend = (uint32_t *)((char *)rbuf + bwr.read_consumed);
+}
+
+/*
+ * Return the next return command that needs the caller's attention,
+ * with its argument at *arg. Reference counting on our own nodes is
+ * acknowledged here.
+ */
+static uint32_t binder_next(int fd, void **arg)
+{
+	struct binder_ptr_cookie *pc;
+	uint32_t cmd;
+
+	for (;;) {
+		if (rpos >= rend)
+			binder_io(fd, 1);
+		if (rpos >= rend)
+			continue;
+
+		cmd = *rpos++;
+		*arg = rpos;
+		rpos = (uint32_t *)((char *)rpos + _IOC_SIZE(cmd));
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+		case BR_RELEASE:
+		case BR_DECREFS:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			pc = *arg;
+			binder_queue(cmd == BR_INCREFS ?
+				     BC_INCREFS_DONE : BC_ACQUIRE_DONE,
+				     pc, sizeof(*pc));
+			break;
+		default:
+			return cmd;
+		}
+	}
+}
+
+/*
+ * Make a synchronous call, with BC_TRANSACTION_SG if buffers_size has
+ * room for buffer objects. The reply stays valid until the caller
+ * queues it to be freed with binder_queue_free().
+ */
+static int binder_call(int fd, uint32_t handle, uint32_t code,
+		       const void *data, size_t size,
+		       const size_t *offsets, size_t offsets_size,
+		       size_t buffers_size,
+		       struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data_sg sg;
+	struct binder_transaction_data *tr = &sg.transaction_data;
+	void *arg;
+	uint32_t cmd;
+
+	memset(&sg, 0, sizeof(sg));
+	tr->target.handle = handle;
+	tr->code = code;
+	tr->flags = TF_ACCEPT_FDS;
+	tr->data_size = size;
+	tr->offsets_size = offsets_size;
+	tr->data.ptr.buffer = data;
+	tr->data.ptr.offsets = offsets;
+	if (buffers_size) {
+		sg.buffers_size = buffers_size;
+		binder_queue(BC_TRANSACTION_SG, &sg, sizeof(sg));
+	} else {
+		binder_queue(BC_TRANSACTION, tr, sizeof(*tr));
+	}
+
+	for (;;) {
+		cmd = binder_next(fd, &arg);
+		switch (cmd) {
+		case BR_REPLY:
+			memcpy(reply, arg, sizeof(*reply));
+			return 0;
+		case BR_FAILED_REPLY:
+		case BR_DEAD_REPLY:
+			return -1;
+		default:
+			errno = EPROTO;
+			child_fail("unexpected binder return");
+		}
+	}
+}
+
+/* Free a received transaction and answer it */
+static void binder_reply(const struct binder_transaction_data *txn,
+			 const void *data, size_t size,
+			 const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	binder_queue_free(txn->data.ptr.buffer);
+
+	memset(&tr, 0, sizeof(tr));
+	tr.data_size = size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	binder_queue(BC_REPLY, &tr, sizeof(tr));
+}
+
+/*
+ * The context manager is a tiny service registry: servers publish
+ * their node under an id with REG_ADD, clients get a handle to it with
+ * REG_GET.
+ */
+struct reg_msg {
+	unsigned long			id;
+	struct flat_binder_object	obj;
+};
+
+static const size_t reg_msg_offset = offsetof(struct reg_msg, obj);
+
+static void registry(int max_id, int unused __used)
+{
+	struct binder_transaction_data *txn;
+	struct reg_msg *msg;
+	static struct reg_msg reply;
+	uint32_t *handles, cmd;
+	void *arg;
+	int fd;
+
+	handles = calloc(max_id, sizeof(*handles));
+	if (!handles)
+		child_fail("calloc");
+
+	fd = binder_open_dev();
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		child_fail("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+	binder_queue(BC_ENTER_LOOPER, NULL, 0);
+	binder_io(fd, 0);
+	child_report(0, 0);
+
+	for (;;) {
+		cmd = binder_next(fd, &arg);
+		if (cmd != BR_TRANSACTION) {
+			errno = EPROTO;
+			child_fail("unexpected binder return");
+		}
+		txn = arg;
+		msg = (struct reg_msg *)txn->data.ptr.buffer;
+
+		if (txn->code == BENCH_DONE) {
+			binder_reply(txn, NULL, 0, NULL, 0);
+			binder_io(fd, 0);
+			exit(0);
+		}
+		if (txn->data_size < sizeof(*msg) || msg->id >= (unsigned)max_id) {
+			binder_reply(txn, NULL, 0, NULL, 0);
+			continue;
+		}
+
+		if (txn->code == REG_ADD &&
+		    txn->offsets_size == sizeof(size_t) &&
+		    msg->obj.type == BINDER_TYPE_HANDLE) {
+			/* Keep the node alive once the buffer is freed */
+			binder_queue_handle(BC_ACQUIRE, msg->obj.handle);
+			if (handles[msg->id])
+				binder_queue_handle(BC_RELEASE,
+						    handles[msg->id]);
+			handles[msg->id] = msg->obj.handle;
+			binder_reply(txn, NULL, 0, NULL, 0);
+		} else if (txn->code == REG_GET && handles[msg->id]) {
+			memset(&reply, 0, sizeof(reply));
+			reply.id = msg->id;
+			reply.obj.type = BINDER_TYPE_HANDLE;
+			reply.obj.handle = handles[msg->id];
+			binder_reply(txn, &reply, sizeof(reply),
+				     &reg_msg_offset, sizeof(reg_msg_offset));
+		} else {
+			binder_reply(txn, NULL, 0, NULL, 0);
+		}
+	}
+}
+
+static char *payload_buf, *parcel_buf;
+static int start_pipe[2] = { -1, -1 };
+
+/* Publish a node as pair 'id' and answer calls on it until BENCH_DONE */
+static void bench_server(int id, int unused __used)
+{
+	struct binder_transaction_data *txn, reply;
+	struct reg_msg msg;
+	uint32_t cmd;
+	void *arg;
+	int fd;
+
+	fd = binder_open_dev();
+	binder_queue(BC_ENTER_LOOPER, NULL, 0);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.id = id;
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.flags = LIBBINDER_NODE_FLAGS;
+	msg.obj.binder = &payload_buf;
+	msg.obj.cookie = &payload_buf;
+	if (binder_call(fd, 0, REG_ADD, &msg, sizeof(msg),
+			&reg_msg_offset, sizeof(reg_msg_offset), 0, &reply)) {
+		errno = ECONNREFUSED;
+		child_fail("REG_ADD");
+	}
+	binder_queue_free(reply.data.ptr.buffer);
+	binder_io(fd, 0);
+	child_report(0, 0);
+
+	for (;;) {
+		cmd = binder_next(fd, &arg);
+		if (cmd != BR_TRANSACTION) {
+			errno = EPROTO;
+			child_fail("unexpected binder return");
+		}
+		txn = arg;
+		if (txn->code == BENCH_DONE) {
+			binder_reply(txn, NULL, 0, NULL, 0);
+			binder_io(fd, 0);
+			exit(0);
+		}
+		if (txn->code == BENCH_CALL)
+			binder_reply(txn, payload_buf,
+				     txn->data_size > (size_t)payload ?
+				     (size_t)payload : txn->data_size, NULL, 0);
+		else
+			binder_reply(txn, NULL, 0, NULL, 0);
+	}
+}
+
+static const size_t sg_offset;
+
+/* One call of the round's kind */
+static int client_call(int fd, uint32_t handle,
+		       struct binder_transaction_data *reply)
+{
+	struct binder_buffer_object *bp;
+
+	switch (xfer) {
+	case XFER_ECHO:
+		return binder_call(fd, handle, BENCH_CALL, payload_buf,
+				   payload, NULL, 0, 0, reply);
+	case XFER_COPY:
+		/* What marshalling the payload into a Parcel costs */
+		memcpy(parcel_buf, payload_buf, payload);
+		return binder_call(fd, handle, BENCH_SINK, parcel_buf,
+				   payload, NULL, 0, 0, reply);
+	case XFER_SG:
+		bp = (struct binder_buffer_object *)parcel_buf;
+		memset(bp, 0, sizeof(*bp));
+		bp->type = BINDER_TYPE_PTR;
+		bp->buffer = payload_buf;
+		bp->length = payload;
+		return binder_call(fd, handle, BENCH_SINK, bp, sizeof(*bp),
+				   &sg_offset, sizeof(sg_offset),
+				   ALIGN(payload, sizeof(void *)), reply);
+	default:
+		errno = EINVAL;
+		child_fail("client_call");
+		return -1;
+	}
+}
+
+/* Get pair 'id's server, wait for the start and call it 'loops' times */
+static void bench_client(int id, int unused __used)
+{
+	struct binder_transaction_data reply;
+	struct reg_msg msg;
+	unsigned long long start;
+	uint32_t handle;
+	char c;
+	int fd, i;
+
+	close(start_pipe[1]);
+	fd = binder_open_dev();
+
+	memset(&msg, 0, sizeof(msg));
+	msg.id = id;
+	if (binder_call(fd, 0, REG_GET, &msg, sizeof(msg), NULL, 0, 0,
+			&reply) ||
+	    reply.data_size < sizeof(msg) || reply.offsets_size != sizeof(size_t)) {
+		errno = ENOENT;
+		child_fail("REG_GET");
+	}
+	handle = ((const struct reg_msg *)reply.data.ptr.buffer)->obj.handle;
+	binder_queue_handle(BC_ACQUIRE, handle);
+	binder_queue_free(reply.data.ptr.buffer);
+	binder_io(fd, 0);
+	child_report(0, 0);
+
+	if (read(start_pipe[0], &c, 1) < 0)
+		child_fail("read");
+
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		if (client_call(fd, handle, &reply)) {
+			errno = ECONNRESET;
+			child_fail("BENCH_CALL");
+		}
+		binder_queue_free(reply.data.ptr.buffer);
+	}
+	child_report(0, now_ns() - start);
+
+	binder_call(fd, handle, BENCH_DONE, NULL, 0, NULL, 0, 0, &reply);
+	binder_queue_free(reply.data.ptr.buffer);
+	binder_io(fd, 0);
+	exit(0);
+}
+
+static pid_t *children;
+static int nr_children;
+
+static void fork_child(void (*fn)(int, int), int id, int arg)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		fn(id, arg);
+		exit(0);
+	}
+	children[nr_children++] = pid;
+}
+
+/* Wait for one report from each of n children */
+static int collect(int fd, int n, unsigned long long *ns)
+{
+	struct child_msg msg;
+	int err = 0;
+
+	while (n--) {
+		if (read(fd, &msg, sizeof(msg)) != sizeof(msg))
+			return -1;
+		if (msg.err)
+			err = -1;
+		if (ns)
+			*ns += msg.ns;
+	}
+	return err;
+}
+
+static void reap(int first, int kill_them)
+{
+	int i, status;
+
+	for (i = nr_children - 1; i >= first; i--) {
+		if (kill_them)
+			kill(children[i], SIGKILL);
+		waitpid(children[i], &status, 0);
+	}
+	nr_children = first;
+}
+
+/* Run one round with n pairs, returns transactions per second */
+static double bench_round(int n, int status_rd, double *usecs)
+{
+	unsigned long long start, elapsed, client_ns = 0;
+	int first = nr_children, i;
+
+	for (i = 0; i < n; i++)
+		fork_child(bench_server, i, 0);
+	if (collect(status_rd, n, NULL))
+		goto fail;
+
+	/* Created after the servers fork, so only clients inherit it */
+	if (pipe(start_pipe))
+		die("pipe");
+	for (i = 0; i < n; i++)
+		fork_child(bench_client, i, 0);
+	close(start_pipe[0]);
+	if (collect(status_rd, n, NULL))
+		goto fail;
+
+	/* Closing the pipe releases all clients at once */
+	start = now_ns();
+	close(start_pipe[1]);
+	start_pipe[1] = -1;
+	if (collect(status_rd, n, &client_ns))
+		goto fail;
+	elapsed = now_ns() - start;
+
+	reap(first, 0);
+	*usecs = (double)client_ns / n / loops / 1000;
+	return (double)n * loops / ((double)elapsed / 1e9);
+
+fail:
+	if (start_pipe[1] >= 0)
+		close(start_pipe[1]);
+	reap(first, 1);
+	return -1;
+}
+
+int bench_binder_pingpong(int argc, const char **argv,
+			  const char *prefix __used)
+{
+	int status_pipe[2], nr_cpus, max_pairs, n, err = 0;
+	double rate, usecs;
+
+	argc = parse_options(argc, argv, pingpong_options,
+			     bench_binder_pingpong_usage, 0);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	max_pairs = nr_pairs > 0 ? nr_pairs : nr_cpus;
+	loops = pingpong_loops;
+	payload = pingpong_size;
+	xfer = XFER_ECHO;
+	if (loops <= 0 || payload < 0 || payload > BINDER_MAP_SIZE / 4)
+		usage_with_options(bench_binder_pingpong_usage,
+				   pingpong_options);
+
+	payload_buf = zalloc(payload + 1);
+	children = zalloc((2 * max_pairs + 1) * sizeof(*children));
+	if (!payload_buf || !children)
+		die("zalloc");
+	if (pipe(status_pipe))
+		die("pipe");
+	status_fd = status_pipe[1];
+
+	fork_child(registry, max_pairs, 0);
+	if (collect(status_pipe[0], 1, NULL)) {
+		reap(0, 1);
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d transactions of %d bytes per pair, %d CPUs online\n\n"
+		       " %14s %14s %14s\n", loops, payload, nr_cpus,
+		       "pairs", "txns/sec", "usecs/txn");
+
+	n = nr_pairs > 0 ? nr_pairs : 1;
+	for (;;) {
+		rate = bench_round(n, status_pipe[0], &usecs);
+		if (rate < 0) {
+			fprintf(stderr, "pingpong with %d pairs failed\n", n);
+			err = 1;
+			break;
+		}
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %14d %14.0f %14.2f\n", n, rate, usecs);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%d %.0f\n", n, rate);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+
+		if (n == max_pairs)
+			break;
+		n = n * 2 < max_pairs ? n * 2 : max_pairs;
+	}
+
+	/* The registry is the only child left */
+	reap(0, 1);
+	free(children);
+	free(payload_buf);
+	close(status_pipe[0]);
+	close(status_pipe[1]);
+	return err;
+}
+
+static const int sg_sizes[] = {
+	4096, 16384, 65536, 262144, 1048576,
+};
+
+int bench_binder_sg(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	int status_pipe[2], max_size, i, n, err = 0;
+	double rate[2], usecs[2];
+
+	argc = parse_options(argc, argv, sg_options,
+			     bench_binder_sg_usage, 0);
+
+	n = sg_size ? 1 : ARRAY_SIZE(sg_sizes);
+	max_size = sg_size ? sg_size : sg_sizes[n - 1];
+	loops = sg_loops;
+	if (loops <= 0 || max_size < 0 || max_size > BINDER_MAP_SIZE / 4)
+		usage_with_options(bench_binder_sg_usage, sg_options);
+
+	payload_buf = malloc(max_size + 1);
+	parcel_buf = malloc(max_size + sizeof(struct binder_buffer_object));
+	children = zalloc(3 * sizeof(*children));
+	if (!payload_buf || !parcel_buf || !children)
+		die("malloc");
+	memset(payload_buf, 0x5a, max_size + 1);
+	memset(parcel_buf, 0, max_size + sizeof(struct binder_buffer_object));
+	if (pipe(status_pipe))
+		die("pipe");
+	status_fd = status_pipe[1];
+
+	fork_child(registry, 1, 0);
+	if (collect(status_pipe[0], 1, NULL)) {
+		reap(0, 1);
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d transactions per size, copied into the "
+		       "transaction or sent as a buffer object\n\n"
+		       " %10s %12s %12s %12s %12s\n", loops, "bytes",
+		       "copy MB/s", "sg MB/s", "copy usecs", "sg usecs");
+
+	for (i = 0; i < n; i++) {
+		payload = sg_size ? sg_size : sg_sizes[i];
+
+		xfer = XFER_COPY;
+		rate[0] = bench_round(1, status_pipe[0], &usecs[0]);
+		xfer = XFER_SG;
+		rate[1] = rate[0] < 0 ? -1 :
+			bench_round(1, status_pipe[0], &usecs[1]);
+		if (rate[1] < 0) {
+			fprintf(stderr, "sg with %d bytes failed\n", payload);
+			err = 1;
+			break;
+		}
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %10d %12.1f %12.1f %12.2f %12.2f\n", payload,
+			       rate[0] * payload / (1 << 20),
+			       rate[1] * payload / (1 << 20),
+			       usecs[0], usecs[1]);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%d %.1f %.1f\n", payload,
+			       rate[0] * payload / (1 << 20),
+			       rate[1] * payload / (1 << 20));
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+	}
+
+	reap(0, 1);
+	free(children);
+	free(parcel_buf);
+	free(payload_buf);
+	close(status_pipe[0]);
+	close(status_pipe[1]);
+	return err;
+}
@@ -0,0 +1,291 @@
+/*
+ *
+ * lmk-stress.c
+ *
+ * stress: lowmemorykiller cost per shrinker call under memory pressure
+ *
+ * Forks a population of tasks at the highest oom_adj, optionally
+ * rewriting their oom_adj all the time, then allocates memory until the
+ * lowmemorykiller has killed a number of them. Reports how many times
+ * the shrinker looked for victims meanwhile and the time it took per
+ * call, from the scan_calls and scan_ns statistics of the driver.
+ *
+ * This kills processes: run it on a test device only.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define LMK_PARAMS	"/sys/module/lowmemorykiller/parameters/"
+#define VICTIM_ADJ	15	/* OOM_ADJUST_MAX: the first ones to go */
+#define CHUNK_SIZE	(1 << 20)
+
+static int nr_tasks = 64;
+static int size_kb = 1024;
+static int nr_kills = 16;
+static int timeout = 60;
+static int max_mb;
+static bool churn;
+
+static const struct option options[] = {
+	OPT_INTEGER('n', "tasks", &nr_tasks,
+		    "Specify number of tasks at oom_adj 15"),
+	OPT_INTEGER('s', "size", &size_kb,
+		    "Specify KB touched by the smallest task (others 2-4x)"),
+	OPT_BOOLEAN('c', "churn", &churn,
+		    "Keep moving the tasks between oom_adj 14 and 15"),
+	OPT_INTEGER('k', "kills", &nr_kills,
+		    "Stop after this many tasks were killed"),
+	OPT_INTEGER('t', "timeout", &timeout,
+		    "Stop after this many seconds"),
+	OPT_INTEGER('m', "max", &max_mb,
+		    "Specify most MB to allocate (default: all RAM)"),
+	OPT_END()
+};
+
+static const char * const bench_lmk_stress_usage[] = {
+	"perf bench lmk stress <options>",
+	NULL
+};
+
+static int read_stat(const char *name, unsigned long long *val)
+{
+	char path[128], buf[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), LMK_PARAMS "%s", name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+	*val = strtoull(buf, NULL, 10);
+	return 0;
+}
+
+static int set_oom_adj(int fd, int adj)
+{
+	char buf[8];
+	int len = snprintf(buf, sizeof(buf), "%d", adj);
+
+	return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+/*
+ * Touch a little memory, become a candidate, and wait to be killed.
+ * Writes 'r' to ready_fd once set up, or 'e' if that failed.
+ */
+static void victim(int id, int ready_fd)
+{
+	size_t size = (size_t)size_kb * 1024 * (1 + id % 4);
+	char *mem;
+	int fd;
+	int __used ret;
+
+	mem = malloc(size);
+	fd = open("/proc/self/oom_adj", O_WRONLY);
+	if (!mem || fd < 0 || set_oom_adj(fd, VICTIM_ADJ)) {
+		ret = write(ready_fd, "e", 1);
+		exit(1);
+	}
+	memset(mem, id + 1, size);
+	if (write(ready_fd, "r", 1) != 1)
+		exit(1);
+
+	for (;;) {
+		if (!churn) {
+			pause();
+			continue;
+		}
+		if (set_oom_adj(fd, VICTIM_ADJ - 1) ||
+		    set_oom_adj(fd, VICTIM_ADJ))
+			exit(1);
+		usleep(1000);
+	}
+}
+
+/* Allocate and touch memory a chunk at a time, up to max_mb */
+static void pressure(void)
+{
+	char *chunk;
+	int mb;
+
+	for (mb = 0; mb < max_mb; mb++) {
+		chunk = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+			break;
+		memset(chunk, 0x5a, CHUNK_SIZE);
+	}
+	for (;;)
+		pause();
+}
+
+static volatile sig_atomic_t timed_out;
+
+static void alarm_handler(int sig __used)
+{
+	timed_out = 1;
+}
+
+int bench_lmk_stress(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned long long calls[2], ns[2], start, elapsed;
+	struct sigaction sa;
+	struct timespec ts;
+	pid_t *victims, pressure_pid, pid;
+	int ready[2], killed = 0, status, i;
+	char c;
+
+	argc = parse_options(argc, argv, options,
+			     bench_lmk_stress_usage, 0);
+
+	if (nr_tasks <= 0 || size_kb <= 0 || nr_kills <= 0 || timeout <= 0)
+		usage_with_options(bench_lmk_stress_usage, options);
+	if (nr_kills > nr_tasks)
+		nr_kills = nr_tasks;
+	if (max_mb <= 0)
+		max_mb = (unsigned long long)sysconf(_SC_PHYS_PAGES) *
+			sysconf(_SC_PAGESIZE) >> 20;
+
+	if (read_stat("scan_calls", &calls[0]) ||
+	    read_stat("scan_ns", &ns[0])) {
+		fprintf(stderr, "Cannot read " LMK_PARAMS "scan_calls and "
+			"scan_ns: %s\n", strerror(errno));
+		return 1;
+	}
+
+	victims = zalloc(nr_tasks * sizeof(*victims));
+	if (!victims)
+		die("zalloc");
+	if (pipe(ready))
+		die("pipe");
+
+	fflush(stdout);
+	for (i = 0; i < nr_tasks; i++) {
+		victims[i] = fork();
+		if (victims[i] < 0)
+			die("fork");
+		if (!victims[i]) {
+			close(ready[0]);
+			victim(i, ready[1]);
+		}
+	}
+	close(ready[1]);
+	for (i = 0; i < nr_tasks; i++) {
+		if (read(ready[0], &c, 1) != 1 || c != 'r') {
+			fprintf(stderr, "Cannot set up the tasks\n");
+			for (i = 0; i < nr_tasks; i++) {
+				kill(victims[i], SIGKILL);
+				waitpid(victims[i], &status, 0);
+			}
+			free(victims);
+			return 1;
+		}
+	}
+	close(ready[0]);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = alarm_handler;
+	sigaction(SIGALRM, &sa, NULL);
+	alarm(timeout);
+
+	read_stat("scan_calls", &calls[0]);
+	read_stat("scan_ns", &ns[0]);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	pressure_pid = fork();
+	if (pressure_pid < 0)
+		die("fork");
+	if (!pressure_pid)
+		pressure();
+
+	while (killed < nr_kills && !timed_out) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pid == pressure_pid) {
+			/* The pressure went first: nothing left to kill */
+			pressure_pid = 0;
+			break;
+		}
+		for (i = 0; i < nr_tasks; i++)
+			if (victims[i] == pid)
+				victims[i] = 0;
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+			killed++;
+	}
+	alarm(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	elapsed = ts.tv_sec * 1000000000ULL + ts.tv_nsec - start;
+	read_stat("scan_calls", &calls[1]);
+	read_stat("scan_ns", &ns[1]);
+
+	if (pressure_pid) {
+		kill(pressure_pid, SIGKILL);
+		waitpid(pressure_pid, &status, 0);
+	}
+	for (i = 0; i < nr_tasks; i++) {
+		if (!victims[i])
+			continue;
+		kill(victims[i], SIGKILL);
+		waitpid(victims[i], &status, 0);
+	}
+	free(victims);
+
+	calls[1] -= calls[0];
+	ns[1] -= ns[0];
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d tasks of %d-%d KB at oom_adj %d, oom_adj churn %s\n\n",
+		       nr_tasks, size_kb, size_kb * 4, VICTIM_ADJ,
+		       churn ? "on" : "off");
+		printf(" %14s: %d tasks in %llu.%03llu sec%s\n", "Killed",
+		       killed, elapsed / 1000000000ULL,
+		       (elapsed / 1000000ULL) % 1000,
+		       timed_out ? " (timed out)" : "");
+		printf(" %14s: %llu\n", "Scan calls", calls[1]);
+		printf(" %14s: %llu ns, %llu ns/call\n", "Scan time", ns[1],
+		       calls[1] ? ns[1] / calls[1] : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", calls[1] ? ns[1] / calls[1] : 0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
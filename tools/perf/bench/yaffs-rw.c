@@ -0,0 +1,352 @@
+/*
+ *
+ * yaffs-rw.c
+ *
+ * rw: parallel file I/O on a yaffs2 mount
+ *
+ * Every thread writes, fsyncs, then reads back its own file in a
+ * directory of a yaffs2 file system, typically one mounted on nandsim.
+ * Before reading, the files are dropped from the page cache so that the
+ * reads reach yaffs. With --mixed, a third pass has half of the threads
+ * rewrite their file while the other half read theirs: the rewrites
+ * leave garbage behind, so the readers run against writers and GC at
+ * once. Reports the throughput of every pass and the per-I/O latency.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/* Per-I/O latency histogram: bucket i counts [2^i, 2^(i+1)) ns */
+#define LAT_BUCKETS	32
+
+enum {
+	PASS_WRITE,
+	PASS_READ,
+	PASS_MIXED_WRITE,
+	PASS_MIXED_READ,
+	NR_PASSES
+};
+
+static const char *dir = "/mnt/yaffs";
+static int nr_threads;
+static int size_kb = 4096;
+static int io_size = 4096;
+static bool no_read;
+static bool mixed;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &dir, "path",
+		    "Specify a directory on yaffs2 (default: /mnt/yaffs)"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads (default: online CPUs)"),
+	OPT_INTEGER('s', "size", &size_kb,
+		    "Specify KB written and read by each thread"),
+	OPT_INTEGER('b', "block", &io_size,
+		    "Specify bytes per read() or write() (default: 4096)"),
+	OPT_BOOLEAN('w', "write-only", &no_read,
+		    "Skip the read passes"),
+	OPT_BOOLEAN('m', "mixed", &mixed,
+		    "Add a pass of half the threads rewriting, half reading"),
+	OPT_END()
+};
+
+static const char * const bench_yaffs_rw_usage[] = {
+	"perf bench yaffs rw <options>",
+	NULL
+};
+
+struct rw_pass {
+	unsigned long long	ios;
+	unsigned long long	total_ns;
+	unsigned long long	max_ns;
+	unsigned long long	hist[LAT_BUCKETS];
+};
+
+struct rw_thread {
+	pthread_t		thread;
+	int			id;
+	int			fd;
+	size_t			ios;
+	struct rw_pass		pass[NR_PASSES];
+	int			err;
+};
+
+static pthread_barrier_t rw_barrier;
+static struct timespec pass_start[NR_PASSES], pass_stop[NR_PASSES];
+
+static unsigned long long ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_ns(&ts);
+}
+
+static void pass_add(struct rw_pass *p, unsigned long long ns)
+{
+	int b = 0;
+
+	while (b < LAT_BUCKETS - 1 && (ns >> (b + 1)))
+		b++;
+	p->hist[b]++;
+	p->ios++;
+	p->total_ns += ns;
+	if (ns > p->max_ns)
+		p->max_ns = ns;
+}
+
+/* Contents that differ between threads, blocks and rewrites */
+static void fill_block(char *buf, int id, size_t block, int gen)
+{
+	size_t i;
+
+	for (i = 0; i < (size_t)io_size; i++)
+		buf[i] = (char)(id * 31 + block * 7 + gen + i);
+}
+
+static int rw_one_pass(struct rw_thread *t, char *buf, int pass)
+{
+	struct rw_pass *p = &t->pass[pass];
+	int write_pass = pass == PASS_WRITE || pass == PASS_MIXED_WRITE;
+	unsigned long long start;
+	ssize_t ret;
+	size_t i;
+	off_t off;
+
+	for (i = 0; i < t->ios; i++) {
+		off = (off_t)i * io_size;
+		if (write_pass)
+			fill_block(buf, t->id, i, pass);
+
+		start = now_ns();
+		if (write_pass)
+			ret = pwrite(t->fd, buf, io_size, off);
+		else
+			ret = pread(t->fd, buf, io_size, off);
+		pass_add(p, now_ns() - start);
+
+		if (ret != io_size)
+			return ret < 0 ? -errno : -EIO;
+	}
+
+	if (write_pass && fsync(t->fd))
+		return -errno;
+
+	return 0;
+}
+
+/* Make the next reads of the file go to yaffs, not the page cache */
+static int drop_cache(struct rw_thread *t)
+{
+	int err = posix_fadvise(t->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	return err ? -err : 0;
+}
+
+static void *rw_worker(void *arg)
+{
+	struct rw_thread *t = arg;
+	char *buf;
+	int pass;
+
+	buf = malloc(io_size);
+	if (!buf)
+		t->err = -ENOMEM;
+
+	/* Every thread starts and ends a pass together */
+	pthread_barrier_wait(&rw_barrier);
+	if (!t->err)
+		t->err = rw_one_pass(t, buf, PASS_WRITE);
+	if (!t->err)
+		t->err = drop_cache(t);
+	pthread_barrier_wait(&rw_barrier);
+
+	if (!no_read) {
+		pthread_barrier_wait(&rw_barrier);
+		if (!t->err)
+			t->err = rw_one_pass(t, buf, PASS_READ);
+		if (!t->err)
+			t->err = drop_cache(t);
+		pthread_barrier_wait(&rw_barrier);
+	}
+
+	if (mixed) {
+		pass = t->id % 2 ? PASS_MIXED_READ : PASS_MIXED_WRITE;
+		pthread_barrier_wait(&rw_barrier);
+		if (!t->err)
+			t->err = rw_one_pass(t, buf, pass);
+		pthread_barrier_wait(&rw_barrier);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void print_pass(const char *name, struct rw_thread *threads,
+		       int pass, int run)
+{
+	struct rw_pass sum;
+	unsigned long long elapsed;
+	int i, b;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < nr_threads; i++) {
+		struct rw_pass *p = &threads[i].pass[pass];
+
+		sum.ios += p->ios;
+		sum.total_ns += p->total_ns;
+		if (p->max_ns > sum.max_ns)
+			sum.max_ns = p->max_ns;
+		for (b = 0; b < LAT_BUCKETS; b++)
+			sum.hist[b] += p->hist[b];
+	}
+	if (!sum.ios)
+		return;
+	elapsed = ts_ns(&pass_stop[run]) - ts_ns(&pass_start[run]);
+	if (!elapsed)
+		elapsed = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %llu I/Os in %llu.%03llu sec, %.1f MB/s\n",
+		       name, sum.ios, elapsed / 1000000000ULL,
+		       (elapsed / 1000000ULL) % 1000,
+		       (double)sum.ios * io_size /
+		       (1 << 20) / ((double)elapsed / 1e9));
+		printf(" %14s  per I/O: mean %llu ns, max %llu ns\n", "",
+		       sum.total_ns / sum.ios, sum.max_ns);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			if (sum.hist[b])
+				printf(" %14s  < %10llu ns: %llu\n", "",
+				       2ULL << b, sum.hist[b]);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.1f\n", (double)sum.ios * io_size /
+		       (1 << 20) / ((double)elapsed / 1e9));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+/* Let the threads through one pass, timing it as pass number run */
+static void run_pass(int run)
+{
+	clock_gettime(CLOCK_MONOTONIC, &pass_start[run]);
+	pthread_barrier_wait(&rw_barrier);
+	pthread_barrier_wait(&rw_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &pass_stop[run]);
+}
+
+int bench_yaffs_rw(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct rw_thread *threads;
+	char path[PATH_MAX];
+	int i, err = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_yaffs_rw_usage, 0);
+
+	if (nr_threads <= 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (size_kb <= 0 || io_size <= 0 ||
+	    (long long)size_kb * 1024 < io_size)
+		usage_with_options(bench_yaffs_rw_usage, options);
+	if (no_read)
+		mixed = false;
+
+	threads = zalloc(nr_threads * sizeof(*threads));
+	if (!threads)
+		die("zalloc");
+
+	for (i = 0; i < nr_threads; i++) {
+		snprintf(path, sizeof(path), "%s/yaffs-rw.%d.%d", dir,
+			 getpid(), i);
+		threads[i].fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (threads[i].fd < 0) {
+			fprintf(stderr, "Cannot create %s: %s\n", path,
+				strerror(errno));
+			err = 1;
+			break;
+		}
+		threads[i].id = i;
+		threads[i].ios = (size_t)size_kb * 1024 / io_size;
+	}
+	if (err)
+		goto out;
+
+	pthread_barrier_init(&rw_barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i].thread, NULL, rw_worker,
+				   &threads[i]))
+			die("pthread_create");
+
+	run_pass(PASS_WRITE);
+	if (!no_read)
+		run_pass(PASS_READ);
+	if (mixed)
+		run_pass(PASS_MIXED_WRITE);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].err && !err)
+			err = threads[i].err;
+	}
+
+	if (err) {
+		fprintf(stderr, "I/O in %s failed: %s\n", dir,
+			strerror(-err));
+		err = 1;
+		goto out;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d threads, %d KB each, %d byte I/Os in %s\n\n",
+		       nr_threads, size_kb, io_size, dir);
+	print_pass("Write", threads, PASS_WRITE, PASS_WRITE);
+	if (!no_read)
+		print_pass("Read", threads, PASS_READ, PASS_READ);
+	if (mixed) {
+		/* Both halves of the mixed pass ran in the same interval */
+		print_pass("Mixed write", threads, PASS_MIXED_WRITE,
+			   PASS_MIXED_WRITE);
+		print_pass("Mixed read", threads, PASS_MIXED_READ,
+			   PASS_MIXED_WRITE);
+	}
+
+out:
+	for (i = 0; i < nr_threads; i++) {
+		if (threads[i].fd <= 0)
+			continue;
+		close(threads[i].fd);
+		snprintf(path, sizeof(path), "%s/yaffs-rw.%d.%d", dir,
+			 getpid(), i);
+		unlink(path);
+	}
+	free(threads);
+	return err;
+}
@@ -0,0 +1,315 @@
+/*
+ *
+ * zram-rw.c
+ *
+ * rw: parallel page I/O against a zram device
+ *
+ * Every thread writes, then reads back, its own slice of the device one
+ * page at a time with O_DIRECT, so that each request is a single page
+ * compressed or decompressed by zram. Reports the throughput of both
+ * passes and the per-page latency.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+/* Per-page latency histogram: bucket i counts [2^i, 2^(i+1)) ns */
+#define LAT_BUCKETS	32
+
+static const char *device = "/dev/zram0";
+static int nr_threads;
+static int size_mb = 32;
+static bool no_read;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "path",
+		    "Specify the zram device (default: /dev/zram0)"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads (default: online CPUs)"),
+	OPT_INTEGER('s', "size", &size_mb,
+		    "Specify MB written and read by each thread"),
+	OPT_BOOLEAN('w', "write-only", &no_read,
+		    "Skip the read pass"),
+	OPT_END()
+};
+
+static const char * const bench_zram_rw_usage[] = {
+	"perf bench zram rw <options>",
+	NULL
+};
+
+struct rw_pass {
+	unsigned long long	pages;
+	unsigned long long	total_ns;
+	unsigned long long	max_ns;
+	unsigned long long	hist[LAT_BUCKETS];
+};
+
+struct rw_thread {
+	pthread_t		thread;
+	int			id;
+	int			fd;
+	off_t			start;
+	size_t			pages;
+	size_t			page_size;
+	struct rw_pass		pass[2];	/* write, read */
+	int			err;
+};
+
+static pthread_barrier_t rw_barrier;
+static struct timespec pass_start[2], pass_stop[2];
+
+static unsigned long long ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_ns(&ts);
+}
+
+static void pass_add(struct rw_pass *p, unsigned long long ns)
+{
+	int b = 0;
+
+	while (b < LAT_BUCKETS - 1 && (ns >> (b + 1)))
+		b++;
+	p->hist[b]++;
+	p->pages++;
+	p->total_ns += ns;
+	if (ns > p->max_ns)
+		p->max_ns = ns;
+}
+
+/*
+ * Text-like, compressible page contents that differ from page to page,
+ * so that zram neither stores them as same-filled pages nor finds them
+ * already stored.
+ */
+static void fill_page(char *buf, size_t page_size, int id, size_t page)
+{
+	size_t i;
+	int len;
+
+	for (i = 0; i < page_size; i += len) {
+		len = snprintf(buf + i, page_size - i,
+			       "thread %d page %zu offset %zu: the quick brown "
+			       "fox jumps over the lazy dog\n", id, page, i);
+		if (len <= 0 || (size_t)len >= page_size - i)
+			break;
+	}
+}
+
+static int rw_one_pass(struct rw_thread *t, char *buf, int write_pass)
+{
+	struct rw_pass *p = &t->pass[write_pass ? 0 : 1];
+	unsigned long long start;
+	ssize_t ret;
+	size_t i;
+	off_t off;
+
+	for (i = 0; i < t->pages; i++) {
+		off = t->start + (off_t)i * t->page_size;
+		if (write_pass)
+			fill_page(buf, t->page_size, t->id, i);
+
+		start = now_ns();
+		if (write_pass)
+			ret = pwrite(t->fd, buf, t->page_size, off);
+		else
+			ret = pread(t->fd, buf, t->page_size, off);
+		pass_add(p, now_ns() - start);
+
+		if (ret != (ssize_t)t->page_size)
+			return ret < 0 ? -errno : -EIO;
+	}
+
+	return 0;
+}
+
+static void *rw_worker(void *arg)
+{
+	struct rw_thread *t = arg;
+	char *buf;
+
+	if (posix_memalign((void **)&buf, t->page_size, t->page_size))
+		t->err = -ENOMEM;
+
+	/* Every thread starts and ends a pass together */
+	pthread_barrier_wait(&rw_barrier);
+	if (!t->err)
+		t->err = rw_one_pass(t, buf, 1);
+	if (!t->err && fsync(t->fd))
+		t->err = -errno;
+	pthread_barrier_wait(&rw_barrier);
+
+	if (!no_read) {
+		pthread_barrier_wait(&rw_barrier);
+		if (!t->err)
+			t->err = rw_one_pass(t, buf, 0);
+		pthread_barrier_wait(&rw_barrier);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void print_pass(const char *name, struct rw_thread *threads,
+		       int pass)
+{
+	struct rw_pass sum;
+	unsigned long long elapsed;
+	int i, b;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < nr_threads; i++) {
+		struct rw_pass *p = &threads[i].pass[pass];
+
+		sum.pages += p->pages;
+		sum.total_ns += p->total_ns;
+		if (p->max_ns > sum.max_ns)
+			sum.max_ns = p->max_ns;
+		for (b = 0; b < LAT_BUCKETS; b++)
+			sum.hist[b] += p->hist[b];
+	}
+	elapsed = ts_ns(&pass_stop[pass]) - ts_ns(&pass_start[pass]);
+	if (!elapsed)
+		elapsed = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %llu pages in %llu.%03llu sec, %.1f MB/s\n",
+		       name, sum.pages, elapsed / 1000000000ULL,
+		       (elapsed / 1000000ULL) % 1000,
+		       (double)sum.pages * threads[0].page_size /
+		       (1 << 20) / ((double)elapsed / 1e9));
+		printf(" %14s  per page: mean %llu ns, max %llu ns\n", "",
+		       sum.pages ? sum.total_ns / sum.pages : 0, sum.max_ns);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			if (sum.hist[b])
+				printf(" %14s  < %10llu ns: %llu\n", "",
+				       2ULL << b, sum.hist[b]);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.1f\n", (double)sum.pages * threads[0].page_size /
+		       (1 << 20) / ((double)elapsed / 1e9));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+int bench_zram_rw(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct rw_thread *threads;
+	unsigned long long disk_size = 0;
+	struct stat st;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t pages;
+	int fd, i, err = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_zram_rw_usage, 0);
+
+	if (nr_threads <= 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (size_mb <= 0)
+		usage_with_options(bench_zram_rw_usage, options);
+
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", device,
+			strerror(errno));
+		return 1;
+	}
+	if (!fstat(fd, &st) && S_ISBLK(st.st_mode))
+		ioctl(fd, BLKGETSIZE64, &disk_size);
+	else
+		disk_size = st.st_size;
+
+	pages = ((size_t)size_mb << 20) / page_size;
+	if ((unsigned long long)pages * page_size * nr_threads > disk_size) {
+		fprintf(stderr, "%s is too small for %d threads of %d MB\n",
+			device, nr_threads, size_mb);
+		close(fd);
+		return 1;
+	}
+
+	threads = zalloc(nr_threads * sizeof(*threads));
+	if (!threads)
+		die("zalloc");
+	pthread_barrier_init(&rw_barrier, NULL, nr_threads + 1);
+
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].id = i;
+		threads[i].fd = fd;
+		threads[i].page_size = page_size;
+		threads[i].pages = pages;
+		threads[i].start = (off_t)i * pages * page_size;
+		if (pthread_create(&threads[i].thread, NULL, rw_worker,
+				   &threads[i]))
+			die("pthread_create");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &pass_start[0]);
+	pthread_barrier_wait(&rw_barrier);
+	pthread_barrier_wait(&rw_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &pass_stop[0]);
+
+	if (!no_read) {
+		clock_gettime(CLOCK_MONOTONIC, &pass_start[1]);
+		pthread_barrier_wait(&rw_barrier);
+		pthread_barrier_wait(&rw_barrier);
+		clock_gettime(CLOCK_MONOTONIC, &pass_stop[1]);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].err && !err)
+			err = threads[i].err;
+	}
+	close(fd);
+
+	if (err) {
+		fprintf(stderr, "I/O on %s failed: %s\n", device,
+			strerror(-err));
+		free(threads);
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d threads, %d MB each, %zu byte pages on %s\n\n",
+		       nr_threads, size_mb, page_size, device);
+	print_pass("Write", threads, 0);
+	if (!no_read)
+		print_pass("Read", threads, 1);
+
+	free(threads);
+	return 0;
+}
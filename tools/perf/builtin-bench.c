@@ -13,6 +13,10 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  zram  ... compressed RAM block device
+ *  binder ... Android binder IPC
+ *  lmk   ... Android lowmemorykiller
+ *  yaffs ... YAFFS2 flash file system
  *
  */
 
@@ -58,6 +62,49 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite zram_suites[] = {
+	{ "rw",
+	  "Parallel page writes and reads on a zram device",
+	  bench_zram_rw },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite binder_suites[] = {
+	{ "pingpong",
+	  "Synchronous transactions between client/server pairs",
+	  bench_binder_pingpong },
+	{ "sg",
+	  "Large transactions, copied or as scatter-gather buffers",
+	  bench_binder_sg },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite lmk_suites[] = {
+	{ "stress",
+	  "Shrinker cost per call while killing under memory pressure",
+	  bench_lmk_stress },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite yaffs_suites[] = {
+	{ "rw",
+	  "Parallel file writes and reads on a yaffs2 mount",
+	  bench_yaffs_rw },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +118,18 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "zram",
+	  "compressed RAM block device",
+	  zram_suites },
+	{ "binder",
+	  "Android binder IPC",
+	  binder_suites },
+	{ "lmk",
+	  "Android lowmemorykiller",
+	  lmk_suites },
+	{ "yaffs",
+	  "YAFFS2 flash file system",
+	  yaffs_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },